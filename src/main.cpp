@@ -1,50 +1,713 @@
-#include<iostream>
-#include<vector>
-#include<string>
-#include<algorithm>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 #include "mzd.hpp"
 
-int main() {
-    std::vector<double> data = {1, 2, 3, 4, 5};
-    buffer_t buffer;
-    buffer_t transposeBuffer;
+namespace fs = std::filesystem;
+
+/// @brief Command line options
+struct Options
+{
+    std::string dtype = "f64";
+    std::vector<std::string> codecs;
+    std::vector<int> levels = {ZSTD_defaultCLevel()};
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t repeat = 1;
+    size_t synthetic = 0;
+    bool concatenate = false;
+    size_t reference_stride = 0;
+    size_t anchor_interval = 16;
+    std::vector<std::string> param_specs = {"default"};
+    bool verify = true;
+    std::string output_dir;
+    std::vector<std::string> inputs;
+};
+
+/// @brief An input array and where it came from
+template <typename T>
+struct Array
+{
+    std::string name;
+    std::vector<T> values;
+};
 
-    std::vector<double> ref(data);
-    std::vector<double> revert;
+/// @brief A named encoder/decoder pair operating on arrays of `T`, with per-thread scratch space. `reference` is an
+/// earlier array of the same kind, empty for the first arrays of a sequence; codecs that do not use one ignore it.
+template <typename T>
+struct Codec
+{
+    std::string name;
+    std::function<void(const std::vector<T> &data, const std::vector<T> &reference, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)> encode;
+    std::function<void(const buffer_t &buffer, const std::vector<T> &reference, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)> decode;
+};
 
-    std::cout << "Decompressed size: " << revert.size() << std::endl;
-    for(auto i = 0; i < revert.size(); i++) {
-        std::cout << i << ": " << ref[i] << " " << revert[i] << std::endl;
+template <typename T>
+std::vector<Codec<T>> available_codecs()
+{
+    std::vector<Codec<T>> codecs;
+    codecs.push_back({"zstd",
+                      [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &)
+                      { mzd::compress_buffer(data, out, params); },
+                      [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &)
+                      { mzd::decompress_buffer(buffer, out, params); }});
+    codecs.push_back({"shuffle",
+                      [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                      { mzd::byteshuffle_compress_buffer(data, scratch, out, params); },
+                      [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                      { mzd::byteshuffle_decompress_buffer(buffer, scratch, out, params); }});
+    codecs.push_back({"planes",
+                      [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                      { mzd::byteshuffle_planes_compress_buffer(data, scratch, out, params); },
+                      [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                      { mzd::byteshuffle_decompress_buffer(buffer, scratch, out, params); }});
+    codecs.push_back({"dict",
+                      [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                      { mzd::dict_compress_buffer(data, scratch, out, params); },
+                      [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                      { mzd::dict_decompress_buffer(buffer, scratch, out, params); }});
+    codecs.push_back({"sparse",
+                      [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                      { mzd::sparse_compress_buffer(data, scratch, out, params); },
+                      [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                      { mzd::sparse_decompress_buffer(buffer, scratch, out, params); }});
+    codecs.push_back({"chunked",
+                      [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                      { mzd::chunked_compress_buffer(data, scratch, out, params); },
+                      [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                      { mzd::chunked_decompress_buffer(buffer, scratch, out, params); }});
+    if constexpr (std::is_integral_v<T>)
+    {
+        for (auto [name, zstd_stage] : {std::pair{"intpack", false}, std::pair{"intpack-zstd", true}})
+        {
+            codecs.push_back({name,
+                              [zstd_stage](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                              { mzd::intpack_compress_buffer(data, scratch, out, zstd_stage, params); },
+                              [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                              { mzd::intpack_decompress_buffer(buffer, scratch, out, params); }});
+        }
+    }
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        codecs.push_back({"xor",
+                          [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &, buffer_t &)
+                          { mzd::xor_compress_buffer(data, out); },
+                          [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &, buffer_t &)
+                          { mzd::xor_decompress_buffer(buffer, out); }});
+        codecs.push_back({"fields",
+                          [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                          { mzd::fields_compress_buffer(data, scratch, out, params); },
+                          [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                          { mzd::fields_decompress_buffer(buffer, scratch, out, params); }});
+        codecs.push_back({"grid",
+                          [](const std::vector<T> &data, const std::vector<T> &, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                          { mzd::grid_compress_buffer(data, scratch, out, params); },
+                          [](const buffer_t &buffer, const std::vector<T> &, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                          { mzd::grid_decompress_buffer(buffer, scratch, out, params); }});
+    }
+    for (auto [name, mode] : {std::pair{"ref-xor", mzd::reference::ResidualMode::Xor}, std::pair{"ref-delta", mzd::reference::ResidualMode::Delta}})
+    {
+        codecs.push_back({name,
+                          [mode](const std::vector<T> &data, const std::vector<T> &reference, buffer_t &out, const mzd::CompressionParams &params, buffer_t &scratch)
+                          { mzd::reference_compress_buffer<T>(data, reference, scratch, out, mode, 1, params); },
+                          [](const buffer_t &buffer, const std::vector<T> &reference, std::vector<T> &out, const mzd::DecompressionParams &params, buffer_t &scratch)
+                          { mzd::reference_decompress_buffer<T>(buffer, reference, scratch, out, params); }});
     }
+    return codecs;
+}
 
-    transposeBuffer.clear();
-    buffer_t dict_buffer;
-    std::cout << "Encoding dictionary" << std::endl;
-    mzd::dict::dictionary_encode<double>(ref, transposeBuffer, dict_buffer);
-    std::vector<double> read_out;
-    std::cout << "Decoding dictionary" << std::endl;
-    try {
-        mzd::dict::dictionary_decode(dict_buffer, read_out);
-    } catch(std::exception &err) {
-        std::cout << "Error: " << err.what() << std::endl;
-        return 1;
+/// @brief Parse a comma-separated list of ZSTD parameters such as "ldm,wlog=27,strategy=btopt" on top of `level`.
+/// "default" leaves every parameter but the level at ZSTD's choice.
+mzd::CompressionParams parse_params(const std::string &spec, int level)
+{
+    static const std::map<std::string, int> strategies = {
+        {"fast", ZSTD_fast}, {"dfast", ZSTD_dfast}, {"greedy", ZSTD_greedy}, {"lazy", ZSTD_lazy}, {"lazy2", ZSTD_lazy2}, {"btlazy2", ZSTD_btlazy2}, {"btopt", ZSTD_btopt}, {"btultra", ZSTD_btultra}, {"btultra2", ZSTD_btultra2}};
+    mzd::CompressionParams params(level);
+    std::stringstream ss(spec);
+    std::string token;
+    while (std::getline(ss, token, ','))
+    {
+        auto eq = token.find('=');
+        auto key = token.substr(0, eq);
+        auto value = eq == std::string::npos ? std::string() : token.substr(eq + 1);
+        if (key == "default" || key.empty())
+        {
+            continue;
+        }
+        else if (key == "ldm")
+        {
+            params.long_distance_matching = true;
+        }
+        else if (key == "checksum")
+        {
+            params.checksum = true;
+        }
+        else if (key == "wlog")
+        {
+            params.window_log = std::stoi(value);
+        }
+        else if (key == "strategy")
+        {
+            auto it = strategies.find(value);
+            params.strategy = it != strategies.end() ? it->second : std::stoi(value);
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown ZSTD parameter " + key);
+        }
     }
-    for (auto i = 0; i < revert.size(); i++)
+    return params;
+}
+
+/// @brief Peak resident set size of this process in bytes
+size_t peak_rss()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
     {
-        std::cout << i << ": " << ref[i] << " " << read_out[i] << std::endl;
+        return counters.PeakWorkingSetSize;
     }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024;
+#endif
+#endif
+}
 
-    revert.clear();
-    std::cout << "Encoding dictionary" << std::endl;
-    mzd::dict_compress_buffer<double>(ref, dict_buffer, buffer);
-    std::cout << "Decoding dictionary" << std::endl;
-    mzd::dict_decompress_buffer(buffer, dict_buffer, revert);
+/// @brief Read a raw little-endian array of `T` from `path`
+template <typename T>
+std::vector<T> read_array(const fs::path &path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+    {
+        throw std::runtime_error("Could not open " + path.string());
+    }
+    buffer_t bytes((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    if (bytes.size() % sizeof(T) != 0)
+    {
+        throw std::runtime_error(path.string() + " is not a whole number of " + std::to_string(sizeof(T)) + "-byte values");
+    }
+    std::vector<T> values(bytes.size() / sizeof(T));
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        std::array<uint8_t, sizeof(T)> raw;
+        std::copy(bytes.begin() + i * sizeof(T), bytes.begin() + (i + 1) * sizeof(T), raw.begin());
+        values[i] = mzd::binary::byte_view<T>::as_little_endian(raw).value();
+    }
+    return values;
+}
 
-    for (auto i = 0; i < revert.size(); i++)
+/// @brief Convert `value` to `T`, saturating at the limits of integral types
+template <typename T>
+T saturate(double value)
+{
+    if constexpr (std::is_integral_v<T>)
     {
-        std::cout << i << ": " << ref[i] << " " << read_out[i] << std::endl;
+        value = std::clamp(std::round(value), (double)std::numeric_limits<T>::min(), (double)std::numeric_limits<T>::max());
     }
+    return (T)value;
+}
 
-    return 0;
-}
\ No newline at end of file
+/// @brief Generate `n` profile spectra resembling an LC-MS run on a TOF instrument: each spectrum samples
+/// a sqrt-spaced m/z grid around the peaks of a shared pool of analytes, most of which recur from scan to scan,
+/// and its intensity array is zero away from peak apexes
+template <typename T>
+void synthetic_arrays(size_t n, std::vector<Array<T>> &arrays)
+{
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    auto next = [&state]()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (state >> 11) * (1.0 / 9007199254740992.0);
+    };
+
+    const double a = std::sqrt(200.0);
+    const double b = 8.5e-6;
+    struct Peak
+    {
+        size_t index;
+        size_t width;
+        double apex;
+    };
+    std::vector<Peak> pool;
+    size_t index = 0;
+    while (true)
+    {
+        index += 50 + (size_t)(next() * 2000);
+        double root = a + b * index;
+        if (root * root > 2000.0)
+        {
+            break;
+        }
+        Peak peak{index, 6 + (size_t)(next() * 10), 1e3 + next() * 1e5};
+        pool.push_back(peak);
+        index += peak.width;
+    }
+
+    for (size_t s = 0; s < n; s++)
+    {
+        std::vector<T> mz;
+        std::vector<T> intensity;
+        for (auto &peak : pool)
+        {
+            if (next() < 0.3)
+            {
+                continue;
+            }
+            double apex = peak.apex * (0.5 + next());
+            for (size_t k = 0; k < peak.width; k++)
+            {
+                double r = a + b * (peak.index + k);
+                mz.push_back(saturate<T>(r * r));
+                double x = ((double)k - peak.width / 2.0) / (peak.width / 5.0);
+                double value = k == 0 || k + 1 == peak.width ? 0.0 : apex * std::exp(-x * x);
+                intensity.push_back(saturate<T>(std::round(value * 16.0) / 16.0));
+            }
+        }
+        arrays.push_back({"synthetic_mz_" + std::to_string(s), std::move(mz)});
+        arrays.push_back({"synthetic_intensity_" + std::to_string(s), std::move(intensity)});
+    }
+}
+
+struct Totals
+{
+    size_t arrays = 0;
+    size_t bytes_in = 0;
+    size_t bytes_out = 0;
+    double encode_seconds = 0;
+    double decode_seconds = 0;
+    size_t failures = 0;
+};
+
+template <typename T>
+int run(const Options &options)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<Array<T>> arrays;
+    for (auto &input : options.inputs)
+    {
+        fs::path path(input);
+        if (fs::is_directory(path))
+        {
+            std::vector<fs::path> paths;
+            for (auto &entry : fs::directory_iterator(path))
+            {
+                if (entry.is_regular_file())
+                {
+                    paths.push_back(entry.path());
+                }
+            }
+            std::sort(paths.begin(), paths.end());
+            for (auto &p : paths)
+            {
+                arrays.push_back({p.string(), read_array<T>(p)});
+            }
+        }
+        else
+        {
+            arrays.push_back({path.string(), read_array<T>(path)});
+        }
+    }
+    if (options.synthetic > 0)
+    {
+        synthetic_arrays<T>(options.synthetic, arrays);
+    }
+    if (arrays.empty())
+    {
+        std::cerr << "No input arrays" << std::endl;
+        return 2;
+    }
+    // Arrays `stride` apart are consecutive arrays of the same kind, synthetic spectra alternate m/z and intensity
+    size_t stride = options.reference_stride > 0 ? options.reference_stride : (options.inputs.empty() ? 2 : 1);
+    if (options.concatenate)
+    {
+        stride = 1;
+        Array<T> joined{"concatenated", {}};
+        for (auto &array : arrays)
+        {
+            joined.values.insert(joined.values.end(), array.values.begin(), array.values.end());
+        }
+        arrays.clear();
+        arrays.push_back(std::move(joined));
+    }
+
+    mzd::DecompressionParams decompression_params;
+    for (auto &spec : options.param_specs)
+    {
+        decompression_params.max_window_log = std::max(decompression_params.max_window_log, parse_params(spec, 0).window_log);
+    }
+
+    std::vector<Codec<T>> codecs;
+    auto all = available_codecs<T>();
+    if (options.codecs.empty())
+    {
+        codecs = all;
+    }
+    for (auto &name : options.codecs)
+    {
+        auto it = std::find_if(all.begin(), all.end(), [&](const Codec<T> &c)
+                               { return c.name == name; });
+        if (it == all.end())
+        {
+            std::cerr << "Unknown codec " << name << ". Available:";
+            for (auto &c : all)
+            {
+                std::cerr << " " << c.name;
+            }
+            std::cerr << std::endl;
+            return 2;
+        }
+        codecs.push_back(*it);
+    }
+
+    if (!options.output_dir.empty())
+    {
+        fs::create_directories(options.output_dir);
+    }
+
+    struct Job
+    {
+        size_t codec;
+        int level;
+        size_t variant;
+        size_t array;
+    };
+    std::vector<Job> jobs;
+    for (size_t c = 0; c < codecs.size(); c++)
+    {
+        for (auto level : options.levels)
+        {
+            for (size_t v = 0; v < options.param_specs.size(); v++)
+            {
+                for (size_t a = 0; a < arrays.size(); a++)
+                {
+                    jobs.push_back({c, level, v, a});
+                }
+            }
+        }
+    }
+
+    std::map<std::tuple<size_t, int, size_t>, Totals> totals;
+    std::mutex totals_lock;
+    std::atomic<size_t> next_job{0};
+    auto wall_start = clock::now();
+
+    const std::vector<T> no_reference;
+    auto worker = [&]()
+    {
+        buffer_t compressed;
+        buffer_t scratch;
+        std::vector<T> decoded;
+        while (true)
+        {
+            auto j = next_job.fetch_add(1);
+            if (j >= jobs.size())
+            {
+                break;
+            }
+            auto &job = jobs[j];
+            auto &codec = codecs[job.codec];
+            auto &array = arrays[job.array];
+            auto params = parse_params(options.param_specs[job.variant], job.level);
+            // Every `anchor_interval`-th array of a kind is stored without a reference, the rest against the one before
+            auto position = job.array / stride;
+            const auto &reference = position % std::max<size_t>(options.anchor_interval, 1) == 0 ? no_reference : arrays[job.array - stride].values;
+            Totals local;
+            local.arrays = 1;
+            local.bytes_in = array.values.size() * sizeof(T);
+            try
+            {
+                for (size_t r = 0; r < options.repeat; r++)
+                {
+                    auto start = clock::now();
+                    codec.encode(array.values, reference, compressed, params, scratch);
+                    local.encode_seconds += std::chrono::duration<double>(clock::now() - start).count();
+                    if (options.verify)
+                    {
+                        decoded.clear();
+                        start = clock::now();
+                        codec.decode(compressed, reference, decoded, decompression_params, scratch);
+                        local.decode_seconds += std::chrono::duration<double>(clock::now() - start).count();
+                    }
+                }
+                local.bytes_out = compressed.size();
+                if (options.verify && (decoded.size() != array.values.size() ||
+                                       (local.bytes_in > 0 && std::memcmp(decoded.data(), array.values.data(), local.bytes_in) != 0)))
+                {
+                    local.failures = 1;
+                }
+                if (!options.output_dir.empty())
+                {
+                    auto stem = fs::path(array.name).filename().string();
+                    auto path = fs::path(options.output_dir) / (stem + "." + codec.name + ".l" + std::to_string(job.level) +
+                                                                (job.variant > 0 ? ".p" + std::to_string(job.variant) : ""));
+                    std::ofstream stream(path, std::ios::binary);
+                    stream.write((const char *)compressed.data(), compressed.size());
+                }
+            }
+            catch (std::exception &err)
+            {
+                std::lock_guard<std::mutex> guard(totals_lock);
+                std::cerr << codec.name << " failed on " << array.name << ": " << err.what() << std::endl;
+                local.failures = 1;
+            }
+            if (local.failures > 0 && options.verify)
+            {
+                std::lock_guard<std::mutex> guard(totals_lock);
+                std::cerr << codec.name << " level " << job.level << " did not round-trip " << array.name << std::endl;
+            }
+            std::lock_guard<std::mutex> guard(totals_lock);
+            auto &t = totals[{job.codec, job.level, job.variant}];
+            t.arrays += local.arrays;
+            t.bytes_in += local.bytes_in;
+            t.bytes_out += local.bytes_out;
+            t.encode_seconds += local.encode_seconds;
+            t.decode_seconds += local.decode_seconds;
+            t.failures += local.failures;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    auto n_threads = std::max<size_t>(1, std::min(options.threads, jobs.size()));
+    for (size_t i = 0; i < n_threads; i++)
+    {
+        pool.emplace_back(worker);
+    }
+    for (auto &thread : pool)
+    {
+        thread.join();
+    }
+    double wall = std::chrono::duration<double>(clock::now() - wall_start).count();
+
+    size_t failures = 0;
+    int codec_width = 10;
+    for (const auto &codec : codecs)
+    {
+        codec_width = std::max(codec_width, (int)codec.name.size());
+    }
+    std::printf("%-*s %6s %-20s %8s %12s %12s %8s %12s %12s %6s\n",
+                codec_width, "codec", "level", "params", "arrays", "input MB", "output MB", "ratio", "enc MB/s", "dec MB/s", "fail");
+    for (auto &[key, t] : totals)
+    {
+        double mb_in = t.bytes_in / 1e6;
+        double processed = mb_in * options.repeat;
+        std::printf("%-*s %6d %-20s %8zu %12.3f %12.3f %8.3f %12.1f %12.1f %6zu\n",
+                    codec_width,
+                    codecs[std::get<0>(key)].name.c_str(),
+                    std::get<1>(key),
+                    options.param_specs[std::get<2>(key)].c_str(),
+                    t.arrays,
+                    mb_in,
+                    t.bytes_out / 1e6,
+                    t.bytes_out > 0 ? (double)t.bytes_in / t.bytes_out : 0.0,
+                    t.encode_seconds > 0 ? processed / t.encode_seconds : 0.0,
+                    t.decode_seconds > 0 ? processed / t.decode_seconds : 0.0,
+                    t.failures);
+        failures += t.failures;
+    }
+    std::printf("threads: %zu, wall time: %.3f s, peak RSS: %.1f MB\n", n_threads, wall, peak_rss() / 1e6);
+    std::printf("MB/s are per thread, measured over the time spent inside each codec call\n");
+    return failures > 0 ? 1 : 0;
+}
+
+std::vector<std::string> split(const std::string &text, char delim)
+{
+    std::vector<std::string> parts;
+    std::stringstream ss(text);
+    std::string part;
+    while (std::getline(ss, part, delim))
+    {
+        if (!part.empty())
+        {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+void usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options] [FILE|DIRECTORY]...\n"
+              << "\n"
+              << "Compress raw little-endian arrays with each codec, verify the round trip and report\n"
+              << "compression ratio, encode/decode throughput and peak memory.\n"
+              << "\n"
+              << "Options:\n"
+              << "  -t, --dtype TYPE      element type of the input files: f64, f32, i64, i32, i16, u8 (default f64)\n"
+              << "  -c, --codec NAMES     comma-separated codecs to run (default: all)\n"
+              << "  -l, --level LEVELS    comma-separated ZSTD levels (default " << ZSTD_defaultCLevel() << ")\n"
+              << "  -j, --threads N       number of worker threads (default: all cores)\n"
+              << "  -r, --repeat N        encode/decode each array N times for steadier timings (default 1)\n"
+              << "  -p, --params SPEC     ZSTD parameters to compare, repeatable: \"default\" or a comma-separated list of\n"
+              << "                        ldm, checksum, wlog=N, strategy=fast|dfast|greedy|lazy|lazy2|btlazy2|btopt|btultra|btultra2\n"
+              << "  -s, --synthetic N     add N synthetic profile spectra (an m/z and an intensity array each)\n"
+              << "      --concatenate     join all input arrays into one before compressing\n"
+              << "      --reference-stride N\n"
+              << "                        ref-* codecs encode each array against the one N positions earlier\n"
+              << "                        (default 2 for synthetic spectra, which alternate m/z and intensity, 1 otherwise)\n"
+              << "      --anchor-interval N\n"
+              << "                        ref-* codecs store every N-th array of a kind without a reference (default 16)\n"
+              << "  -o, --output DIR      write each compressed buffer to DIR\n"
+              << "      --no-verify       only encode, skip decoding and comparison\n"
+              << "  -h, --help            show this message\n";
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    bool explicit_params = false;
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string
+            {
+                if (i + 1 >= argc)
+                {
+                    throw std::invalid_argument("Missing value for " + arg);
+                }
+                return argv[++i];
+            };
+            if (arg == "-h" || arg == "--help")
+            {
+                usage(argv[0]);
+                return 0;
+            }
+            else if (arg == "-t" || arg == "--dtype")
+            {
+                options.dtype = value();
+            }
+            else if (arg == "-c" || arg == "--codec")
+            {
+                options.codecs = split(value(), ',');
+            }
+            else if (arg == "-l" || arg == "--level")
+            {
+                options.levels.clear();
+                for (auto &level : split(value(), ','))
+                {
+                    options.levels.push_back(std::stoi(level));
+                }
+            }
+            else if (arg == "-j" || arg == "--threads")
+            {
+                options.threads = std::stoul(value());
+            }
+            else if (arg == "-r" || arg == "--repeat")
+            {
+                options.repeat = std::max<size_t>(1, std::stoul(value()));
+            }
+            else if (arg == "-p" || arg == "--params")
+            {
+                if (!explicit_params)
+                {
+                    options.param_specs.clear();
+                    explicit_params = true;
+                }
+                auto spec = value();
+                parse_params(spec, 0);
+                options.param_specs.push_back(spec);
+            }
+            else if (arg == "--concatenate")
+            {
+                options.concatenate = true;
+            }
+            else if (arg == "--reference-stride")
+            {
+                options.reference_stride = std::stoul(value());
+            }
+            else if (arg == "--anchor-interval")
+            {
+                options.anchor_interval = std::stoul(value());
+            }
+            else if (arg == "-s" || arg == "--synthetic")
+            {
+                options.synthetic = std::stoul(value());
+            }
+            else if (arg == "-o" || arg == "--output")
+            {
+                options.output_dir = value();
+            }
+            else if (arg == "--no-verify")
+            {
+                options.verify = false;
+            }
+            else if (!arg.empty() && arg[0] == '-')
+            {
+                throw std::invalid_argument("Unknown option " + arg);
+            }
+            else
+            {
+                options.inputs.push_back(arg);
+            }
+        }
+
+        if (options.inputs.empty() && options.synthetic == 0)
+        {
+            usage(argv[0]);
+            return 2;
+        }
+
+        if (options.dtype == "f64")
+        {
+            return run<double>(options);
+        }
+        else if (options.dtype == "f32")
+        {
+            return run<float>(options);
+        }
+        else if (options.dtype == "i64")
+        {
+            return run<int64_t>(options);
+        }
+        else if (options.dtype == "i32")
+        {
+            return run<int32_t>(options);
+        }
+        else if (options.dtype == "i16")
+        {
+            return run<int16_t>(options);
+        }
+        else if (options.dtype == "u8")
+        {
+            return run<uint8_t>(options);
+        }
+        throw std::invalid_argument("Unknown dtype " + options.dtype);
+    }
+    catch (std::exception &err)
+    {
+        std::cerr << "Error: " << err.what() << std::endl;
+        return 2;
+    }
+}
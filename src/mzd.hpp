@@ -1,17 +1,52 @@
 #ifndef _MZDHPP_
 #define _MZDHPP_
 
+// The window and frame header inspection used by `DecompressionParams` is part of ZSTD's static API
+#ifndef ZSTD_STATIC_LINKING_ONLY
+#define ZSTD_STATIC_LINKING_ONLY
+#endif
 #include <zstd.h>
+#if !defined(ZSTD_H_ZSTD_STATIC_LINKING_ONLY)
+#error "mzd.hpp needs ZSTD's static API, but <zstd.h> was included without it. Include mzd.hpp first or define ZSTD_STATIC_LINKING_ONLY before including <zstd.h>."
+#endif
 #include <array>
 #include <vector>
 #include <span>
 #include <unordered_map>
 #include <unordered_set>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <algorithm>
+#include <numeric>
 #include <bit>
 #include <sstream>
 #include <stdexcept>
+#include <chrono>
+#include <map>
+#include <deque>
+#include <utility>
+#include <type_traits>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <functional>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <exception>
+#include <list>
+#include <atomic>
+#include <optional>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MZD_X86_SIMD 1
+#include <immintrin.h>
+/// Compile a function for an instruction set extension, to be selected at runtime with `__builtin_cpu_supports`
+#define MZD_TARGET(isa) __attribute__((target(isa)))
+#endif
 
 using byte_t = std::uint8_t;
 using buffer_t = std::vector<byte_t>;
@@ -118,8 +153,193 @@ namespace mzd
                 return 0;
             }
         };
+
+        /// @brief The unsigned integer type with the same width as a `N` byte value
+        template <size_t N>
+        using uint_of = std::conditional_t<N == 1, uint8_t,
+                                           std::conditional_t<N == 2, uint16_t,
+                                                              std::conditional_t<N == 4, uint32_t, uint64_t>>>;
+
+        /// @brief Append `value` to `buffer` in little endian byte order
+        template <typename U>
+        void write_le(buffer_t &buffer, U value)
+        {
+            auto view = byte_view<U>::as_little_endian(value);
+            buffer.insert(buffer.end(), view.begin(), view.end());
+        }
+
+        /// @brief Read a little endian `U` from `data`
+        template <typename U>
+        U read_le(const byte_t *data)
+        {
+            byte_view<U> view;
+            std::memcpy((void *)&view, data, sizeof(U));
+            if constexpr (is_big_endian())
+            {
+                view.byteswap();
+            }
+            return view.value();
+        }
+
+        /// @brief Append `value` to `buffer` as a LEB128 variable length integer
+        inline void write_varint(buffer_t &buffer, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                buffer.push_back((byte_t)(value | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back((byte_t)value);
+        }
+
+        /// @brief Read a LEB128 variable length integer from `data` starting at `offset`, advancing `offset` past it
+        inline uint64_t read_varint(const buffer_span_t &data, size_t &offset)
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (offset >= data.size())
+                {
+                    throw std::runtime_error("Truncated variable length integer");
+                }
+                byte_t b = data[offset++];
+                value |= (uint64_t)(b & 0x7f) << shift;
+                if ((b & 0x80) == 0)
+                {
+                    return value;
+                }
+            }
+            throw std::runtime_error("Malformed variable length integer");
+        }
+
+        /// @brief Map signed integers onto unsigned ones so small magnitudes of either sign stay small
+        inline uint64_t zigzag_encode(int64_t value)
+        {
+            return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+        }
+
+        inline int64_t zigzag_decode(uint64_t value)
+        {
+            return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+        }
+
+        /// @brief A 64-bit FNV-1a hash of the little endian bytes of `data`
+        template <typename T>
+        uint64_t fingerprint(const std::span<const T> &data)
+        {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (const T &value : data)
+            {
+                auto view = byte_view<T>::as_little_endian(value);
+                for (auto b : view)
+                {
+                    hash = (hash ^ b) * 0x100000001b3ull;
+                }
+            }
+            return hash;
+        }
     }
 
+    /// @brief ZSTD compression parameters beyond the compression level.
+    ///
+    /// Implicitly constructible from a level, so any function taking `CompressionParams` also accepts a plain `int` level.
+    /// Fields left at 0 keep ZSTD's choice for the level and input size.
+    struct CompressionParams
+    {
+        /// @brief The ZSTD compression level. Negative levels select the fast modes.
+        int level = ZSTD_defaultCLevel();
+        /// @brief Log2 of the match window size. Frames written with a window log above 27 need
+        /// `DecompressionParams::max_window_log` raised to match when decoded.
+        int window_log = 0;
+        /// @brief Use long-distance matching, which finds repeats far back in large or concatenated arrays
+        bool long_distance_matching = false;
+        /// @brief The match finder strategy, one of `ZSTD_strategy`
+        int strategy = 0;
+        /// @brief Write a checksum of the decompressed content into the frame
+        bool checksum = false;
+
+        CompressionParams(int level = ZSTD_defaultCLevel()) : level(level) {}
+
+        /// @brief Apply these parameters to `cctx`, replacing whatever parameters it held before
+        void apply(ZSTD_CCtx *cctx) const
+        {
+            set(cctx, ZSTD_CCtx_reset(cctx, ZSTD_reset_parameters));
+            set(cctx, ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level));
+            if (window_log != 0)
+            {
+                set(cctx, ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, window_log));
+            }
+            if (long_distance_matching)
+            {
+                set(cctx, ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1));
+            }
+            if (strategy != 0)
+            {
+                set(cctx, ZSTD_CCtx_setParameter(cctx, ZSTD_c_strategy, strategy));
+            }
+            set(cctx, ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, checksum ? 1 : 0));
+        }
+
+    private:
+        static void set(ZSTD_CCtx *, size_t code)
+        {
+            if (ZSTD_isError(code))
+            {
+                throw std::invalid_argument(std::string("Invalid ZSTD compression parameter: ") + ZSTD_getErrorName(code));
+            }
+        }
+    };
+
+    /// @brief ZSTD decompression parameters
+    struct DecompressionParams
+    {
+        /// @brief Log2 of the largest match window a frame may require. 0 keeps ZSTD's default limit of 2^27 bytes.
+        /// Frames needing a larger window are rejected rather than allowed to allocate it.
+        int max_window_log = 0;
+
+        /// @brief The largest window size, in bytes, a frame may require
+        uint64_t max_window_size() const
+        {
+            return 1ull << (max_window_log != 0 ? max_window_log : ZSTD_WINDOWLOG_LIMIT_DEFAULT);
+        }
+
+        /// @brief Reject a frame whose header requires a larger window than permitted.
+        ///
+        /// Single-segment frames, whose window is the whole content, are always accepted since
+        /// the codecs decode a complete frame into an output buffer of that size anyway.
+        /// @param src The start of a ZSTD frame
+        /// @param size The number of bytes available at `src`
+        void check_frame(const void *src, size_t size) const
+        {
+            ZSTD_frameHeader header;
+            if (ZSTD_getFrameHeader(&header, src, size) != 0)
+            {
+                return;
+            }
+            if (header.frameType == ZSTD_frame && header.windowSize != header.frameContentSize && header.windowSize > max_window_size())
+            {
+                std::stringstream ss;
+                ss << "ZSTD frame requires a " << header.windowSize << " byte window but at most " << max_window_size()
+                   << " bytes are permitted, raise DecompressionParams::max_window_log to decode it";
+                throw std::runtime_error(ss.str());
+            }
+        }
+
+        /// @brief Apply these parameters to `dctx`, replacing whatever parameters it held before
+        void apply(ZSTD_DCtx *dctx) const
+        {
+            ZSTD_DCtx_reset(dctx, ZSTD_reset_parameters);
+            if (max_window_log != 0)
+            {
+                auto code = ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, max_window_log);
+                if (ZSTD_isError(code))
+                {
+                    throw std::invalid_argument(std::string("Invalid ZSTD decompression parameter: ") + ZSTD_getErrorName(code));
+                }
+            }
+        }
+    };
+
     /// @brief Implementation details of byte-shuffling codec
     namespace inner
     {
@@ -215,6 +435,257 @@ namespace mzd
             }
             return;
         }
+
+        /// @brief Throw a `std::runtime_error` describing a ZSTD error code if `code` is an error
+        /// @param code The return value of a ZSTD function
+        /// @return `code` if it was not an error
+        inline size_t check_zstd_error(size_t code)
+        {
+            if (ZSTD_isError(code))
+            {
+                auto errCode = ZSTD_getErrorCode(code);
+                std::stringstream ss;
+                ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(code)) << " " << std::string(ZSTD_getErrorString(errCode));
+                throw std::runtime_error(ss.str());
+            }
+            return code;
+        }
+
+        /// @brief Compress `size` bytes from `src` into `outBuffer` re-using the compression context `cctx`
+        /// @param cctx The ZSTD compression context to use
+        /// @param src The bytes to compress
+        /// @param size The number of bytes to compress
+        /// @param outBuffer The buffer to write the ZSTD frame into, resized to fit
+        /// @param params The ZSTD compression parameters
+        /// @return The number of bytes written to `outBuffer`
+        inline size_t zstd_compress_into(ZSTD_CCtx *cctx, const void *src, size_t size, buffer_t &outBuffer, const CompressionParams &params)
+        {
+            params.apply(cctx);
+            auto outputBound = check_zstd_error(ZSTD_compressBound(size));
+            outBuffer.resize(outputBound);
+            auto used = check_zstd_error(ZSTD_compress2(cctx, (void *)outBuffer.data(), outputBound, src, size));
+            outBuffer.resize(used);
+            return used;
+        }
+
+        /// @brief Compress `size` bytes from `src` into `outBuffer` with a temporary compression context
+        inline size_t zstd_compress_into(const void *src, size_t size, buffer_t &outBuffer, const CompressionParams &params)
+        {
+            std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+            if (!cctx)
+            {
+                throw std::runtime_error("Failed to allocate ZSTD compression context");
+            }
+            return zstd_compress_into(cctx.get(), src, size, outBuffer, params);
+        }
+
+        /// @brief Decompress a single ZSTD frame from `buffer` into `size` bytes at `dst` re-using the decompression context `dctx`
+        /// @param dctx The ZSTD decompression context to use
+        /// @param buffer The ZSTD frame to decompress
+        /// @param dst Where to write the decompressed bytes
+        /// @param size The capacity of `dst`
+        /// @param params The ZSTD decompression parameters
+        /// @return The number of bytes written to `dst`
+        inline size_t zstd_decompress_into(ZSTD_DCtx *dctx, const buffer_span_t &buffer, void *dst, size_t size, const DecompressionParams &params)
+        {
+            params.check_frame(buffer.data(), buffer.size());
+            params.apply(dctx);
+            return check_zstd_error(ZSTD_decompressDCtx(dctx, dst, size, (void *)buffer.data(), buffer.size()));
+        }
+
+        /// @brief The decompressed size recorded in the header of the ZSTD frame in `buffer`
+        inline size_t zstd_content_size(const buffer_span_t &buffer)
+        {
+            return check_zstd_error(ZSTD_getFrameContentSize(buffer.data(), buffer.size()));
+        }
+
+        /// @brief Decompress a single ZSTD frame from `buffer` into `outBuffer` re-using the decompression context `dctx`
+        /// @param dctx The ZSTD decompression context to use
+        /// @param buffer The ZSTD frame to decompress
+        /// @param outBuffer The buffer to write the decompressed bytes into, resized to fit
+        /// @param params The ZSTD decompression parameters
+        /// @return The number of bytes written to `outBuffer`
+        inline size_t zstd_decompress_into(ZSTD_DCtx *dctx, const buffer_span_t &buffer, buffer_t &outBuffer, const DecompressionParams &params = DecompressionParams())
+        {
+            auto outputBound = zstd_content_size(buffer);
+            outBuffer.resize(outputBound);
+            auto used = zstd_decompress_into(dctx, buffer, outBuffer.data(), outputBound, params);
+            outBuffer.resize(used);
+            return used;
+        }
+
+        /// @brief Decompress a single ZSTD frame from `buffer` into `outBuffer` with a temporary decompression context
+        inline size_t zstd_decompress_into(const buffer_span_t &buffer, buffer_t &outBuffer, const DecompressionParams &params = DecompressionParams())
+        {
+            std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+            if (!dctx)
+            {
+                throw std::runtime_error("Failed to allocate ZSTD decompression context");
+            }
+            return zstd_decompress_into(dctx.get(), buffer, outBuffer, params);
+        }
+
+        /// @brief Decompress the ZSTD frame in `buffer` through a small fixed-size block instead of a buffer holding
+        /// the whole output, handing `sink(const byte_t *bytes, size_t n)` whole values of `value_size` bytes as they
+        /// are produced
+        /// @param dctx The ZSTD decompression context to use
+        /// @param buffer The ZSTD frame to decompress
+        /// @param value_size The size of one value, `sink` is never handed a partial value
+        /// @param params The ZSTD decompression parameters
+        /// @param sink The callable receiving the decompressed bytes
+        template <typename F>
+        void zstd_decompress_blocks(ZSTD_DCtx *dctx, const buffer_span_t &buffer, size_t value_size, const DecompressionParams &params, F &&sink)
+        {
+            ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+            params.check_frame(buffer.data(), buffer.size());
+            params.apply(dctx);
+            std::array<byte_t, 1 << 15> block;
+            const size_t usable = block.size() - block.size() % value_size;
+            ZSTD_inBuffer in = {buffer.data(), buffer.size(), 0};
+            size_t carry = 0;
+            size_t remaining = 1;
+            while (in.pos < in.size || remaining != 0)
+            {
+                ZSTD_outBuffer out = {block.data(), usable, carry};
+                auto consumed = in.pos;
+                remaining = check_zstd_error(ZSTD_decompressStream(dctx, &out, &in));
+                auto whole = out.pos - out.pos % value_size;
+                if (whole > 0)
+                {
+                    sink(block.data(), whole);
+                }
+                carry = out.pos - whole;
+                std::memmove(block.data(), block.data() + whole, carry);
+                if (remaining != 0 && in.pos == consumed && whole == 0 && in.pos == in.size)
+                {
+                    throw std::runtime_error("Truncated ZSTD frame");
+                }
+            }
+            if (carry != 0)
+            {
+                throw std::runtime_error("Decompressed size is not a whole number of values");
+            }
+        }
+
+        /// @brief Writes a stream of byte shuffled values straight to where each byte belongs in the unshuffled
+        /// values, so the shuffled bytes never have to be held in full. Use it as the sink of `zstd_decompress_blocks`
+        /// with a value size of 1.
+        struct PlaneScatter
+        {
+            /// @brief The unshuffled values, `count` values of `value_size` bytes
+            byte_t *values = nullptr;
+            size_t count = 0;
+            size_t value_size = 1;
+            /// @brief How many bytes of the shuffled stream have been written
+            size_t position = 0;
+
+            /// @brief Write the next `n` bytes of the shuffled stream
+            void operator()(const byte_t *bytes, size_t n)
+            {
+                reserve(n);
+                while (n > 0)
+                {
+                    const size_t j = position % count;
+                    const size_t take = std::min(n, count - j);
+                    byte_t *dst = values + j * value_size + byte_of(position / count);
+                    for (size_t k = 0; k < take; k++)
+                    {
+                        dst[k * value_size] = bytes[k];
+                    }
+                    bytes += take;
+                    n -= take;
+                    position += take;
+                }
+            }
+
+            /// @brief Write `n` copies of `value` as the next bytes of the shuffled stream
+            void fill(byte_t value, size_t n)
+            {
+                reserve(n);
+                while (n > 0)
+                {
+                    const size_t j = position % count;
+                    const size_t take = std::min(n, count - j);
+                    byte_t *dst = values + j * value_size + byte_of(position / count);
+                    for (size_t k = 0; k < take; k++)
+                    {
+                        dst[k * value_size] = value;
+                    }
+                    n -= take;
+                    position += take;
+                }
+            }
+
+            /// @brief Whether every byte of every value has been written
+            bool complete() const
+            {
+                return position == count * value_size;
+            }
+
+        private:
+            void reserve(size_t n) const
+            {
+                if (n > count * value_size - position)
+                {
+                    throw std::runtime_error("Shuffled stream is longer than the values it holds");
+                }
+            }
+
+            size_t byte_of(size_t plane) const
+            {
+                if constexpr (is_big_endian())
+                {
+                    return value_size - 1 - plane;
+                }
+                else
+                {
+                    return plane;
+                }
+            }
+        };
+
+        /// @brief Reverses the byte shuffling done by `transpose` for values stored as `S`, converting each value to `T`
+        /// as it is reassembled so no array of `S` is ever materialized
+        /// @tparam S The stored data type
+        /// @tparam T The requested data type
+        /// @param buffer The transposed data
+        /// @param data Where to store the un-transposed, converted data
+        template <typename S, typename T>
+        void reverse_transpose_as(const buffer_span_t &buffer, std::vector<T> &data)
+        {
+            if constexpr (std::is_same_v<S, T>)
+            {
+                reverse_transpose<T>(buffer, data);
+            }
+            else
+            {
+                const auto nData = buffer.size() / sizeof(S);
+                data.resize(nData);
+                std::array<byte_t, sizeof(S)> bytes;
+                for (size_t j = 0; j < nData; j++)
+                {
+                    for (size_t i = 0; i < sizeof(S); i++)
+                    {
+                        bytes[i] = buffer[i * nData + j];
+                    }
+                    data[j] = static_cast<T>(binary::read_le<S>(bytes.data()));
+                }
+            }
+        }
+
+        /// @brief Convert `values` to `T`, passing them through untouched if they already are
+        template <typename T, typename S>
+        std::vector<T> convert_values(std::vector<S> &&values)
+        {
+            if constexpr (std::is_same_v<S, T>)
+            {
+                return std::move(values);
+            }
+            else
+            {
+                return std::vector<T>(values.begin(), values.end());
+            }
+        }
     }
 
     /// @brief Implementation of the dictionary codec
@@ -342,14 +813,25 @@ namespace mzd
             std::vector<I> blocks;
             reverse_transpose(slice, blocks);
 
-            auto i = 0;
-            for (auto chunk : blocks)
+            if constexpr (sizeof(I) != sizeof(T))
             {
-                T val = *reinterpret_cast<T *>(&chunk);
-                values.push_back(val);
-                i += 1;
+                // Only reachable through a header whose value width does not match `T`
+                std::stringstream ss;
+                ss << "Malformed dictionary, holds " << sizeof(I) << " byte values but " << sizeof(T) << " byte values were expected";
+                throw std::runtime_error(ss.str());
+            }
+            else
+            {
+                auto i = 0;
+                for (auto chunk : blocks)
+                {
+                    T val;
+                    std::memcpy(&val, &chunk, sizeof(T));
+                    values.push_back(val);
+                    i += 1;
+                }
+                return i;
             }
-            return i;
         }
 
         template <typename T, typename K>
@@ -381,13 +863,15 @@ namespace mzd
             return 0;
         }
 
-        /// @brief Decode a dictionary-compressed byte buffer
+        /// @brief Decode a dictionary-compressed byte buffer holding values of `T` as `Out`. The dictionary is converted
+        /// to `Out` once, before the indices are gathered, so conversion costs one operation per distinct value rather than per element.
         /// @tparam T The type being decoded
+        /// @tparam Out The type to decode elements as
         /// @param data The dictionary-encoded data buffer
         /// @param outBuffer The buffer to decode elements into
         /// @return 0 if successful, otherwise an error
-        template <typename T>
-        int dictionary_decode(const buffer_t &data, std::vector<T> &outBuffer)
+        template <typename T, typename Out>
+        int dictionary_decode_as(const buffer_t &data, std::vector<Out> &outBuffer)
         {
             if (data.size() < 16)
             {
@@ -431,21 +915,22 @@ namespace mzd
             if (value_size == 1)
             {
                 decode_values<T, uint8_t>(data, offset, n_values, value_lookup);
-                if (n_values < std::numeric_limits<uint8_t>::max())
+                auto lookup = inner::convert_values<Out>(std::move(value_lookup));
+                if (n_values <= std::numeric_limits<uint8_t>::max())
                 {
-                    decode_indices<T, uint8_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint8_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint16_t>::max())
+                else if (n_values <= std::numeric_limits<uint16_t>::max())
                 {
-                    decode_indices<T, uint16_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint16_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint32_t>::max())
+                else if (n_values <= std::numeric_limits<uint32_t>::max())
                 {
-                    decode_indices<T, uint32_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint32_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint64_t>::max())
+                else if (n_values <= std::numeric_limits<uint64_t>::max())
                 {
-                    decode_indices<T, uint64_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint64_t>(data, offset, lookup, outBuffer);
                 }
                 else
                 {
@@ -455,21 +940,22 @@ namespace mzd
             else if (value_size == 2)
             {
                 decode_values<T, uint16_t>(data, offset, n_values, value_lookup);
-                if (n_values < std::numeric_limits<uint8_t>::max())
+                auto lookup = inner::convert_values<Out>(std::move(value_lookup));
+                if (n_values <= std::numeric_limits<uint8_t>::max())
                 {
-                    decode_indices<T, uint8_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint8_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint16_t>::max())
+                else if (n_values <= std::numeric_limits<uint16_t>::max())
                 {
-                    decode_indices<T, uint16_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint16_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint32_t>::max())
+                else if (n_values <= std::numeric_limits<uint32_t>::max())
                 {
-                    decode_indices<T, uint32_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint32_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint64_t>::max())
+                else if (n_values <= std::numeric_limits<uint64_t>::max())
                 {
-                    decode_indices<T, uint64_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint64_t>(data, offset, lookup, outBuffer);
                 }
                 else
                 {
@@ -479,21 +965,22 @@ namespace mzd
             else if (value_size == 4)
             {
                 decode_values<T, uint32_t>(data, offset, n_values, value_lookup);
-                if (n_values < std::numeric_limits<uint8_t>::max())
+                auto lookup = inner::convert_values<Out>(std::move(value_lookup));
+                if (n_values <= std::numeric_limits<uint8_t>::max())
                 {
-                    decode_indices<T, uint8_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint8_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint16_t>::max())
+                else if (n_values <= std::numeric_limits<uint16_t>::max())
                 {
-                    decode_indices<T, uint16_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint16_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint32_t>::max())
+                else if (n_values <= std::numeric_limits<uint32_t>::max())
                 {
-                    decode_indices<T, uint32_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint32_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint64_t>::max())
+                else if (n_values <= std::numeric_limits<uint64_t>::max())
                 {
-                    decode_indices<T, uint64_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint64_t>(data, offset, lookup, outBuffer);
                 }
                 else
                 {
@@ -503,21 +990,22 @@ namespace mzd
             else if (value_size == 8)
             {
                 decode_values<T, uint64_t>(data, offset, n_values, value_lookup);
-                if (n_values < std::numeric_limits<uint8_t>::max())
+                auto lookup = inner::convert_values<Out>(std::move(value_lookup));
+                if (n_values <= std::numeric_limits<uint8_t>::max())
                 {
-                    decode_indices<T, uint8_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint8_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint16_t>::max())
+                else if (n_values <= std::numeric_limits<uint16_t>::max())
                 {
-                    decode_indices<T, uint16_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint16_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint32_t>::max())
+                else if (n_values <= std::numeric_limits<uint32_t>::max())
                 {
-                    decode_indices<T, uint32_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint32_t>(data, offset, lookup, outBuffer);
                 }
-                else if (n_values < std::numeric_limits<uint64_t>::max())
+                else if (n_values <= std::numeric_limits<uint64_t>::max())
                 {
-                    decode_indices<T, uint64_t>(data, offset, value_lookup, outBuffer);
+                    decode_indices<Out, uint64_t>(data, offset, lookup, outBuffer);
                 }
                 else
                 {
@@ -531,350 +1019,6417 @@ namespace mzd
 
             return 0;
         }
-    }
-    /// @brief Compress an array of numerical data using byte shuffling and ZSTD compression. Data will be stored in little endian byte order.
-    /// @tparam T The data type of the array to compress
-    /// @param data The data array to compress
-    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
-    /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
-    /// @param level The ZSTD compression level
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
-    template <typename T>
-    size_t byteshuffle_compress_buffer(const std::vector<T> &data,
-                                       buffer_t &transposeBuffer,
-                                       buffer_t &outBuffer,
-                                       int level = ZSTD_defaultCLevel())
-    {
-        const std::span<const T> view(data.data(), data.size());
-        return byteshuffle_compress_buffer(view, transposeBuffer, outBuffer, level);
-    }
 
-    /// @brief Compress an array of numerical data using byte shuffling and ZSTD compression. Data will be stored in little endian byte order.
-    /// @tparam T The data type of the array to compress
-    /// @param data The data array to compress
-    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
-    /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
-    /// @param level The ZSTD compression level
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
-    template <typename T>
-    size_t byteshuffle_compress_buffer(const std::span<const T> &data,
-                                       buffer_t &transposeBuffer,
-                                       buffer_t &outBuffer,
-                                       int level = ZSTD_defaultCLevel())
-    {
-        transposeBuffer.clear();
-        inner::transpose<T>(data, transposeBuffer);
-        auto outputBound = ZSTD_compressBound(transposeBuffer.size());
-        if (ZSTD_isError(outputBound))
+        /// @brief The width of the dictionary indices `encode_values` writes for a dictionary of `n_values`
+        inline size_t index_width(uint64_t n_values)
         {
-            auto errCode = ZSTD_getErrorCode(outputBound);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            if (n_values <= std::numeric_limits<uint8_t>::max())
+            {
+                return 1;
+            }
+            else if (n_values <= std::numeric_limits<uint16_t>::max())
+            {
+                return 2;
+            }
+            else if (n_values <= std::numeric_limits<uint32_t>::max())
+            {
+                return 4;
+            }
+            return 8;
         }
-        outBuffer.resize(outputBound);
-        auto used = ZSTD_compress(
-            (void *)outBuffer.data(),
-            outputBound,
-            (void *)transposeBuffer.data(),
-            transposeBuffer.size(),
-            level);
-        if (ZSTD_isError(used))
+
+        /// @brief Gather `lookup[index]` for the `n` indices of width `K` at the start of `dataBuffer`'s memory (or in
+        /// `indices` if they did not fit there), walking backwards so no index is overwritten before it is read
+        template <typename T, typename K>
+        void expand_indices(const byte_t *indices, const std::vector<T> &lookup, std::vector<T> &dataBuffer)
         {
-            auto errCode = ZSTD_getErrorCode(used);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            for (size_t j = dataBuffer.size(); j-- > 0;)
+            {
+                K index;
+                std::memcpy(&index, indices + j * sizeof(K), sizeof(K));
+                if (index >= lookup.size())
+                {
+                    std::stringstream ss;
+                    ss << "Malformed dictionary, decoded index " << (uint64_t)index << " but dictionary contains only " << lookup.size() << " values";
+                    throw std::runtime_error(ss.str());
+                }
+                dataBuffer[j] = lookup[index];
+            }
         }
-        outBuffer.resize(used);
-        return 0;
-    }
-
-    /// @brief Compress an array of numerical data using byte shuffling and ZSTD compression
-    /// @tparam T The data type of the array to compress
-    /// @param data The data array to compress
-    /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
-    /// @param level The ZSTD compression level
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
-    template <typename T>
-    size_t byteshuffle_compress_buffer(const std::vector<T> &data,
-                                       buffer_t &outBuffer,
-                                       int level = ZSTD_defaultCLevel())
-    {
-        buffer_t transposeBuffer;
-        return byteshuffle_compress_buffer(data, transposeBuffer, outBuffer, level);
-    }
 
-    /// @brief Decompress an array of numerical data using byte shuffling and ZSTD compression
-    /// @tparam T The data type of the array to compress
-    /// @param buffer A byte buffer to containing ZSTD-compressed bytes
-    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
-    /// @param dataBuffer The data array to decompress into
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
-    template <typename T>
-    size_t byteshuffle_decompress_buffer(const buffer_span_t &buffer,
+        /// @brief Decompress and decode a dictionary-compressed ZSTD frame without a buffer for the whole decompressed
+        /// stream. The frame is streamed through a small block, the dictionary is kept aside and the indices are
+        /// unshuffled straight into the memory of `dataBuffer`, then replaced by their values in place.
+        template <typename T>
+        void dictionary_decode_streaming(ZSTD_DCtx *dctx, const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params)
+        {
+            const size_t total = inner::zstd_content_size(buffer);
+            buffer_t head;
+            buffer_t indices;
+            bool have_header = false;
+            uint64_t offset = 16;
+            uint64_t n_values = 0;
+            size_t width = 0;
+            size_t consumed = 0;
+            inner::PlaneScatter scatter;
+            inner::zstd_decompress_blocks(dctx, buffer, 1, params, [&](const byte_t *bytes, size_t n)
+                                          {
+                while (n > 0)
+                {
+                    if (consumed >= offset)
+                    {
+                        scatter(bytes, n);
+                        consumed += n;
+                        return;
+                    }
+                    const size_t take = std::min<size_t>(n, offset - consumed);
+                    head.insert(head.end(), bytes, bytes + take);
+                    bytes += take;
+                    n -= take;
+                    consumed += take;
+                    if (!have_header && consumed == 16)
+                    {
+                        have_header = true;
+                        offset = binary::read_le<uint64_t>(head.data());
+                        n_values = binary::read_le<uint64_t>(head.data() + 8);
+                        if (offset < 16 || offset > total || offset - 16 != n_values * sizeof(T))
+                        {
+                            throw std::runtime_error("Malformed dictionary, header does not match the value type");
+                        }
+                        width = index_width(n_values);
+                        if ((total - offset) % width != 0 || (n_values == 0 && total != offset))
+                        {
+                            throw std::runtime_error("Malformed dictionary, indices are not a whole number of values");
+                        }
+                        const size_t count = (total - offset) / width;
+                        dataBuffer.resize(count);
+                        byte_t *target = (byte_t *)dataBuffer.data();
+                        if (width > sizeof(T))
+                        {
+                            // Indices wider than the values themselves, only possible for 1 and 2 byte types
+                            indices.resize(count * width);
+                            target = indices.data();
+                        }
+                        scatter = inner::PlaneScatter{target, count, width};
+                        head.reserve(offset);
+                    }
+                } });
+            if (!have_header)
+            {
+                if (total == 0)
+                {
+                    dataBuffer.clear();
+                    return;
+                }
+                throw std::runtime_error("Buffer less than 16 bytes long, invalid dictionary buffer");
+            }
+            if (!scatter.complete() || consumed != total)
+            {
+                throw std::runtime_error("Malformed dictionary, decompressed size does not match the frame header");
+            }
+            if (n_values == 0)
+            {
+                dataBuffer.clear();
+                return;
+            }
+            std::vector<T> lookup;
+            inner::reverse_transpose<T>(buffer_span_t(head).subspan(16), lookup);
+            const byte_t *source = indices.empty() ? (const byte_t *)dataBuffer.data() : indices.data();
+            switch (width)
+            {
+            case 1:
+                expand_indices<T, uint8_t>(source, lookup, dataBuffer);
+                break;
+            case 2:
+                expand_indices<T, uint16_t>(source, lookup, dataBuffer);
+                break;
+            case 4:
+                expand_indices<T, uint32_t>(source, lookup, dataBuffer);
+                break;
+            default:
+                expand_indices<T, uint64_t>(source, lookup, dataBuffer);
+                break;
+            }
+        }
+
+        /// @brief Decode a dictionary-compressed byte buffer
+        /// @tparam T The type being decoded
+        /// @param data The dictionary-encoded data buffer
+        /// @param outBuffer The buffer to decode elements into
+        /// @return 0 if successful, otherwise an error
+        template <typename T>
+        int dictionary_decode(const buffer_t &data, std::vector<T> &outBuffer)
+        {
+            return dictionary_decode_as<T, T>(data, outBuffer);
+        }
+    }
+    /// @brief Base64 encoding and decoding, as used for binary data arrays embedded in mzML.
+    ///
+    /// On x86 the bulk of the work is done 12 bytes (16 characters) at a time with SSSE3 when the CPU supports it,
+    /// with a scalar loop for the tail and for other platforms. Decoding rejects any character outside the standard
+    /// alphabet, including whitespace.
+    namespace base64
+    {
+        inline constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        /// @brief Reverse lookup table from character to 6-bit value, -1 for characters outside the alphabet
+        inline constexpr std::array<int8_t, 256> decode_table = []()
+        {
+            std::array<int8_t, 256> table{};
+            table.fill(-1);
+            for (int i = 0; i < 64; i++)
+            {
+                table[(uint8_t)alphabet[i]] = (int8_t)i;
+            }
+            return table;
+        }();
+
+        /// @brief The number of characters needed to encode `n` bytes, including padding
+        inline constexpr size_t encoded_size(size_t n)
+        {
+            return ((n + 2) / 3) * 4;
+        }
+
+        /// @brief The number of bytes `text` decodes to, accounting for padding
+        inline size_t decoded_size(std::string_view text)
+        {
+            auto n = text.size();
+            while (n > 0 && text[n - 1] == '=' && text.size() - n < 2)
+            {
+                n--;
+            }
+            return (n / 4) * 3 + ((n % 4) * 3) / 4;
+        }
+
+        inline bool has_simd()
+        {
+#ifdef MZD_X86_SIMD
+            static const bool supported = __builtin_cpu_supports("ssse3");
+            return supported;
+#else
+            return false;
+#endif
+        }
+
+        [[noreturn]] inline void throw_invalid(size_t position)
+        {
+            std::stringstream ss;
+            ss << "Invalid base64 input at character " << position;
+            throw std::runtime_error(ss.str());
+        }
+
+#ifdef MZD_X86_SIMD
+        /// @brief Encode `n / 12` groups of 12 bytes while at least 16 bytes are readable, returning the number of bytes consumed
+        MZD_TARGET("ssse3")
+        inline size_t encode_ssse3(const byte_t *src, size_t n, char *dst)
+        {
+            const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+            const __m128i shift_lut = _mm_setr_epi8(
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                '/' - 63, 'A', 0, 0);
+            size_t i = 0;
+            for (; i + 16 <= n; i += 12, dst += 16)
+            {
+                __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+                in = _mm_shuffle_epi8(in, shuffle);
+                // Split each group of 3 bytes into four 6-bit indices, one per output byte
+                const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+                const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+                const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+                const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+                const __m128i indices = _mm_or_si128(t1, t3);
+                // Map each index range onto the offset that turns it into its ASCII character
+                __m128i offsets = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+                const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+                offsets = _mm_or_si128(offsets, _mm_and_si128(less, _mm_set1_epi8(13)));
+                offsets = _mm_shuffle_epi8(shift_lut, offsets);
+                _mm_storeu_si128((__m128i *)dst, _mm_add_epi8(offsets, indices));
+            }
+            return i;
+        }
+
+        /// @brief Decode groups of 16 characters while at least 24 characters remain, returning the number of characters consumed.
+        /// Stops early, without consuming the group, at the first group containing a character outside the alphabet.
+        MZD_TARGET("ssse3")
+        inline size_t decode_ssse3(const char *src, size_t n, byte_t *dst)
+        {
+            const __m128i lut_lo = _mm_setr_epi8(
+                0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+            const __m128i lut_hi = _mm_setr_epi8(
+                0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+            const __m128i lut_roll = _mm_setr_epi8(
+                0, 16, 19, 4, -65, -65, -71, -71,
+                0, 0, 0, 0, 0, 0, 0, 0);
+            const __m128i mask_2f = _mm_set1_epi8(0x2f);
+            const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+            size_t i = 0;
+            for (; i + 24 <= n; i += 16, dst += 12)
+            {
+                __m128i str = _mm_loadu_si128((const __m128i *)(src + i));
+                const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+                const __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+                const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+                const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+                if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+                {
+                    break;
+                }
+                const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+                const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+                str = _mm_add_epi8(str, roll);
+                // Pack four 6-bit values per 32-bit lane back into 3 bytes
+                const __m128i merged = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+                const __m128i out = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+                _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(out, pack));
+            }
+            return i;
+        }
+#endif
+
+        /// @brief Encode `n` bytes from `src` into `encoded_size(n)` characters at `dst`, padding the final group with '='
+        inline void encode(const byte_t *src, size_t n, char *dst)
+        {
+            size_t i = 0;
+#ifdef MZD_X86_SIMD
+            if (has_simd())
+            {
+                i = encode_ssse3(src, n, dst);
+                dst += (i / 3) * 4;
+            }
+#endif
+            for (; i + 3 <= n; i += 3, dst += 4)
+            {
+                uint32_t group = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | (uint32_t)src[i + 2];
+                dst[0] = alphabet[(group >> 18) & 0x3f];
+                dst[1] = alphabet[(group >> 12) & 0x3f];
+                dst[2] = alphabet[(group >> 6) & 0x3f];
+                dst[3] = alphabet[group & 0x3f];
+            }
+            if (i < n)
+            {
+                uint32_t group = (uint32_t)src[i] << 16;
+                if (i + 1 < n)
+                {
+                    group |= (uint32_t)src[i + 1] << 8;
+                }
+                dst[0] = alphabet[(group >> 18) & 0x3f];
+                dst[1] = alphabet[(group >> 12) & 0x3f];
+                dst[2] = i + 1 < n ? alphabet[(group >> 6) & 0x3f] : '=';
+                dst[3] = '=';
+            }
+        }
+
+        /// @brief Encode `data` and append the characters to `out`
+        inline void encode(const buffer_span_t &data, std::string &out)
+        {
+            auto start = out.size();
+            out.resize(start + encoded_size(data.size()));
+            encode(data.data(), data.size(), out.data() + start);
+        }
+
+        /// @brief Decode `text` into `dst`, which must have room for `decoded_size(text)` bytes
+        /// @return The number of bytes written
+        inline size_t decode(std::string_view text, byte_t *dst)
+        {
+            auto n = text.size();
+            auto padding = n - (text.find_last_not_of('=') + 1);
+            if (n == 0)
+            {
+                return 0;
+            }
+            if (padding > 2 || (padding > 0 && n % 4 != 0))
+            {
+                throw_invalid(n - padding);
+            }
+            n -= padding;
+            if (n % 4 == 1)
+            {
+                throw_invalid(n - 1);
+            }
+            const char *src = text.data();
+            byte_t *start = dst;
+            size_t i = 0;
+#ifdef MZD_X86_SIMD
+            if (has_simd())
+            {
+                i = decode_ssse3(src, n, dst);
+                dst += (i / 4) * 3;
+            }
+#endif
+            for (; i + 4 <= n; i += 4, dst += 3)
+            {
+                int32_t a = decode_table[(uint8_t)src[i]];
+                int32_t b = decode_table[(uint8_t)src[i + 1]];
+                int32_t c = decode_table[(uint8_t)src[i + 2]];
+                int32_t d = decode_table[(uint8_t)src[i + 3]];
+                if ((a | b | c | d) < 0)
+                {
+                    for (size_t j = i; j < i + 4; j++)
+                    {
+                        if (decode_table[(uint8_t)src[j]] < 0)
+                        {
+                            throw_invalid(j);
+                        }
+                    }
+                }
+                uint32_t group = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | (uint32_t)d;
+                dst[0] = (byte_t)(group >> 16);
+                dst[1] = (byte_t)(group >> 8);
+                dst[2] = (byte_t)group;
+            }
+            if (i < n)
+            {
+                uint32_t group = 0;
+                for (size_t j = i; j < n; j++)
+                {
+                    int32_t v = decode_table[(uint8_t)src[j]];
+                    if (v < 0)
+                    {
+                        throw_invalid(j);
+                    }
+                    group |= (uint32_t)v << (18 - 6 * (j - i));
+                }
+                *dst++ = (byte_t)(group >> 16);
+                if (n - i == 3)
+                {
+                    *dst++ = (byte_t)(group >> 8);
+                }
+            }
+            return dst - start;
+        }
+
+        /// @brief Decode `text` into `out`, replacing its contents
+        inline size_t decode(std::string_view text, buffer_t &out)
+        {
+            out.resize(decoded_size(text));
+            auto used = decode(text, out.data());
+            out.resize(used);
+            return used;
+        }
+
+        /// @brief Incrementally base64-encode a byte stream into a string, carrying partial 3-byte groups between calls
+        class Encoder
+        {
+        public:
+            Encoder(std::string &out) : out_(out) {}
+
+            /// @brief Encode as many complete groups of `data` as possible, holding back up to two bytes
+            void update(const byte_t *data, size_t n)
+            {
+                while (n_carry_ > 0 && n_carry_ < 3 && n > 0)
+                {
+                    carry_[n_carry_++] = *data++;
+                    n--;
+                }
+                if (n_carry_ == 3)
+                {
+                    append(carry_.data(), 3);
+                    n_carry_ = 0;
+                }
+                auto whole = n - (n % 3);
+                append(data, whole);
+                for (size_t i = whole; i < n; i++)
+                {
+                    carry_[n_carry_++] = data[i];
+                }
+            }
+
+            /// @brief Encode any held back bytes, with padding
+            void finish()
+            {
+                append(carry_.data(), n_carry_);
+                n_carry_ = 0;
+            }
+
+        private:
+            std::string &out_;
+            std::array<byte_t, 3> carry_;
+            size_t n_carry_ = 0;
+
+            void append(const byte_t *data, size_t n)
+            {
+                auto start = out_.size();
+                out_.resize(start + encoded_size(n));
+                encode(data, n, out_.data() + start);
+            }
+        };
+
+        /// @brief Compress `size` bytes with ZSTD, base64-encoding each output block as it is produced
+        /// so the complete binary frame is never held in memory.
+        /// @param src The bytes to compress
+        /// @param size The number of bytes to compress
+        /// @param out The string to append the encoded frame to
+        /// @param params The ZSTD compression parameters
+        /// @return The number of characters appended to `out`
+        inline size_t zstd_compress_to_base64(const void *src, size_t size, std::string &out, const CompressionParams &params)
+        {
+            std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+            if (!cctx)
+            {
+                throw std::runtime_error("Failed to allocate ZSTD compression context");
+            }
+            params.apply(cctx.get());
+            inner::check_zstd_error(ZSTD_CCtx_setPledgedSrcSize(cctx.get(), size));
+
+            // A multiple of 3 so whole blocks encode without carrying bytes over
+            buffer_t block(((ZSTD_CStreamOutSize() + 2) / 3) * 3);
+            auto start = out.size();
+            Encoder encoder(out);
+            ZSTD_inBuffer input = {src, size, 0};
+            size_t remaining = 0;
+            do
+            {
+                ZSTD_outBuffer output = {block.data(), block.size(), 0};
+                remaining = inner::check_zstd_error(ZSTD_compressStream2(cctx.get(), &output, &input, ZSTD_e_end));
+                encoder.update(block.data(), output.pos);
+            } while (remaining != 0);
+            encoder.finish();
+            return out.size() - start;
+        }
+
+        /// @brief Decode base64 text holding a single ZSTD frame and decompress it, decoding the text a block at a time
+        /// so the complete binary frame is never held in memory.
+        /// @param text The base64-encoded ZSTD frame
+        /// @param reserve A callable taking the decompressed size from the frame header and returning a pointer to that many writable bytes
+        /// @param params The ZSTD decompression parameters
+        /// @return The number of decompressed bytes
+        template <typename F>
+        size_t zstd_decompress_from_base64(std::string_view text, F &&reserve, const DecompressionParams &params = DecompressionParams())
+        {
+            // 4 characters decode to 3 bytes, so blocks of 4 * 4096 characters never split a group
+            constexpr size_t text_block = 4 * 4096;
+            std::array<byte_t, (text_block / 4) * 3> block;
+
+            auto first = text.substr(0, text_block);
+            if (first.size() < text.size() && first.back() == '=')
+            {
+                throw_invalid(first.size() - 1);
+            }
+            auto n = decode(first, block.data());
+            params.check_frame(block.data(), n);
+            auto outputBound = inner::check_zstd_error(ZSTD_getFrameContentSize(block.data(), n));
+            byte_t *dst = reserve((size_t)outputBound);
+
+            std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+            if (!dctx)
+            {
+                throw std::runtime_error("Failed to allocate ZSTD decompression context");
+            }
+            params.apply(dctx.get());
+            ZSTD_outBuffer output = {dst, (size_t)outputBound, 0};
+            size_t offset = first.size();
+            size_t remaining = 1;
+            while (true)
+            {
+                ZSTD_inBuffer input = {block.data(), n, 0};
+                while (input.pos < input.size)
+                {
+                    auto in_pos = input.pos;
+                    auto out_pos = output.pos;
+                    remaining = inner::check_zstd_error(ZSTD_decompressStream(dctx.get(), &output, &input));
+                    if (remaining == 0 && input.pos < input.size)
+                    {
+                        throw std::runtime_error("Trailing data after ZSTD frame in base64 input");
+                    }
+                    if (input.pos == in_pos && output.pos == out_pos)
+                    {
+                        throw std::runtime_error("ZSTD frame is larger than its declared content size");
+                    }
+                }
+                if (offset >= text.size())
+                {
+                    break;
+                }
+                auto next = text.substr(offset, text_block);
+                offset += next.size();
+                if (offset < text.size() && next.back() == '=')
+                {
+                    throw_invalid(offset - 1);
+                }
+                n = decode(next, block.data());
+            }
+            if (remaining != 0)
+            {
+                throw std::runtime_error("Truncated ZSTD frame in base64 input");
+            }
+            return output.pos;
+        }
+    }
+    /// @brief Implementation of per-plane coding for byte shuffled data.
+    ///
+    /// After shuffling, the byte planes of an array behave very differently: sign and exponent planes are nearly
+    /// constant, the top mantissa planes compress well and the lowest ones are noise. Each plane is classified and
+    /// stored on its own, so a constant plane costs one byte and a noise plane is copied without running the entropy
+    /// coder over it.
+    ///
+    /// Frame layout, all integers little endian:
+    ///  - 4 byte magic "MZPL", 1 byte version, 1 byte value size, 2 reserved bytes
+    ///  - u64 number of values
+    ///  - per plane: 1 byte `PlaneMode` and the u64 size of its payload
+    ///  - the planes' payloads, one after another: the repeated byte, the raw bytes or a ZSTD frame
+    namespace planes
+    {
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'P', 'L'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + sizeof(uint64_t);
+        inline constexpr size_t plane_entry_size = 1 + sizeof(uint64_t);
+        /// @brief Planes longer than this are first tried on a sample, and stored raw without running ZSTD over the
+        /// whole plane if the sample does not compress
+        inline constexpr size_t sample_threshold = 1 << 16;
+        inline constexpr size_t sample_window = 1 << 12;
+        inline constexpr size_t sample_windows = 16;
+
+        enum class PlaneMode : uint8_t
+        {
+            /// @brief Every byte of the plane is the same
+            Constant = 0,
+            /// @brief Stored as is
+            Raw = 1,
+            /// @brief Stored as its own ZSTD frame
+            Compressed = 2,
+        };
+
+        /// @brief Whether `buffer` holds a per-plane frame rather than a plain ZSTD frame
+        inline bool is_plane_frame(const buffer_span_t &buffer)
+        {
+            return buffer.size() >= magic.size() && std::equal(magic.begin(), magic.end(), buffer.begin());
+        }
+
+        /// @brief Whether a long plane looks like noise, judged by compressing a few evenly spaced windows of it at
+        /// ZSTD's fastest level. Byte frequencies alone are not enough, as the middle planes of a smooth sequence
+        /// have near uniform bytes yet compress well through repeated patterns.
+        inline bool looks_incompressible(ZSTD_CCtx *cctx, const byte_t *plane, size_t n)
+        {
+            if (n <= sample_threshold)
+            {
+                return false;
+            }
+            buffer_t sample;
+            sample.reserve(sample_window * sample_windows);
+            const size_t stride = (n - sample_window) / (sample_windows - 1);
+            for (size_t i = 0; i < sample_windows; i++)
+            {
+                sample.insert(sample.end(), plane + i * stride, plane + i * stride + sample_window);
+            }
+            buffer_t compressed;
+            if (cctx != nullptr)
+            {
+                inner::zstd_compress_into(cctx, sample.data(), sample.size(), compressed, 1);
+            }
+            else
+            {
+                inner::zstd_compress_into(sample.data(), sample.size(), compressed, 1);
+            }
+            return compressed.size() >= sample.size() - sample.size() / 64;
+        }
+
+        /// @brief Classify and encode one plane of `n` bytes, returning its mode and writing its payload to `payload`
+        inline PlaneMode encode_plane(ZSTD_CCtx *cctx, const byte_t *plane, size_t n, buffer_t &payload, const CompressionParams &params)
+        {
+            if (std::all_of(plane, plane + n, [&](byte_t b)
+                            { return b == plane[0]; }))
+            {
+                payload.assign(1, n == 0 ? 0 : plane[0]);
+                return PlaneMode::Constant;
+            }
+            if (!looks_incompressible(cctx, plane, n))
+            {
+                if (cctx != nullptr)
+                {
+                    inner::zstd_compress_into(cctx, plane, n, payload, params);
+                }
+                else
+                {
+                    inner::zstd_compress_into(plane, n, payload, params);
+                }
+                if (payload.size() < n)
+                {
+                    return PlaneMode::Compressed;
+                }
+            }
+            payload.assign(plane, plane + n);
+            return PlaneMode::Raw;
+        }
+
+        /// @brief Encode the shuffled bytes of `n` values of `value_size` bytes each into `outBuffer`
+        /// @param parallel Whether to encode the planes concurrently, one thread per plane
+        inline void encode(const buffer_span_t &shuffled, size_t value_size, buffer_t &outBuffer, const CompressionParams &params, bool parallel)
+        {
+            const size_t n = shuffled.size() / value_size;
+            std::vector<buffer_t> payloads(value_size);
+            std::vector<PlaneMode> modes(value_size);
+            if (parallel && value_size > 1)
+            {
+                std::vector<std::future<PlaneMode>> pending;
+                for (size_t i = 0; i < value_size; i++)
+                {
+                    pending.push_back(std::async(std::launch::async, [&, i]()
+                                                 { return encode_plane(nullptr, shuffled.data() + i * n, n, payloads[i], params); }));
+                }
+                for (size_t i = 0; i < value_size; i++)
+                {
+                    modes[i] = pending[i].get();
+                }
+            }
+            else
+            {
+                std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+                if (!cctx)
+                {
+                    throw std::runtime_error("Failed to allocate ZSTD compression context");
+                }
+                for (size_t i = 0; i < value_size; i++)
+                {
+                    modes[i] = encode_plane(cctx.get(), shuffled.data() + i * n, n, payloads[i], params);
+                }
+            }
+
+            size_t total = header_size + value_size * plane_entry_size;
+            for (auto &payload : payloads)
+            {
+                total += payload.size();
+            }
+            outBuffer.clear();
+            outBuffer.reserve(total);
+            outBuffer.insert(outBuffer.end(), magic.begin(), magic.end());
+            outBuffer.push_back(version);
+            outBuffer.push_back((byte_t)value_size);
+            outBuffer.push_back(0);
+            outBuffer.push_back(0);
+            binary::write_le<uint64_t>(outBuffer, n);
+            for (size_t i = 0; i < value_size; i++)
+            {
+                outBuffer.push_back((byte_t)modes[i]);
+                binary::write_le<uint64_t>(outBuffer, payloads[i].size());
+            }
+            for (auto &payload : payloads)
+            {
+                outBuffer.insert(outBuffer.end(), payload.begin(), payload.end());
+            }
+        }
+
+        /// @brief The validated header and plane table of a per-plane frame
+        struct PlaneTable
+        {
+            /// @brief The number of values
+            uint64_t size = 0;
+            /// @brief Each plane's mode and payload
+            std::vector<std::pair<PlaneMode, buffer_span_t>> planes;
+        };
+
+        inline PlaneTable read_table(const buffer_span_t &buffer, size_t value_size)
+        {
+            if (buffer.size() < header_size || !is_plane_frame(buffer))
+            {
+                throw std::runtime_error("Not a per-plane shuffled buffer");
+            }
+            if (buffer[4] != version || buffer[5] != value_size)
+            {
+                std::stringstream ss;
+                ss << "Cannot decode per-plane frame version " << (int)buffer[4] << " holding " << (int)buffer[5]
+                   << " byte values as " << value_size << " byte values";
+                throw std::runtime_error(ss.str());
+            }
+            PlaneTable table;
+            table.size = binary::read_le<uint64_t>(buffer.data() + 8);
+            size_t offset = header_size + value_size * plane_entry_size;
+            if (buffer.size() < offset || table.size > std::numeric_limits<size_t>::max() / value_size)
+            {
+                throw std::runtime_error("Malformed per-plane frame, truncated plane table");
+            }
+            for (size_t i = 0; i < value_size; i++)
+            {
+                const byte_t *entry = buffer.data() + header_size + i * plane_entry_size;
+                const auto mode = (PlaneMode)entry[0];
+                const uint64_t size = binary::read_le<uint64_t>(entry + 1);
+                if (size > buffer.size() - offset)
+                {
+                    throw std::runtime_error("Malformed per-plane frame, plane overflows the buffer");
+                }
+                if ((mode == PlaneMode::Constant && size != 1) || (mode == PlaneMode::Raw && size != table.size) ||
+                    (mode != PlaneMode::Constant && mode != PlaneMode::Raw && mode != PlaneMode::Compressed))
+                {
+                    throw std::runtime_error("Malformed per-plane frame, unknown plane mode");
+                }
+                table.planes.emplace_back(mode, buffer.subspan(offset, size));
+                offset += size;
+            }
+            return table;
+        }
+
+        /// @brief Decode a per-plane frame back into the shuffled bytes of its values
+        /// @param dctx The ZSTD decompression context to re-use for compressed planes, or `nullptr` to create one
+        /// only if a plane needs it
+        inline void decode(ZSTD_DCtx *dctx, const buffer_span_t &buffer, size_t value_size, buffer_t &shuffled, const DecompressionParams &params)
+        {
+            const auto table = read_table(buffer, value_size);
+            const size_t n = table.size;
+            shuffled.resize(n * value_size);
+            if (n == 0)
+            {
+                return;
+            }
+            std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> owned(nullptr, &ZSTD_freeDCtx);
+            for (size_t i = 0; i < value_size; i++)
+            {
+                const auto &[mode, payload] = table.planes[i];
+                byte_t *plane = shuffled.data() + i * n;
+                if (mode == PlaneMode::Constant)
+                {
+                    std::memset(plane, payload[0], n);
+                }
+                else if (mode == PlaneMode::Raw)
+                {
+                    std::memcpy(plane, payload.data(), n);
+                }
+                else
+                {
+                    if (!dctx)
+                    {
+                        owned.reset(ZSTD_createDCtx());
+                        if (!owned)
+                        {
+                            throw std::runtime_error("Failed to allocate ZSTD decompression context");
+                        }
+                        dctx = owned.get();
+                    }
+                    if (inner::zstd_decompress_into(dctx, payload, plane, n, params) != n)
+                    {
+                        throw std::runtime_error("Malformed per-plane frame, plane size does not match header");
+                    }
+                }
+            }
+        }
+
+        inline void decode(const buffer_span_t &buffer, size_t value_size, buffer_t &shuffled, const DecompressionParams &params)
+        {
+            decode(nullptr, buffer, value_size, shuffled, params);
+        }
+    }
+
+    /// @brief Compress an array of numerical data using byte shuffling and ZSTD compression. Data will be stored in little endian byte order.
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t byteshuffle_compress_buffer(const std::span<const T> &data,
+                                       buffer_t &transposeBuffer,
+                                       buffer_t &outBuffer,
+                                       const CompressionParams &params = CompressionParams())
+    {
+        transposeBuffer.clear();
+        inner::transpose<T>(data, transposeBuffer);
+        inner::zstd_compress_into(transposeBuffer.data(), transposeBuffer.size(), outBuffer, params);
+        return 0;
+    }
+
+    /// @brief Compress an array of numerical data using byte shuffling and ZSTD compression. Data will be stored in little endian byte order.
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t byteshuffle_compress_buffer(const std::vector<T> &data,
+                                       buffer_t &transposeBuffer,
+                                       buffer_t &outBuffer,
+                                       const CompressionParams &params = CompressionParams())
+    {
+        const std::span<const T> view(data.data(), data.size());
+        return byteshuffle_compress_buffer(view, transposeBuffer, outBuffer, params);
+    }
+
+    /// @brief Compress an array of numerical data using byte shuffling and ZSTD compression
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t byteshuffle_compress_buffer(const std::vector<T> &data,
+                                       buffer_t &outBuffer,
+                                       const CompressionParams &params = CompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return byteshuffle_compress_buffer(data, transposeBuffer, outBuffer, params);
+    }
+
+    /// @brief Compress an array of numerical data using byte shuffling, coding each byte plane on its own as a
+    /// constant, raw bytes or a ZSTD frame, whichever fits it. `byteshuffle_decompress_buffer` reads the result.
+    /// Data will be stored in little endian byte order.
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outBuffer A byte buffer to write the compressed frame to
+    /// @param params The ZSTD compression level or parameters
+    /// @param parallel Whether to compress the planes concurrently, one thread per plane
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t byteshuffle_planes_compress_buffer(const std::span<const T> &data,
+                                              buffer_t &transposeBuffer,
+                                              buffer_t &outBuffer,
+                                              const CompressionParams &params = CompressionParams(),
+                                              bool parallel = false)
+    {
+        transposeBuffer.clear();
+        inner::transpose<T>(data, transposeBuffer);
+        planes::encode(transposeBuffer, sizeof(T), outBuffer, params, parallel);
+        return 0;
+    }
+
+    template <typename T>
+    size_t byteshuffle_planes_compress_buffer(const std::vector<T> &data,
+                                              buffer_t &transposeBuffer,
+                                              buffer_t &outBuffer,
+                                              const CompressionParams &params = CompressionParams(),
+                                              bool parallel = false)
+    {
+        const std::span<const T> view(data.data(), data.size());
+        return byteshuffle_planes_compress_buffer(view, transposeBuffer, outBuffer, params, parallel);
+    }
+
+    template <typename T>
+    size_t byteshuffle_planes_compress_buffer(const std::vector<T> &data,
+                                              buffer_t &outBuffer,
+                                              const CompressionParams &params = CompressionParams(),
+                                              bool parallel = false)
+    {
+        buffer_t transposeBuffer;
+        return byteshuffle_planes_compress_buffer(data, transposeBuffer, outBuffer, params, parallel);
+    }
+
+    /// @brief Decompress an array of numerical data using byte shuffling and ZSTD compression. Frames written by
+    /// `byteshuffle_planes_compress_buffer` are recognised and decoded too.
+    /// @tparam T The data type of the array to compress
+    /// @param buffer A byte buffer to containing ZSTD-compressed bytes
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t byteshuffle_decompress_buffer(const buffer_span_t &buffer,
+                                         buffer_t &transposeBuffer,
+                                         std::vector<T> &dataBuffer,
+                                         const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        transposeBuffer.clear();
+        if (planes::is_plane_frame(buffer))
+        {
+            planes::decode(buffer, sizeof(T), transposeBuffer, params);
+        }
+        else
+        {
+            inner::zstd_decompress_into(buffer, transposeBuffer, params);
+        }
+        inner::reverse_transpose(transposeBuffer, dataBuffer);
+        return 0;
+    }
+
+    /// @brief Decompress an array of numerical data using byte shuffling and ZSTD compression without an intermediate
+    /// buffer. The ZSTD frame is streamed through a small block and each byte is written straight to its place in
+    /// `dataBuffer`, so peak memory is the output plus a constant rather than twice the output. Frames written by
+    /// `byteshuffle_planes_compress_buffer` are decoded the same way, plane by plane.
+    /// @tparam T The data type of the array to decompress
+    /// @param buffer A byte buffer containing ZSTD-compressed bytes
+    /// @param dataBuffer The data array to decompress into, re-using its allocation if large enough
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t byteshuffle_decompress_buffer(const buffer_span_t &buffer,
+                                         std::vector<T> &dataBuffer,
+                                         const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        if (!dctx)
+        {
+            throw std::runtime_error("Failed to allocate ZSTD decompression context");
+        }
+        if (planes::is_plane_frame(buffer))
+        {
+            const auto table = planes::read_table(buffer, sizeof(T));
+            dataBuffer.resize(table.size);
+            inner::PlaneScatter scatter{(byte_t *)dataBuffer.data(), dataBuffer.size(), sizeof(T)};
+            for (const auto &[mode, payload] : table.planes)
+            {
+                const auto start = scatter.position;
+                if (mode == planes::PlaneMode::Constant)
+                {
+                    scatter.fill(payload[0], table.size);
+                }
+                else if (mode == planes::PlaneMode::Raw)
+                {
+                    scatter(payload.data(), payload.size());
+                }
+                else
+                {
+                    inner::zstd_decompress_blocks(dctx.get(), payload, 1, params, scatter);
+                }
+                if (scatter.position - start != table.size)
+                {
+                    throw std::runtime_error("Malformed per-plane frame, plane size does not match header");
+                }
+            }
+            return 0;
+        }
+        const auto size = inner::zstd_content_size(buffer);
+        if (size % sizeof(T) != 0)
+        {
+            throw std::runtime_error("Decompressed size is not a whole number of values");
+        }
+        dataBuffer.resize(size / sizeof(T));
+        inner::PlaneScatter scatter{(byte_t *)dataBuffer.data(), dataBuffer.size(), sizeof(T)};
+        inner::zstd_decompress_blocks(dctx.get(), buffer, 1, params, scatter);
+        if (!scatter.complete())
+        {
+            throw std::runtime_error("Decompressed size does not match the frame header");
+        }
+        return 0;
+    }
+
+    /// @brief Compress an array of numerical data using dictionary encoding and ZSTD compression. Data will be stored in little-endian byte order
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param dictBuffer An intermediate byte buffer to hold the dictionary encoded bytes in
+    /// @param transposeBuffer An intermediate byte buffer to hold the intermediate shuffled bytes in
+    /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t dict_compress_buffer(
+        const std::span<const T> &data,
+        buffer_t &dictBuffer,
+        buffer_t &transposeBuffer,
+        buffer_t &outBuffer,
+        const CompressionParams &params = CompressionParams())
+    {
+        dictBuffer.clear();
+        dict::dictionary_encode<T>(data, transposeBuffer, dictBuffer);
+        dictBuffer.shrink_to_fit();
+        inner::zstd_compress_into(dictBuffer.data(), dictBuffer.size(), outBuffer, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t dict_compress_buffer(
+        const std::vector<T> &data,
+        buffer_t &dictBuffer,
+        buffer_t &outBuffer,
+        const CompressionParams &params = CompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return dict_compress_buffer<T>(data, dictBuffer, transposeBuffer, outBuffer, params);
+    }
+
+    /// @brief Decompress an array of numerical data using dictionary encoding and ZSTD compression
+    /// @tparam T The data type of the array to compress
+    /// @param buffer A byte buffer containing ZSTD-compressed bytes
+    /// @param dictBuffer An intermediate byte buffer to hold the dictionary encoded bytes
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t dict_decompress_buffer(
+        const buffer_span_t &buffer,
+        buffer_t &dictBuffer,
+        std::vector<T> &dataBuffer,
+        const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        dictBuffer.clear();
+        inner::zstd_decompress_into(buffer, dictBuffer, params);
+        dataBuffer.clear();
+        return dict::dictionary_decode(
+            dictBuffer,
+            dataBuffer);
+    }
+
+    /// @brief Decompress an array of numerical data using dictionary encoding and ZSTD compression without a buffer
+    /// for the whole decompressed stream. Only the dictionary is kept aside; the indices are unshuffled into the
+    /// memory of `dataBuffer` and replaced by their values in place, so peak memory is the output plus the dictionary.
+    /// @tparam T The data type of the array to decompress
+    /// @param buffer A byte buffer containing ZSTD-compressed bytes
+    /// @param dataBuffer The data array to decompress into, re-using its allocation if large enough
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t dict_decompress_buffer(const buffer_span_t &buffer,
+                                  std::vector<T> &dataBuffer,
+                                  const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        if (!dctx)
+        {
+            throw std::runtime_error("Failed to allocate ZSTD decompression context");
+        }
+        dict::dictionary_decode_streaming(dctx.get(), buffer, dataBuffer, params);
+        return 0;
+    }
+
+    /// @brief Compress an array of numerical data using ZSTD compression. Data will be stored in little-endian byte order
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param outBuffer The byte buffer to compress into
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t compress_buffer(const std::span<const T> &data,
+                           buffer_t &outBuffer,
+                           const CompressionParams &params = CompressionParams())
+    {
+        if constexpr (binary::is_big_endian() && sizeof(T) > 1)
+        {
+            buffer_t revEndian;
+            revEndian.reserve(data.size() * sizeof(T));
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                const T val = data[i];
+                binary::byte_view<T> view = binary::byte_view<T>::as_little_endian(val);
+                std::copy(view.begin(), view.end(), std::back_inserter(revEndian));
+            }
+            inner::zstd_compress_into(revEndian.data(), revEndian.size(), outBuffer, params);
+        }
+        else
+        {
+            inner::zstd_compress_into(data.data(), data.size() * sizeof(T), outBuffer, params);
+        }
+        return 0;
+    }
+
+    /// @brief Decompress Zstd-compressed data back into it's native format.
+    /// @tparam T The data type of the array to decompress to
+    /// @param buffer A byte buffer containing containing little endian ZSTD-compressed bytes
+    /// @param dataBuffer The data array to decompress into. Data will be in native byte ordering
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t decompress_buffer(const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        auto outputBound = inner::zstd_content_size(buffer);
+        dataBuffer.resize((outputBound + sizeof(T) - 1) / sizeof(T));
+        std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        if (!dctx)
+        {
+            throw std::runtime_error("Failed to allocate ZSTD decompression context");
+        }
+        auto used = inner::zstd_decompress_into(dctx.get(), buffer, (void *)dataBuffer.data(), outputBound, params);
+        dataBuffer.resize(used / sizeof(T));
+        if constexpr (binary::is_big_endian() && sizeof(T) > 1)
+        {
+            for (size_t i = 0; i < dataBuffer.size(); i++)
+            {
+                T val = dataBuffer[i];
+                binary::byte_view<T> view(val);
+                view.byteswap();
+                dataBuffer[i] = view.value();
+            }
+        }
+        return 0;
+    }
+
+    /// @brief Compress an array of numerical data using ZSTD compression. Data will be stored in little-endian byte order.
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param outBuffer The byte buffer to compress into
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t compress_buffer(const std::vector<T> &data,
+                           buffer_t &outBuffer,
+                           const CompressionParams &params = CompressionParams())
+    {
+        const std::span<const T> view(data.data(), data.size());
+        return compress_buffer(view, outBuffer, params);
+    }
+
+    /// @brief The element type an array was stored as, for choosing a decoder's stored type at runtime
+    enum class DType : uint8_t
+    {
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Int64,
+        UInt64,
+        Float32,
+        Float64,
+    };
+
+    /// @brief The `DType` corresponding to the C++ type `T`
+    template <typename T>
+    constexpr DType dtype_of()
+    {
+        static_assert(std::is_arithmetic_v<T> && sizeof(T) <= 8, "No DType corresponds to this type");
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            return sizeof(T) == 4 ? DType::Float32 : DType::Float64;
+        }
+        else
+        {
+            constexpr size_t width = std::bit_width(sizeof(T)) - 1;
+            return (DType)(width * 2 + (std::is_unsigned_v<T> ? 1 : 0));
+        }
+    }
+
+    /// @brief Call `fn.template operator()<S>()` with `S` the C++ type corresponding to `dtype`
+    template <typename F>
+    decltype(auto) visit_dtype(DType dtype, F &&fn)
+    {
+        switch (dtype)
+        {
+        case DType::Int8:
+            return fn.template operator()<int8_t>();
+        case DType::UInt8:
+            return fn.template operator()<uint8_t>();
+        case DType::Int16:
+            return fn.template operator()<int16_t>();
+        case DType::UInt16:
+            return fn.template operator()<uint16_t>();
+        case DType::Int32:
+            return fn.template operator()<int32_t>();
+        case DType::UInt32:
+            return fn.template operator()<uint32_t>();
+        case DType::Int64:
+            return fn.template operator()<int64_t>();
+        case DType::UInt64:
+            return fn.template operator()<uint64_t>();
+        case DType::Float32:
+            return fn.template operator()<float>();
+        case DType::Float64:
+            return fn.template operator()<double>();
+        }
+        std::stringstream ss;
+        ss << "Unknown DType " << (int)dtype;
+        throw std::invalid_argument(ss.str());
+    }
+
+    /// @brief Decompress an array stored as `Stored` using byte shuffling and ZSTD compression, converting each
+    /// value to `T` while the bytes are unshuffled
+    /// @tparam Stored The data type the array was compressed as
+    /// @tparam T The data type to decompress to
+    /// @param buffer A byte buffer to containing ZSTD-compressed bytes
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename Stored, typename T>
+    size_t byteshuffle_decompress_buffer_as(const buffer_span_t &buffer,
+                                            buffer_t &transposeBuffer,
+                                            std::vector<T> &dataBuffer,
+                                            const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        transposeBuffer.clear();
+        if (planes::is_plane_frame(buffer))
+        {
+            planes::decode(buffer, sizeof(Stored), transposeBuffer, params);
+        }
+        else
+        {
+            inner::zstd_decompress_into(buffer, transposeBuffer, params);
+        }
+        inner::reverse_transpose_as<Stored>(transposeBuffer, dataBuffer);
+        return 0;
+    }
+
+    /// @brief Decompress an array stored as the runtime type `stored` using byte shuffling and ZSTD compression,
+    /// converting each value to `T` while the bytes are unshuffled
+    template <typename T>
+    size_t byteshuffle_decompress_buffer_as(DType stored,
+                                            const buffer_span_t &buffer,
+                                            buffer_t &transposeBuffer,
+                                            std::vector<T> &dataBuffer,
+                                            const DecompressionParams &params = DecompressionParams())
+    {
+        return visit_dtype(stored, [&]<typename Stored>()
+                           { return byteshuffle_decompress_buffer_as<Stored>(buffer, transposeBuffer, dataBuffer, params); });
+    }
+
+    /// @brief Decompress an array stored as `Stored` using dictionary encoding and ZSTD compression. The dictionary
+    /// is converted to `T` once and then gathered, so the conversion costs one operation per distinct value.
+    /// @tparam Stored The data type the array was compressed as
+    /// @tparam T The data type to decompress to
+    /// @param buffer A byte buffer containing ZSTD-compressed bytes
+    /// @param dictBuffer An intermediate byte buffer to hold the dictionary encoded bytes
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename Stored, typename T>
+    size_t dict_decompress_buffer_as(const buffer_span_t &buffer,
+                                     buffer_t &dictBuffer,
+                                     std::vector<T> &dataBuffer,
+                                     const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        dictBuffer.clear();
+        inner::zstd_decompress_into(buffer, dictBuffer, params);
+        dataBuffer.clear();
+        return dict::dictionary_decode_as<Stored, T>(dictBuffer, dataBuffer);
+    }
+
+    /// @brief Decompress an array stored as the runtime type `stored` using dictionary encoding and ZSTD compression,
+    /// converting it to `T`
+    template <typename T>
+    size_t dict_decompress_buffer_as(DType stored,
+                                     const buffer_span_t &buffer,
+                                     buffer_t &dictBuffer,
+                                     std::vector<T> &dataBuffer,
+                                     const DecompressionParams &params = DecompressionParams())
+    {
+        return visit_dtype(stored, [&]<typename Stored>()
+                           { return dict_decompress_buffer_as<Stored>(buffer, dictBuffer, dataBuffer, params); });
+    }
+
+    /// @brief Decompress an array stored as `Stored` using ZSTD compression, converting each value to `T` without
+    /// an intermediate array. When `T` is at least as wide as `Stored`, the stored bytes are decompressed into the
+    /// tail of `dataBuffer` and widened in place front to back, which never overwrites an unread value. Otherwise
+    /// values are converted as they leave ZSTD's streaming decoder, a small fixed-size block at a time.
+    /// @tparam Stored The data type the array was compressed as
+    /// @tparam T The data type to decompress to
+    /// @param buffer A byte buffer containing containing little endian ZSTD-compressed bytes
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename Stored, typename T>
+    size_t decompress_buffer_as(const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        if constexpr (std::is_same_v<Stored, T>)
+        {
+            return decompress_buffer(buffer, dataBuffer, params);
+        }
+        else
+        {
+            if (buffer.empty())
+            {
+                dataBuffer.clear();
+                return 0;
+            }
+            auto outputBound = inner::zstd_content_size(buffer);
+            dataBuffer.resize(outputBound / sizeof(Stored));
+            std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+            if (!dctx)
+            {
+                throw std::runtime_error("Failed to allocate ZSTD decompression context");
+            }
+            if constexpr (sizeof(T) >= sizeof(Stored))
+            {
+                const size_t n = dataBuffer.size();
+                auto base = reinterpret_cast<byte_t *>(dataBuffer.data());
+                auto stored = base + n * (sizeof(T) - sizeof(Stored));
+                auto used = inner::zstd_decompress_into(dctx.get(), buffer, stored, n * sizeof(Stored), params);
+                if (used != outputBound)
+                {
+                    throw std::runtime_error("Decompressed size is not a whole number of values");
+                }
+                for (size_t i = 0; i < n; i++)
+                {
+                    T value = static_cast<T>(binary::read_le<Stored>(stored + i * sizeof(Stored)));
+                    std::memcpy(base + i * sizeof(T), &value, sizeof(T));
+                }
+                return 0;
+            }
+            size_t i = 0;
+            inner::zstd_decompress_blocks(dctx.get(), buffer, sizeof(Stored), params, [&](const byte_t *bytes, size_t n)
+                                          {
+                                              if (i + n / sizeof(Stored) > dataBuffer.size())
+                                              {
+                                                  throw std::runtime_error("ZSTD frame holds more data than its header declares");
+                                              }
+                                              for (size_t k = 0; k < n; k += sizeof(Stored))
+                                              {
+                                                  dataBuffer[i++] = static_cast<T>(binary::read_le<Stored>(bytes + k));
+                                              } });
+            dataBuffer.resize(i);
+            return 0;
+        }
+    }
+
+    /// @brief Decompress an array stored as the runtime type `stored` using ZSTD compression, converting it to `T`
+    template <typename T>
+    size_t decompress_buffer_as(DType stored, const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        return visit_dtype(stored, [&]<typename Stored>()
+                           { return decompress_buffer_as<Stored>(buffer, dataBuffer, params); });
+    }
+
+    /// @brief Compress an array of numerical data using byte shuffling and ZSTD compression, and base64-encode the result for embedding in mzML.
+    /// The ZSTD output is encoded block by block as it is produced, so the binary frame is never materialized. Data will be stored in little endian byte order.
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outText The string to write base64 text to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t byteshuffle_compress_base64(const std::span<const T> &data,
+                                       buffer_t &transposeBuffer,
+                                       std::string &outText,
+                                       const CompressionParams &params = CompressionParams())
+    {
+        outText.clear();
+        inner::transpose<T>(data, transposeBuffer);
+        base64::zstd_compress_to_base64(transposeBuffer.data(), transposeBuffer.size(), outText, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t byteshuffle_compress_base64(const std::vector<T> &data,
+                                       buffer_t &transposeBuffer,
+                                       std::string &outText,
+                                       const CompressionParams &params = CompressionParams())
+    {
+        const std::span<const T> view(data.data(), data.size());
+        return byteshuffle_compress_base64(view, transposeBuffer, outText, params);
+    }
+
+    template <typename T>
+    size_t byteshuffle_compress_base64(const std::vector<T> &data,
+                                       std::string &outText,
+                                       const CompressionParams &params = CompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return byteshuffle_compress_base64(data, transposeBuffer, outText, params);
+    }
+
+    /// @brief Decompress base64 text written by `byteshuffle_compress_base64`, decoding the text block by block
+    /// straight into the ZSTD decompressor so the binary frame is never materialized
+    /// @tparam T The data type of the array to decompress
+    /// @param text The base64-encoded, ZSTD-compressed bytes
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t byteshuffle_decompress_base64(std::string_view text,
                                          buffer_t &transposeBuffer,
-                                         std::vector<T> &dataBuffer)
+                                         std::vector<T> &dataBuffer,
+                                         const DecompressionParams &params = DecompressionParams())
+    {
+        if (text.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        auto used = base64::zstd_decompress_from_base64(text, [&](size_t n)
+                                                        {
+                                                            transposeBuffer.resize(n);
+                                                            return transposeBuffer.data(); },
+                                                        params);
+        transposeBuffer.resize(used);
+        inner::reverse_transpose(transposeBuffer, dataBuffer);
+        return 0;
+    }
+
+    /// @brief Compress an array of numerical data using dictionary encoding and ZSTD compression, and base64-encode the result for embedding in mzML.
+    /// Data will be stored in little-endian byte order
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param dictBuffer An intermediate byte buffer to hold the dictionary encoded bytes in
+    /// @param transposeBuffer An intermediate byte buffer to hold the intermediate shuffled bytes in
+    /// @param outText The string to write base64 text to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t dict_compress_base64(
+        const std::span<const T> &data,
+        buffer_t &dictBuffer,
+        buffer_t &transposeBuffer,
+        std::string &outText,
+        const CompressionParams &params = CompressionParams())
+    {
+        outText.clear();
+        dictBuffer.clear();
+        dict::dictionary_encode<T>(data, transposeBuffer, dictBuffer);
+        base64::zstd_compress_to_base64(dictBuffer.data(), dictBuffer.size(), outText, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t dict_compress_base64(
+        const std::vector<T> &data,
+        buffer_t &dictBuffer,
+        std::string &outText,
+        const CompressionParams &params = CompressionParams())
+    {
+        buffer_t transposeBuffer;
+        const std::span<const T> view(data.data(), data.size());
+        return dict_compress_base64<T>(view, dictBuffer, transposeBuffer, outText, params);
+    }
+
+    /// @brief Decompress base64 text written by `dict_compress_base64`
+    /// @tparam T The data type of the array to decompress
+    /// @param text The base64-encoded, ZSTD-compressed bytes
+    /// @param dictBuffer An intermediate byte buffer to hold the dictionary encoded bytes
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t dict_decompress_base64(
+        std::string_view text,
+        buffer_t &dictBuffer,
+        std::vector<T> &dataBuffer,
+        const DecompressionParams &params = DecompressionParams())
+    {
+        dataBuffer.clear();
+        if (text.empty())
+        {
+            return 0;
+        }
+        auto used = base64::zstd_decompress_from_base64(text, [&](size_t n)
+                                                        {
+                                                            dictBuffer.resize(n);
+                                                            return dictBuffer.data(); },
+                                                        params);
+        dictBuffer.resize(used);
+        return dict::dictionary_decode(dictBuffer, dataBuffer);
+    }
+
+    /// @brief Compress an array of numerical data using ZSTD compression, and base64-encode the result for embedding in mzML.
+    /// Data will be stored in little-endian byte order
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param outText The string to write base64 text to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t compress_base64(const std::span<const T> &data,
+                           std::string &outText,
+                           const CompressionParams &params = CompressionParams())
+    {
+        outText.clear();
+        if constexpr (binary::is_big_endian() && sizeof(T) > 1)
+        {
+            buffer_t revEndian;
+            revEndian.reserve(data.size() * sizeof(T));
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                binary::byte_view<T> view = binary::byte_view<T>::as_little_endian(data[i]);
+                std::copy(view.begin(), view.end(), std::back_inserter(revEndian));
+            }
+            base64::zstd_compress_to_base64(revEndian.data(), revEndian.size(), outText, params);
+        }
+        else
+        {
+            base64::zstd_compress_to_base64(data.data(), data.size() * sizeof(T), outText, params);
+        }
+        return 0;
+    }
+
+    template <typename T>
+    size_t compress_base64(const std::vector<T> &data,
+                           std::string &outText,
+                           const CompressionParams &params = CompressionParams())
+    {
+        const std::span<const T> view(data.data(), data.size());
+        return compress_base64(view, outText, params);
+    }
+
+    /// @brief Decompress base64 text written by `compress_base64` directly into the output array
+    /// @tparam T The data type of the array to decompress to
+    /// @param text The base64-encoded, ZSTD-compressed little endian bytes
+    /// @param dataBuffer The data array to decompress into. Data will be in native byte ordering
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t decompress_base64(std::string_view text, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        if (text.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        auto used = base64::zstd_decompress_from_base64(text, [&](size_t n)
+                                                        {
+                                                            dataBuffer.resize((n + sizeof(T) - 1) / sizeof(T));
+                                                            return reinterpret_cast<byte_t *>(dataBuffer.data()); },
+                                                        params);
+        dataBuffer.resize(used / sizeof(T));
+        if constexpr (binary::is_big_endian() && sizeof(T) > 1)
+        {
+            for (size_t i = 0; i < dataBuffer.size(); i++)
+            {
+                binary::byte_view<T> view(dataBuffer[i]);
+                view.byteswap();
+                dataBuffer[i] = view.value();
+            }
+        }
+        return 0;
+    }
+
+    /// @brief Implementation of reference-based (inter-array) compression.
+    ///
+    /// An array is stored as the residual of its IEEE bit patterns against a reference array, usually the previous
+    /// spectrum or a chosen anchor spectrum from the same acquisition method. For sorted arrays such as m/z, each value
+    /// is paired with the nearest reference value, so dropped or inserted sampling points only cost a small skip
+    /// instead of misaligning everything after them. The residuals are byte shuffled and ZSTD compressed.
+    ///
+    /// Frame layout, all integers little endian:
+    ///  - 4 byte magic "MZRF", 1 byte version, 1 byte `ResidualMode`, 1 byte value size, 1 byte flags (bit 0: aligned)
+    ///  - u64 number of values, u64 reference length, u64 reference distance, u64 reference fingerprint, u64 skip stream size
+    ///  - a ZSTD frame holding the zigzag varint skip stream (aligned frames only) followed by the shuffled residual words
+    namespace reference
+    {
+        using binary::uint_of;
+
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'R', 'F'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + 5 * sizeof(uint64_t);
+
+        /// @brief How a value is combined with its reference value
+        enum class ResidualMode : uint8_t
+        {
+            /// @brief Exclusive-or of the bit patterns, zero where the values are identical
+            Xor = 0,
+            /// @brief Wrapping integer difference of the bit patterns, small where nearby floats share sign and exponent
+            Delta = 1,
+        };
+
+        struct FrameHeader
+        {
+            ResidualMode mode;
+            uint8_t value_size;
+            bool aligned;
+            uint64_t size;
+            uint64_t reference_size;
+            /// @brief How many arrays back the reference is, 0 if the array was stored without a reference
+            uint64_t reference_distance;
+            uint64_t reference_fingerprint;
+            uint64_t skip_bytes;
+        };
+
+        /// @brief Whether `buffer` starts with a reference frame header
+        inline bool is_reference_frame(const buffer_span_t &buffer)
+        {
+            return buffer.size() >= header_size && std::equal(magic.begin(), magic.end(), buffer.begin());
+        }
+
+        inline FrameHeader read_header(const buffer_span_t &buffer)
+        {
+            if (!is_reference_frame(buffer))
+            {
+                throw std::runtime_error("Not a reference-compressed buffer");
+            }
+            if (buffer[4] != version)
+            {
+                std::stringstream ss;
+                ss << "Unsupported reference frame version " << (int)buffer[4];
+                throw std::runtime_error(ss.str());
+            }
+            FrameHeader header;
+            header.mode = (ResidualMode)buffer[5];
+            header.value_size = buffer[6];
+            header.aligned = (buffer[7] & 1) != 0;
+            header.size = binary::read_le<uint64_t>(buffer.data() + 8);
+            header.reference_size = binary::read_le<uint64_t>(buffer.data() + 16);
+            header.reference_distance = binary::read_le<uint64_t>(buffer.data() + 24);
+            header.reference_fingerprint = binary::read_le<uint64_t>(buffer.data() + 32);
+            header.skip_bytes = binary::read_le<uint64_t>(buffer.data() + 40);
+            return header;
+        }
+
+        inline void write_header(const FrameHeader &header, buffer_t &buffer)
+        {
+            buffer.insert(buffer.end(), magic.begin(), magic.end());
+            buffer.push_back(version);
+            buffer.push_back((byte_t)header.mode);
+            buffer.push_back(header.value_size);
+            buffer.push_back(header.aligned ? 1 : 0);
+            binary::write_le<uint64_t>(buffer, header.size);
+            binary::write_le<uint64_t>(buffer, header.reference_size);
+            binary::write_le<uint64_t>(buffer, header.reference_distance);
+            binary::write_le<uint64_t>(buffer, header.reference_fingerprint);
+            binary::write_le<uint64_t>(buffer, header.skip_bytes);
+        }
+
+        template <typename U>
+        U combine(U value, U ref, ResidualMode mode)
+        {
+            return mode == ResidualMode::Xor ? (U)(value ^ ref) : (U)(value - ref);
+        }
+
+        template <typename U>
+        U uncombine(U residual, U ref, ResidualMode mode)
+        {
+            return mode == ResidualMode::Xor ? (U)(residual ^ ref) : (U)(residual + ref);
+        }
+
+        /// @brief Pair each value of sorted `data` with the nearest value of sorted `ref`, writing the
+        /// zigzag-encoded step from the previous pairing minus one (0 when both advance together) to `skips`
+        template <typename T>
+        void align(const std::span<const T> &data, const std::span<const T> &ref, std::vector<size_t> &pairing, buffer_t &skips)
+        {
+            pairing.resize(data.size());
+            size_t j = 0;
+            int64_t previous = -1;
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                const double x = (double)data[i];
+                while (j + 1 < ref.size() && (double)ref[j + 1] <= x)
+                {
+                    j++;
+                }
+                size_t k = j;
+                if (j + 1 < ref.size() && ((double)ref[j + 1] - x) < (x - (double)ref[j]))
+                {
+                    k = j + 1;
+                }
+                pairing[i] = k;
+                binary::write_varint(skips, binary::zigzag_encode((int64_t)k - previous - 1));
+                previous = (int64_t)k;
+            }
+        }
+
+        /// @brief Encode `data` against `ref` into a reference frame in `outBuffer`
+        /// @param data The array to encode
+        /// @param ref The reference array, empty to store `data` on its own
+        /// @param transposeBuffer An intermediate byte buffer
+        /// @param outBuffer The buffer to write the frame to
+        /// @param mode How values are combined with their reference values
+        /// @param reference_distance How many arrays back `ref` is, recorded so readers can find it. Ignored if `ref` is empty.
+        /// @param params The ZSTD compression level or parameters
+        template <typename T>
+        void encode(const std::span<const T> &data,
+                    const std::span<const T> &ref,
+                    buffer_t &transposeBuffer,
+                    buffer_t &outBuffer,
+                    ResidualMode mode,
+                    uint64_t reference_distance,
+                    const CompressionParams &params)
+        {
+            using U = uint_of<sizeof(T)>;
+            FrameHeader header;
+            header.mode = mode;
+            header.value_size = sizeof(T);
+            header.size = data.size();
+            header.reference_size = ref.size();
+            header.reference_distance = ref.empty() ? 0 : std::max<uint64_t>(reference_distance, 1);
+            header.reference_fingerprint = ref.empty() ? 0 : binary::fingerprint(ref);
+            header.aligned = !ref.empty() && std::is_sorted(data.begin(), data.end()) && std::is_sorted(ref.begin(), ref.end());
+
+            buffer_t payload;
+            std::vector<U> residuals(data.size());
+            if (header.aligned)
+            {
+                std::vector<size_t> pairing;
+                align(data, ref, pairing, payload);
+                for (size_t i = 0; i < data.size(); i++)
+                {
+                    residuals[i] = combine(std::bit_cast<U>(data[i]), std::bit_cast<U>(ref[pairing[i]]), mode);
+                }
+            }
+            else
+            {
+                auto shared = std::min(data.size(), ref.size());
+                for (size_t i = 0; i < data.size(); i++)
+                {
+                    residuals[i] = i < shared ? combine(std::bit_cast<U>(data[i]), std::bit_cast<U>(ref[i]), mode) : std::bit_cast<U>(data[i]);
+                }
+            }
+            header.skip_bytes = payload.size();
+            inner::transpose<U>(residuals, transposeBuffer);
+            payload.insert(payload.end(), transposeBuffer.begin(), transposeBuffer.end());
+
+            buffer_t compressed;
+            inner::zstd_compress_into(payload.data(), payload.size(), compressed, params);
+            outBuffer.clear();
+            outBuffer.reserve(header_size + compressed.size());
+            write_header(header, outBuffer);
+            outBuffer.insert(outBuffer.end(), compressed.begin(), compressed.end());
+        }
+
+        /// @brief Decode a reference frame written by `encode`
+        /// @param buffer The frame
+        /// @param ref The same reference array the frame was encoded against, empty if it was stored on its own
+        /// @param transposeBuffer An intermediate byte buffer
+        /// @param dataBuffer The array to decode into
+        /// @param params The ZSTD decompression parameters
+        template <typename T>
+        void decode(const buffer_span_t &buffer,
+                    const std::span<const T> &ref,
+                    buffer_t &transposeBuffer,
+                    std::vector<T> &dataBuffer,
+                    const DecompressionParams &params)
+        {
+            using U = uint_of<sizeof(T)>;
+            auto header = read_header(buffer);
+            if (header.value_size != sizeof(T))
+            {
+                std::stringstream ss;
+                ss << "Reference frame holds " << (int)header.value_size << " byte values, cannot decode as " << sizeof(T) << " byte values";
+                throw std::runtime_error(ss.str());
+            }
+            if (header.reference_distance != 0 &&
+                (ref.size() != header.reference_size || binary::fingerprint(ref) != header.reference_fingerprint))
+            {
+                throw std::runtime_error("Reference array does not match the one this buffer was encoded against");
+            }
+
+            inner::zstd_decompress_into(buffer.subspan(header_size), transposeBuffer, params);
+            if (transposeBuffer.size() != header.skip_bytes + header.size * sizeof(T))
+            {
+                throw std::runtime_error("Malformed reference frame, payload size does not match header");
+            }
+            std::vector<U> residuals;
+            inner::reverse_transpose<U>(buffer_span_t(transposeBuffer).subspan(header.skip_bytes), residuals);
+
+            dataBuffer.resize(header.size);
+            if (header.aligned)
+            {
+                buffer_span_t skips(transposeBuffer.data(), header.skip_bytes);
+                size_t offset = 0;
+                int64_t previous = -1;
+                for (size_t i = 0; i < header.size; i++)
+                {
+                    int64_t k = previous + 1 + binary::zigzag_decode(binary::read_varint(skips, offset));
+                    if (k < 0 || (uint64_t)k >= ref.size())
+                    {
+                        throw std::runtime_error("Malformed reference frame, aligned index out of range");
+                    }
+                    dataBuffer[i] = std::bit_cast<T>(uncombine(residuals[i], std::bit_cast<U>(ref[k]), header.mode));
+                    previous = k;
+                }
+            }
+            else
+            {
+                auto shared = std::min<size_t>(header.size, header.reference_distance != 0 ? ref.size() : 0);
+                for (size_t i = 0; i < header.size; i++)
+                {
+                    dataBuffer[i] = std::bit_cast<T>(i < shared ? uncombine(residuals[i], std::bit_cast<U>(ref[i]), header.mode) : residuals[i]);
+                }
+            }
+        }
+    }
+
+    /// @brief Compress an array against a reference array, typically the previous spectrum or an anchor spectrum
+    /// sharing its sampling grid. Data will be stored in little endian byte order.
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param referenceData The reference array. Decoding requires exactly the same array. If empty, `data` is stored on its own.
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outBuffer A byte buffer to write the compressed frame to
+    /// @param mode How values are combined with the reference values
+    /// @param reference_distance How many arrays before `data` the reference is, recorded in the frame for `ReferenceDecoder`
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t reference_compress_buffer(const std::span<const T> &data,
+                                     const std::span<const T> &referenceData,
+                                     buffer_t &transposeBuffer,
+                                     buffer_t &outBuffer,
+                                     reference::ResidualMode mode = reference::ResidualMode::Xor,
+                                     uint64_t reference_distance = 1,
+                                     const CompressionParams &params = CompressionParams())
+    {
+        reference::encode(data, referenceData, transposeBuffer, outBuffer, mode, reference_distance, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t reference_compress_buffer(const std::vector<T> &data,
+                                     const std::vector<T> &referenceData,
+                                     buffer_t &outBuffer,
+                                     reference::ResidualMode mode = reference::ResidualMode::Xor,
+                                     uint64_t reference_distance = 1,
+                                     const CompressionParams &params = CompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return reference_compress_buffer(std::span<const T>(data.data(), data.size()),
+                                         std::span<const T>(referenceData.data(), referenceData.size()),
+                                         transposeBuffer, outBuffer, mode, reference_distance, params);
+    }
+
+    /// @brief Decompress an array written by `reference_compress_buffer`
+    /// @tparam T The data type of the array to decompress
+    /// @param buffer The compressed frame
+    /// @param referenceData The reference array the frame was encoded against
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t reference_decompress_buffer(const buffer_span_t &buffer,
+                                       const std::span<const T> &referenceData,
+                                       buffer_t &transposeBuffer,
+                                       std::vector<T> &dataBuffer,
+                                       const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        reference::decode(buffer, referenceData, transposeBuffer, dataBuffer, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t reference_decompress_buffer(const buffer_span_t &buffer,
+                                       const std::vector<T> &referenceData,
+                                       std::vector<T> &dataBuffer,
+                                       const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return reference_decompress_buffer(buffer, std::span<const T>(referenceData.data(), referenceData.size()), transposeBuffer, dataBuffer, params);
+    }
+
+    /// @brief Which earlier array a `ReferenceEncoder` encodes each array against
+    enum class ReferenceTarget
+    {
+        /// @brief The most recent anchor, so any array decodes from at most its anchor and itself
+        Anchor,
+        /// @brief The previous array, so decoding walks the chain back to the last anchor
+        Previous,
+    };
+
+    /// @brief Configuration for `ReferenceEncoder`
+    struct ReferenceConfig
+    {
+        ReferenceTarget target = ReferenceTarget::Anchor;
+        reference::ResidualMode mode = reference::ResidualMode::Xor;
+        /// @brief The maximum number of arrays encoded against references between two anchors, bounding the chain a reader must decode
+        size_t max_chain = 16;
+        /// @brief Start a new anchor when an array's length differs from its reference by more than this fraction
+        double max_length_change = 0.25;
+        CompressionParams params = CompressionParams();
+    };
+
+    /// @brief How a `ReferenceEncoder` stored one array
+    struct ReferenceFrameInfo
+    {
+        uint64_t index;
+        /// @brief The index of the array it was encoded against, equal to `index` for anchors
+        uint64_t reference_index;
+        /// @brief The number of frames that must be decoded to read it, including itself
+        size_t chain_depth;
+        bool is_anchor() const
+        {
+            return index == reference_index;
+        }
+    };
+
+    /// @brief Encodes a sequence of arrays against earlier arrays of the same sequence, managing anchors so that
+    /// reference chains stay bounded. Feed one array class (e.g. only m/z arrays) per encoder.
+    template <typename T>
+    class ReferenceEncoder
+    {
+    public:
+        ReferenceEncoder(ReferenceConfig config = ReferenceConfig()) : config_(config)
+        {
+            config_.max_chain = std::max<size_t>(config_.max_chain, 1);
+        }
+
+        /// @brief Encode the next array of the sequence
+        /// @param data The array to encode
+        /// @param outBuffer The buffer to write the frame to
+        /// @param force_anchor Store `data` as a new anchor regardless of the chain length
+        /// @return How the array was stored
+        ReferenceFrameInfo encode(const std::span<const T> &data, buffer_t &outBuffer, bool force_anchor = false)
+        {
+            auto index = next_index_++;
+            const auto &ref = config_.target == ReferenceTarget::Anchor ? anchor_ : previous_;
+            bool anchor = force_anchor || !has_anchor_ || since_anchor_ >= config_.max_chain;
+            if (!anchor)
+            {
+                double longest = (double)std::max(data.size(), ref.size());
+                double change = longest > 0 ? std::abs((double)data.size() - (double)ref.size()) / longest : 0.0;
+                anchor = change > config_.max_length_change;
+            }
+
+            ReferenceFrameInfo info;
+            info.index = index;
+            if (anchor)
+            {
+                reference::encode<T>(data, std::span<const T>(), transposeBuffer_, outBuffer, config_.mode, 0, config_.params);
+                anchor_.assign(data.begin(), data.end());
+                anchor_index_ = index;
+                has_anchor_ = true;
+                since_anchor_ = 0;
+                info.reference_index = index;
+                info.chain_depth = 1;
+            }
+            else
+            {
+                auto reference_index = config_.target == ReferenceTarget::Anchor ? anchor_index_ : index - 1;
+                reference::encode<T>(data, std::span<const T>(ref.data(), ref.size()), transposeBuffer_, outBuffer, config_.mode, index - reference_index, config_.params);
+                since_anchor_ += 1;
+                info.reference_index = reference_index;
+                info.chain_depth = config_.target == ReferenceTarget::Anchor ? 2 : since_anchor_ + 1;
+            }
+            if (config_.target == ReferenceTarget::Previous)
+            {
+                previous_.assign(data.begin(), data.end());
+            }
+            return info;
+        }
+
+        ReferenceFrameInfo encode(const std::vector<T> &data, buffer_t &outBuffer, bool force_anchor = false)
+        {
+            return encode(std::span<const T>(data.data(), data.size()), outBuffer, force_anchor);
+        }
+
+        const ReferenceConfig &config() const
+        {
+            return config_;
+        }
+
+    private:
+        ReferenceConfig config_;
+        std::vector<T> anchor_;
+        std::vector<T> previous_;
+        uint64_t anchor_index_ = 0;
+        uint64_t next_index_ = 0;
+        size_t since_anchor_ = 0;
+        bool has_anchor_ = false;
+        buffer_t transposeBuffer_;
+    };
+
+    /// @brief Random access decoding of frames written by `ReferenceEncoder`. Each frame records how far back its
+    /// reference is, so decoding array `i` fetches and decodes only the frames on its chain back to an anchor.
+    /// Recently decoded arrays are kept so sequential and same-anchor reads do not repeat work.
+    template <typename T>
+    class ReferenceDecoder
+    {
+    public:
+        /// @brief A callable returning the frame for an array index
+        using fetch_t = std::function<buffer_span_t(uint64_t)>;
+
+        ReferenceDecoder(fetch_t fetch, size_t cache_size = 4, DecompressionParams params = DecompressionParams())
+            : fetch_(std::move(fetch)), cache_size_(std::max<size_t>(cache_size, 1)), params_(params) {}
+
+        /// @brief Decode the array at `index` into `dataBuffer`
+        /// @return The number of frames that had to be decoded
+        size_t decode(uint64_t index, std::vector<T> &dataBuffer)
+        {
+            std::vector<uint64_t> chain;
+            auto current = index;
+            while (true)
+            {
+                if (find(current) != nullptr)
+                {
+                    break;
+                }
+                chain.push_back(current);
+                auto header = reference::read_header(fetch_(current));
+                if (header.reference_distance == 0)
+                {
+                    break;
+                }
+                if (header.reference_distance > current)
+                {
+                    throw std::runtime_error("Reference frame points before the start of the sequence");
+                }
+                current -= header.reference_distance;
+            }
+
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+            {
+                auto frame = fetch_(*it);
+                auto header = reference::read_header(frame);
+                std::vector<T> decoded;
+                if (header.reference_distance == 0)
+                {
+                    reference::decode<T>(frame, std::span<const T>(), transposeBuffer_, decoded, params_);
+                }
+                else
+                {
+                    auto ref = find(*it - header.reference_distance);
+                    reference::decode<T>(frame, std::span<const T>(ref->data(), ref->size()), transposeBuffer_, decoded, params_);
+                }
+                remember(*it, std::move(decoded));
+            }
+            dataBuffer = *find(index);
+            return chain.size();
+        }
+
+    private:
+        fetch_t fetch_;
+        size_t cache_size_;
+        DecompressionParams params_;
+        buffer_t transposeBuffer_;
+        std::deque<std::pair<uint64_t, std::vector<T>>> cache_;
+
+        const std::vector<T> *find(uint64_t index)
+        {
+            for (auto &entry : cache_)
+            {
+                if (entry.first == index)
+                {
+                    return &entry.second;
+                }
+            }
+            return nullptr;
+        }
+
+        void remember(uint64_t index, std::vector<T> &&values)
+        {
+            cache_.emplace_back(index, std::move(values));
+            // Always keep the two newest entries, the array being decoded and its reference
+            while (cache_.size() > std::max<size_t>(cache_size_, 2))
+            {
+                cache_.pop_front();
+            }
+        }
+    };
+
+    /// @brief Implementation of model-based compression for profile m/z sampling grids.
+    ///
+    /// Profile spectra are sampled on a near-deterministic grid: a TOF instrument samples evenly in sqrt(m/z), an
+    /// Orbitrap evenly in 1/sqrt(m/z). The array is split into fixed-size segments. Each segment is fitted to the
+    /// model that suits it best, as a start `a`, a step `b` and an integer sample index `k` per value, so the model
+    /// predicts `f^-1(a + b * k)`. What is stored is the index steps and the exact difference between the value's
+    /// bit pattern and the prediction's, which is small for well-fitted segments. Residuals that drift smoothly, as
+    /// they do when double precision values are off from a slightly misfitted step, are stored differenced. Segments that
+    /// fit neither model (unsorted, non-positive or non-finite values, centroid peak lists) keep their raw bit
+    /// patterns, so the codec is always lossless.
+    ///
+    /// Frame layout, all integers little endian:
+    ///  - 4 byte magic "MZGD", 1 byte version, 1 byte value size, 2 reserved bytes
+    ///  - u64 number of values, u64 segment size, u64 model stream size, u64 step stream size
+    ///  - a ZSTD frame holding the model stream (per segment a `Model` byte, with `differenced_flag` set if the
+    ///    residuals are differenced, then `a` and `b` as IEEE doubles unless raw), the zigzag varint index steps, and
+    ///    the shuffled, zigzag-encoded residual words
+    namespace grid
+    {
+        using binary::uint_of;
+
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'G', 'D'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + 4 * sizeof(uint64_t);
+        inline constexpr size_t default_segment_size = 4096;
+
+        /// @brief The sampling law a segment was fitted to
+        enum class Model : uint8_t
+        {
+            /// @brief No model, the values' bit patterns are stored as is
+            Raw = 0,
+            /// @brief sqrt(m/z) is linear in the sample index
+            Tof = 1,
+            /// @brief 1 / sqrt(m/z) is linear in the sample index
+            Orbitrap = 2,
+        };
+
+        inline double to_model_space(Model model, double x)
+        {
+            return model == Model::Tof ? std::sqrt(x) : 1.0 / std::sqrt(x);
+        }
+
+        /// @brief The model's prediction for sample index `k`. `std::fma` keeps the result identical whether
+        /// or not the compiler would otherwise contract `a + b * k`, which encoder and decoder rely on.
+        template <typename T>
+        T predict(Model model, double a, double b, int64_t k)
+        {
+            double t = std::fma(b, (double)k, a);
+            return (T)(model == Model::Tof ? t * t : 1.0 / (t * t));
+        }
+
+        /// @brief Set on a segment's model byte when its residuals are differenced
+        inline constexpr byte_t differenced_flag = 0x80;
+
+        /// @brief Bijective zigzag mapping on the full width of `U`, so small negative differences stay small
+        template <typename U>
+        U zigzag(U value)
+        {
+            using S = std::make_signed_t<U>;
+            return (U)(value << 1) ^ (U)((S)value >> (sizeof(U) * 8 - 1));
+        }
+
+        template <typename U>
+        U unzigzag(U value)
+        {
+            return (U)(value >> 1) ^ (U)(0 - (value & 1));
+        }
+
+        /// @brief One segment's fit and encoded streams
+        template <typename T>
+        struct SegmentFit
+        {
+            Model model = Model::Raw;
+            double a = 0;
+            double b = 0;
+            bool differenced = false;
+            buffer_t steps;
+            std::vector<uint_of<sizeof(T)>> words;
+            /// @brief The approximate number of bits needed by the steps and residuals
+            uint64_t cost = std::numeric_limits<uint64_t>::max();
+        };
+
+        /// @brief Fit `segment` to `model` and encode it
+        /// @return Whether the values could be expressed in the model at all
+        template <typename T>
+        bool fit(Model model, const std::span<const T> &segment, SegmentFit<T> &result)
+        {
+            using U = uint_of<sizeof(T)>;
+            const size_t n = segment.size();
+            std::vector<double> t(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                double x = (double)segment[i];
+                if (!(x > 0.0) || !std::isfinite(x))
+                {
+                    return false;
+                }
+                t[i] = to_model_space(model, x);
+            }
+
+            // The typical step between neighbouring samples; gaps between peaks are whole multiples of it
+            std::vector<double> diffs;
+            diffs.reserve(n);
+            for (size_t i = 1; i < n; i++)
+            {
+                if (t[i] != t[i - 1])
+                {
+                    diffs.push_back(t[i] - t[i - 1]);
+                }
+            }
+            double a = t[0];
+            double b = 0.0;
+            std::vector<int64_t> ks(n, 0);
+            if (!diffs.empty())
+            {
+                std::nth_element(diffs.begin(), diffs.begin() + diffs.size() / 2, diffs.end());
+                double step = diffs[diffs.size() / 2];
+                double num = 0.0;
+                double den = 0.0;
+                for (size_t i = 0; i < n; i++)
+                {
+                    double k = std::round((t[i] - a) / step);
+                    if (!(std::abs(k) < 1e12))
+                    {
+                        return false;
+                    }
+                    ks[i] = (int64_t)k;
+                    num += k * (t[i] - a);
+                    den += k * k;
+                }
+                b = den > 0 ? num / den : step;
+            }
+
+            result.model = model;
+            result.a = a;
+            result.b = b;
+            result.steps.clear();
+            result.words.resize(n);
+            uint64_t step_cost = 0;
+            uint64_t plain_cost = 0;
+            uint64_t differenced_cost = 0;
+            U previous = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                if (i > 0)
+                {
+                    auto before = result.steps.size();
+                    binary::write_varint(result.steps, binary::zigzag_encode(ks[i] - ks[i - 1] - 1));
+                    step_cost += (result.steps.size() - before) * 2;
+                }
+                U residual = (U)(std::bit_cast<U>(segment[i]) - std::bit_cast<U>(predict<T>(model, a, b, ks[i])));
+                result.words[i] = residual;
+                plain_cost += std::bit_width(zigzag<U>(residual));
+                differenced_cost += std::bit_width(zigzag<U>((U)(residual - previous)));
+                previous = residual;
+            }
+            result.differenced = differenced_cost < plain_cost;
+            previous = 0;
+            for (auto &word : result.words)
+            {
+                U residual = word;
+                word = zigzag<U>(result.differenced ? (U)(residual - previous) : residual);
+                previous = residual;
+            }
+            result.cost = step_cost + std::min(plain_cost, differenced_cost);
+            return true;
+        }
+
+        /// @brief Encode `data` into a grid frame in `outBuffer`
+        /// @param data The array to encode
+        /// @param transposeBuffer An intermediate byte buffer
+        /// @param outBuffer The buffer to write the frame to
+        /// @param params The ZSTD compression level or parameters
+        /// @param segment_size The number of values fitted together
+        template <typename T>
+        void encode(const std::span<const T> &data,
+                    buffer_t &transposeBuffer,
+                    buffer_t &outBuffer,
+                    const CompressionParams &params,
+                    size_t segment_size = default_segment_size)
+        {
+            static_assert(std::is_floating_point_v<T>, "Grid compression models floating point m/z values");
+            using U = uint_of<sizeof(T)>;
+            segment_size = std::max<size_t>(segment_size, 2);
+
+            buffer_t models;
+            buffer_t steps;
+            std::vector<U> words;
+            words.reserve(data.size());
+            SegmentFit<T> best;
+            SegmentFit<T> candidate;
+            for (size_t start = 0; start < data.size(); start += segment_size)
+            {
+                auto segment = data.subspan(start, std::min(segment_size, data.size() - start));
+                // A model has to beat storing half of each value's bits, roughly what shuffling achieves on sorted m/z
+                best.model = Model::Raw;
+                best.cost = segment.size() * sizeof(T) * 4;
+                for (auto model : {Model::Tof, Model::Orbitrap})
+                {
+                    if (fit(model, segment, candidate) && candidate.cost < best.cost)
+                    {
+                        std::swap(best, candidate);
+                    }
+                }
+                models.push_back((byte_t)best.model | (best.model != Model::Raw && best.differenced ? differenced_flag : 0));
+                if (best.model == Model::Raw)
+                {
+                    for (auto value : segment)
+                    {
+                        words.push_back(std::bit_cast<U>(value));
+                    }
+                }
+                else
+                {
+                    binary::write_le<uint64_t>(models, std::bit_cast<uint64_t>(best.a));
+                    binary::write_le<uint64_t>(models, std::bit_cast<uint64_t>(best.b));
+                    steps.insert(steps.end(), best.steps.begin(), best.steps.end());
+                    words.insert(words.end(), best.words.begin(), best.words.end());
+                }
+            }
+
+            buffer_t payload;
+            payload.reserve(models.size() + steps.size() + words.size() * sizeof(U));
+            payload.insert(payload.end(), models.begin(), models.end());
+            payload.insert(payload.end(), steps.begin(), steps.end());
+            inner::transpose<U>(words, transposeBuffer);
+            payload.insert(payload.end(), transposeBuffer.begin(), transposeBuffer.end());
+
+            buffer_t compressed;
+            inner::zstd_compress_into(payload.data(), payload.size(), compressed, params);
+            outBuffer.clear();
+            outBuffer.reserve(header_size + compressed.size());
+            outBuffer.insert(outBuffer.end(), magic.begin(), magic.end());
+            outBuffer.push_back(version);
+            outBuffer.push_back(sizeof(T));
+            outBuffer.push_back(0);
+            outBuffer.push_back(0);
+            binary::write_le<uint64_t>(outBuffer, data.size());
+            binary::write_le<uint64_t>(outBuffer, segment_size);
+            binary::write_le<uint64_t>(outBuffer, models.size());
+            binary::write_le<uint64_t>(outBuffer, steps.size());
+            outBuffer.insert(outBuffer.end(), compressed.begin(), compressed.end());
+        }
+
+        /// @brief Decode a grid frame written by `encode`
+        template <typename T>
+        void decode(const buffer_span_t &buffer,
+                    buffer_t &transposeBuffer,
+                    std::vector<T> &dataBuffer,
+                    const DecompressionParams &params)
+        {
+            static_assert(std::is_floating_point_v<T>, "Grid compression models floating point m/z values");
+            using U = uint_of<sizeof(T)>;
+            if (buffer.size() < header_size || !std::equal(magic.begin(), magic.end(), buffer.begin()))
+            {
+                throw std::runtime_error("Not a grid-compressed buffer");
+            }
+            if (buffer[4] != version || buffer[5] != sizeof(T))
+            {
+                std::stringstream ss;
+                ss << "Cannot decode grid frame version " << (int)buffer[4] << " holding " << (int)buffer[5]
+                   << " byte values as " << sizeof(T) << " byte values";
+                throw std::runtime_error(ss.str());
+            }
+            const uint64_t n = binary::read_le<uint64_t>(buffer.data() + 8);
+            const uint64_t segment_size = binary::read_le<uint64_t>(buffer.data() + 16);
+            const uint64_t model_bytes = binary::read_le<uint64_t>(buffer.data() + 24);
+            const uint64_t step_bytes = binary::read_le<uint64_t>(buffer.data() + 32);
+
+            inner::zstd_decompress_into(buffer.subspan(header_size), transposeBuffer, params);
+            if (segment_size < 2 || model_bytes > transposeBuffer.size() || step_bytes > transposeBuffer.size() - model_bytes ||
+                transposeBuffer.size() - model_bytes - step_bytes != n * sizeof(U))
+            {
+                throw std::runtime_error("Malformed grid frame, payload size does not match header");
+            }
+            buffer_span_t payload(transposeBuffer);
+            auto models = payload.subspan(0, model_bytes);
+            auto steps = payload.subspan(model_bytes, step_bytes);
+            std::vector<U> words;
+            inner::reverse_transpose<U>(payload.subspan(model_bytes + step_bytes), words);
+
+            dataBuffer.resize(n);
+            size_t model_offset = 0;
+            size_t step_offset = 0;
+            for (uint64_t start = 0; start < n; start += segment_size)
+            {
+                auto end = std::min<uint64_t>(start + segment_size, n);
+                if (model_offset >= models.size())
+                {
+                    throw std::runtime_error("Malformed grid frame, missing segment model");
+                }
+                const bool differenced = (models[model_offset] & differenced_flag) != 0;
+                auto model = (Model)(models[model_offset++] & ~differenced_flag);
+                if (model == Model::Raw)
+                {
+                    for (auto i = start; i < end; i++)
+                    {
+                        dataBuffer[i] = std::bit_cast<T>(words[i]);
+                    }
+                    continue;
+                }
+                if (model != Model::Tof && model != Model::Orbitrap)
+                {
+                    throw std::runtime_error("Malformed grid frame, unknown segment model");
+                }
+                if (model_offset + 2 * sizeof(uint64_t) > models.size())
+                {
+                    throw std::runtime_error("Malformed grid frame, truncated segment model");
+                }
+                double a = std::bit_cast<double>(binary::read_le<uint64_t>(models.data() + model_offset));
+                double b = std::bit_cast<double>(binary::read_le<uint64_t>(models.data() + model_offset + 8));
+                model_offset += 16;
+                int64_t k = 0;
+                U residual = 0;
+                for (auto i = start; i < end; i++)
+                {
+                    if (i > start)
+                    {
+                        k += binary::zigzag_decode(binary::read_varint(steps, step_offset)) + 1;
+                    }
+                    residual = differenced ? (U)(residual + unzigzag<U>(words[i])) : unzigzag<U>(words[i]);
+                    dataBuffer[i] = std::bit_cast<T>((U)(std::bit_cast<U>(predict<T>(model, a, b, k)) + residual));
+                }
+            }
+        }
+    }
+
+    /// @brief Compress a profile m/z array by fitting it to the TOF or Orbitrap sampling law and storing only
+    /// the deviations from the model. Segments that fit neither keep their raw values. Data will be stored in little
+    /// endian byte order.
+    /// @tparam T The floating point type of the array to compress
+    /// @param data The data array to compress
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outBuffer A byte buffer to write the compressed frame to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t grid_compress_buffer(const std::span<const T> &data,
+                                buffer_t &transposeBuffer,
+                                buffer_t &outBuffer,
+                                const CompressionParams &params = CompressionParams())
+    {
+        grid::encode(data, transposeBuffer, outBuffer, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t grid_compress_buffer(const std::vector<T> &data,
+                                buffer_t &transposeBuffer,
+                                buffer_t &outBuffer,
+                                const CompressionParams &params = CompressionParams())
+    {
+        return grid_compress_buffer(std::span<const T>(data.data(), data.size()), transposeBuffer, outBuffer, params);
+    }
+
+    template <typename T>
+    size_t grid_compress_buffer(const std::vector<T> &data, buffer_t &outBuffer, const CompressionParams &params = CompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return grid_compress_buffer(data, transposeBuffer, outBuffer, params);
+    }
+
+    /// @brief Decompress an array written by `grid_compress_buffer`
+    /// @tparam T The floating point type of the array to decompress
+    /// @param buffer The compressed frame
+    /// @param transposeBuffer An intermediate byte buffer
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t grid_decompress_buffer(const buffer_span_t &buffer,
+                                  buffer_t &transposeBuffer,
+                                  std::vector<T> &dataBuffer,
+                                  const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        grid::decode(buffer, transposeBuffer, dataBuffer, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t grid_decompress_buffer(const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return grid_decompress_buffer(buffer, transposeBuffer, dataBuffer, params);
+    }
+
+    /// @brief Implementation of sparse compression for arrays that are mostly exact zeros, like profile intensities
+    /// between peaks. Only the non-zero values are shuffled and compressed, together with where they go, given either
+    /// as a bitmap or as a list of alternating zero and non-zero run lengths, whichever is smaller. A value counts as
+    /// zero only if all of its bits are, so -0.0 is kept as a value and decoding is bit-exact.
+    ///
+    /// Frame layout, all integers little endian:
+    ///  - 4 byte magic "MZSP", 1 byte version, 1 byte value size, 1 byte `Layout`, 1 reserved byte
+    ///  - u64 number of values, u64 number of non-zero values, u64 position stream size
+    ///  - a ZSTD frame holding the position stream followed by the shuffled non-zero values
+    namespace sparse
+    {
+        using binary::uint_of;
+
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'S', 'P'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + 3 * sizeof(uint64_t);
+
+        /// @brief How the positions of the non-zero values are stored
+        enum class Layout : uint8_t
+        {
+            /// @brief One bit per value, least significant bit first
+            Bitmap = 0,
+            /// @brief Varint lengths of alternating runs, starting with a (possibly empty) run of zeros
+            Runs = 1,
+        };
+
+        template <typename T>
+        bool is_zero(const T &value)
+        {
+            return std::bit_cast<uint_of<sizeof(T)>>(value) == 0;
+        }
+
+        /// @brief Encode `data` into a sparse frame in `outBuffer`
+        template <typename T>
+        void encode(const std::span<const T> &data, buffer_t &transposeBuffer, buffer_t &outBuffer, const CompressionParams &params)
+        {
+            const size_t n = data.size();
+            std::vector<T> values;
+            buffer_t runs;
+            size_t start = 0;
+            bool in_values = false;
+            for (size_t i = 0; i < n; i++)
+            {
+                bool zero = is_zero(data[i]);
+                if (zero == in_values)
+                {
+                    binary::write_varint(runs, i - start);
+                    start = i;
+                    in_values = !zero;
+                }
+                if (!zero)
+                {
+                    values.push_back(data[i]);
+                }
+            }
+            binary::write_varint(runs, n - start);
+
+            Layout layout = Layout::Runs;
+            buffer_t positions;
+            if ((n + 7) / 8 < runs.size())
+            {
+                layout = Layout::Bitmap;
+                positions.assign((n + 7) / 8, 0);
+                for (size_t i = 0; i < n; i++)
+                {
+                    if (!is_zero(data[i]))
+                    {
+                        positions[i / 8] |= (byte_t)(1u << (i % 8));
+                    }
+                }
+            }
+            else
+            {
+                positions = std::move(runs);
+            }
+
+            inner::transpose<T>(values, transposeBuffer);
+            buffer_t payload;
+            payload.reserve(positions.size() + transposeBuffer.size());
+            payload.insert(payload.end(), positions.begin(), positions.end());
+            payload.insert(payload.end(), transposeBuffer.begin(), transposeBuffer.end());
+
+            buffer_t compressed;
+            inner::zstd_compress_into(payload.data(), payload.size(), compressed, params);
+            outBuffer.clear();
+            outBuffer.reserve(header_size + compressed.size());
+            outBuffer.insert(outBuffer.end(), magic.begin(), magic.end());
+            outBuffer.push_back(version);
+            outBuffer.push_back(sizeof(T));
+            outBuffer.push_back((byte_t)layout);
+            outBuffer.push_back(0);
+            binary::write_le<uint64_t>(outBuffer, n);
+            binary::write_le<uint64_t>(outBuffer, values.size());
+            binary::write_le<uint64_t>(outBuffer, positions.size());
+            outBuffer.insert(outBuffer.end(), compressed.begin(), compressed.end());
+        }
+
+        /// @brief Decode a sparse frame written by `encode`. Runs of values are copied as blocks, and the bitmap is
+        /// walked a 64-bit word at a time, skipping all-zero words, so the work beyond clearing the output follows
+        /// the number of non-zero values.
+        template <typename T>
+        void decode(const buffer_span_t &buffer, buffer_t &transposeBuffer, std::vector<T> &dataBuffer, const DecompressionParams &params)
+        {
+            if (buffer.size() < header_size || !std::equal(magic.begin(), magic.end(), buffer.begin()))
+            {
+                throw std::runtime_error("Not a sparse-compressed buffer");
+            }
+            if (buffer[4] != version || buffer[5] != sizeof(T))
+            {
+                std::stringstream ss;
+                ss << "Cannot decode sparse frame version " << (int)buffer[4] << " holding " << (int)buffer[5]
+                   << " byte values as " << sizeof(T) << " byte values";
+                throw std::runtime_error(ss.str());
+            }
+            const auto layout = (Layout)buffer[6];
+            const uint64_t n = binary::read_le<uint64_t>(buffer.data() + 8);
+            const uint64_t nnz = binary::read_le<uint64_t>(buffer.data() + 16);
+            const uint64_t position_bytes = binary::read_le<uint64_t>(buffer.data() + 24);
+
+            inner::zstd_decompress_into(buffer.subspan(header_size), transposeBuffer, params);
+            if (nnz > n || position_bytes > transposeBuffer.size() || transposeBuffer.size() - position_bytes != nnz * sizeof(T) ||
+                (layout == Layout::Bitmap && position_bytes != (n + 7) / 8))
+            {
+                throw std::runtime_error("Malformed sparse frame, payload size does not match header");
+            }
+            buffer_span_t payload(transposeBuffer);
+            auto positions = payload.subspan(0, position_bytes);
+            std::vector<T> values;
+            inner::reverse_transpose<T>(payload.subspan(position_bytes), values);
+
+            dataBuffer.assign(n, T());
+            size_t next = 0;
+            if (layout == Layout::Runs)
+            {
+                size_t offset = 0;
+                size_t i = 0;
+                bool in_values = false;
+                while (offset < positions.size())
+                {
+                    auto length = binary::read_varint(positions, offset);
+                    if (length > n - i || (in_values && length > nnz - next))
+                    {
+                        throw std::runtime_error("Malformed sparse frame, run overflows the array");
+                    }
+                    if (in_values)
+                    {
+                        std::copy_n(values.begin() + next, length, dataBuffer.begin() + i);
+                        next += length;
+                    }
+                    i += length;
+                    in_values = !in_values;
+                }
+            }
+            else if (layout == Layout::Bitmap)
+            {
+                for (size_t word_start = 0; word_start < n; word_start += 64)
+                {
+                    std::array<byte_t, 8> bytes = {};
+                    std::memcpy(bytes.data(), positions.data() + word_start / 8, std::min<size_t>(8, positions.size() - word_start / 8));
+                    auto word = binary::read_le<uint64_t>(bytes.data());
+                    while (word != 0)
+                    {
+                        auto bit = std::countr_zero(word);
+                        word &= word - 1;
+                        if (next >= nnz || word_start + bit >= n)
+                        {
+                            throw std::runtime_error("Malformed sparse frame, bitmap does not match value count");
+                        }
+                        dataBuffer[word_start + bit] = values[next++];
+                    }
+                }
+            }
+            else
+            {
+                throw std::runtime_error("Malformed sparse frame, unknown position layout");
+            }
+            if (next != nnz)
+            {
+                throw std::runtime_error("Malformed sparse frame, positions do not cover every value");
+            }
+        }
+    }
+
+    /// @brief Compress an array that is mostly zeros by storing only its non-zero values and their positions.
+    /// Data will be stored in little endian byte order.
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outBuffer A byte buffer to write the compressed frame to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t sparse_compress_buffer(const std::span<const T> &data,
+                                  buffer_t &transposeBuffer,
+                                  buffer_t &outBuffer,
+                                  const CompressionParams &params = CompressionParams())
+    {
+        sparse::encode(data, transposeBuffer, outBuffer, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t sparse_compress_buffer(const std::vector<T> &data,
+                                  buffer_t &transposeBuffer,
+                                  buffer_t &outBuffer,
+                                  const CompressionParams &params = CompressionParams())
+    {
+        return sparse_compress_buffer(std::span<const T>(data.data(), data.size()), transposeBuffer, outBuffer, params);
+    }
+
+    template <typename T>
+    size_t sparse_compress_buffer(const std::vector<T> &data, buffer_t &outBuffer, const CompressionParams &params = CompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return sparse_compress_buffer(data, transposeBuffer, outBuffer, params);
+    }
+
+    /// @brief Decompress an array written by `sparse_compress_buffer`
+    /// @tparam T The data type of the array to decompress
+    /// @param buffer The compressed frame
+    /// @param transposeBuffer An intermediate byte buffer
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t sparse_decompress_buffer(const buffer_span_t &buffer,
+                                    buffer_t &transposeBuffer,
+                                    std::vector<T> &dataBuffer,
+                                    const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        sparse::decode(buffer, transposeBuffer, dataBuffer, params);
+        return 0;
+    }
+
+    template <typename T>
+    size_t sparse_decompress_buffer(const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return sparse_decompress_buffer(buffer, transposeBuffer, dataBuffer, params);
+    }
+
+    /// @brief Implementation of chunked compression with per-chunk statistics.
+    ///
+    /// The array is split into fixed-size chunks. Each chunk is byte shuffled and ZSTD compressed on its own, and
+    /// an index stores each chunk's minimum, maximum and (optionally) sum. Value-range queries then decode only the
+    /// chunks whose range can match. For sorted arrays, the chunks to decode are found by binary search.
+    ///
+    /// Frame layout, all integers little endian:
+    ///  - 4 byte magic "MZCK", 1 byte version, 1 byte value size, 1 byte flags (bit 0: sorted, bit 1: sums), 1 reserved byte
+    ///  - u64 number of values, u64 chunk size, u64 number of chunks
+    ///  - per chunk: minimum and maximum as little endian values of the array's type, the sum as an IEEE double if
+    ///    stored, and the u64 size of the chunk's ZSTD frame
+    ///  - the chunks' ZSTD frames, one after another
+    namespace chunked
+    {
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'C', 'K'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + 3 * sizeof(uint64_t);
+        inline constexpr byte_t sorted_flag = 1;
+        inline constexpr byte_t sums_flag = 2;
+
+        /// @brief How `chunked_compress_buffer` splits and describes an array
+        struct Options
+        {
+            /// @brief The number of values in each chunk, trading query selectivity against compression ratio
+            size_t chunk_size = 4096;
+            /// @brief Whether to store the sum of each chunk, e.g. to total intensities without decoding
+            bool store_sums = false;
+        };
+
+        /// @brief What the index records about one chunk
+        template <typename T>
+        struct ChunkStats
+        {
+            /// @brief The position of the chunk's first value in the array
+            size_t offset;
+            size_t count;
+            /// @brief The smallest and largest values, ignoring NaNs. `min > max` if the chunk holds only NaNs.
+            T min;
+            T max;
+            /// @brief The sum of the chunk's values, NaN if sums were not stored
+            double sum;
+            /// @brief Where the chunk's ZSTD frame starts in the buffer, and its size
+            size_t frame_offset;
+            size_t frame_size;
+        };
+
+        /// @brief The parsed frame header and chunk index
+        template <typename T>
+        struct Index
+        {
+            size_t size = 0;
+            size_t chunk_size = 0;
+            bool sorted = false;
+            bool has_sums = false;
+            std::vector<ChunkStats<T>> chunks;
+        };
+
+        template <typename T>
+        constexpr size_t entry_size(bool sums)
+        {
+            return 2 * sizeof(T) + (sums ? sizeof(double) : 0) + sizeof(uint64_t);
+        }
+
+        template <typename T>
+        bool is_nan(const T &value)
+        {
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                return std::isnan(value);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        /// @brief Encode `data` into a chunked frame in `outBuffer`
+        template <typename T>
+        void encode(const std::span<const T> &data, buffer_t &transposeBuffer, buffer_t &outBuffer, const CompressionParams &params, const Options &options)
+        {
+            using U = binary::uint_of<sizeof(T)>;
+            const size_t chunk_size = std::max<size_t>(options.chunk_size, 1);
+            const size_t n_chunks = (data.size() + chunk_size - 1) / chunk_size;
+            const bool sorted = std::none_of(data.begin(), data.end(), is_nan<T>) && std::is_sorted(data.begin(), data.end());
+
+            std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+            if (!cctx)
+            {
+                throw std::runtime_error("Failed to allocate ZSTD compression context");
+            }
+            buffer_t index;
+            buffer_t frames;
+            buffer_t frame;
+            for (size_t start = 0; start < data.size(); start += chunk_size)
+            {
+                auto chunk = data.subspan(start, std::min(chunk_size, data.size() - start));
+                T lo = std::numeric_limits<T>::max();
+                T hi = std::numeric_limits<T>::lowest();
+                double sum = 0.0;
+                for (auto value : chunk)
+                {
+                    if (!is_nan(value))
+                    {
+                        lo = std::min(lo, value);
+                        hi = std::max(hi, value);
+                    }
+                    sum += (double)value;
+                }
+                binary::write_le<U>(index, std::bit_cast<U>(lo));
+                binary::write_le<U>(index, std::bit_cast<U>(hi));
+                if (options.store_sums)
+                {
+                    binary::write_le<uint64_t>(index, std::bit_cast<uint64_t>(sum));
+                }
+                inner::transpose<T>(chunk, transposeBuffer);
+                inner::zstd_compress_into(cctx.get(), transposeBuffer.data(), transposeBuffer.size(), frame, params);
+                binary::write_le<uint64_t>(index, frame.size());
+                frames.insert(frames.end(), frame.begin(), frame.end());
+            }
+
+            outBuffer.clear();
+            outBuffer.reserve(header_size + index.size() + frames.size());
+            outBuffer.insert(outBuffer.end(), magic.begin(), magic.end());
+            outBuffer.push_back(version);
+            outBuffer.push_back(sizeof(T));
+            outBuffer.push_back((sorted ? sorted_flag : 0) | (options.store_sums ? sums_flag : 0));
+            outBuffer.push_back(0);
+            binary::write_le<uint64_t>(outBuffer, data.size());
+            binary::write_le<uint64_t>(outBuffer, chunk_size);
+            binary::write_le<uint64_t>(outBuffer, n_chunks);
+            outBuffer.insert(outBuffer.end(), index.begin(), index.end());
+            outBuffer.insert(outBuffer.end(), frames.begin(), frames.end());
+        }
+
+        /// @brief Parse the header and chunk index of a chunked frame without decoding any chunk
+        template <typename T>
+        Index<T> read_index(const buffer_span_t &buffer)
+        {
+            using U = binary::uint_of<sizeof(T)>;
+            if (buffer.size() < header_size || !std::equal(magic.begin(), magic.end(), buffer.begin()))
+            {
+                throw std::runtime_error("Not a chunked buffer");
+            }
+            if (buffer[4] != version || buffer[5] != sizeof(T))
+            {
+                std::stringstream ss;
+                ss << "Cannot read chunked frame version " << (int)buffer[4] << " holding " << (int)buffer[5]
+                   << " byte values as " << sizeof(T) << " byte values";
+                throw std::runtime_error(ss.str());
+            }
+            Index<T> result;
+            result.sorted = (buffer[6] & sorted_flag) != 0;
+            result.has_sums = (buffer[6] & sums_flag) != 0;
+            result.size = binary::read_le<uint64_t>(buffer.data() + 8);
+            const uint64_t chunk_size = binary::read_le<uint64_t>(buffer.data() + 16);
+            result.chunk_size = chunk_size;
+            const uint64_t n_chunks = binary::read_le<uint64_t>(buffer.data() + 24);
+            const size_t stride = entry_size<T>(result.has_sums);
+            if (chunk_size == 0 || n_chunks != (result.size + chunk_size - 1) / chunk_size ||
+                n_chunks > (buffer.size() - header_size) / stride)
+            {
+                throw std::runtime_error("Malformed chunked frame, chunk index does not match header");
+            }
+
+            result.chunks.reserve(n_chunks);
+            size_t frame_offset = header_size + n_chunks * stride;
+            for (size_t i = 0; i < n_chunks; i++)
+            {
+                const byte_t *entry = buffer.data() + header_size + i * stride;
+                ChunkStats<T> stats;
+                stats.offset = i * chunk_size;
+                stats.count = std::min<size_t>(chunk_size, result.size - stats.offset);
+                stats.min = std::bit_cast<T>(binary::read_le<U>(entry));
+                stats.max = std::bit_cast<T>(binary::read_le<U>(entry + sizeof(T)));
+                stats.sum = result.has_sums ? std::bit_cast<double>(binary::read_le<uint64_t>(entry + 2 * sizeof(T)))
+                                            : std::numeric_limits<double>::quiet_NaN();
+                stats.frame_size = binary::read_le<uint64_t>(entry + stride - sizeof(uint64_t));
+                stats.frame_offset = frame_offset;
+                if (stats.frame_size > buffer.size() - frame_offset)
+                {
+                    throw std::runtime_error("Malformed chunked frame, chunk extends past the end of the buffer");
+                }
+                frame_offset += stats.frame_size;
+                result.chunks.push_back(stats);
+            }
+            return result;
+        }
+
+        /// @brief Decode one chunk, replacing the contents of `values` with its values
+        template <typename T>
+        void decode_chunk(ZSTD_DCtx *dctx,
+                          const buffer_span_t &buffer,
+                          const ChunkStats<T> &chunk,
+                          buffer_t &transposeBuffer,
+                          std::vector<T> &values,
+                          const DecompressionParams &params)
+        {
+            inner::zstd_decompress_into(dctx, buffer.subspan(chunk.frame_offset, chunk.frame_size), transposeBuffer, params);
+            if (transposeBuffer.size() != chunk.count * sizeof(T))
+            {
+                throw std::runtime_error("Malformed chunked frame, chunk size does not match its index entry");
+            }
+            inner::reverse_transpose<T>(transposeBuffer, values);
+        }
+
+        inline std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> make_dctx()
+        {
+            std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+            if (!dctx)
+            {
+                throw std::runtime_error("Failed to allocate ZSTD decompression context");
+            }
+            return dctx;
+        }
+    }
+
+    /// @brief Compress an array in independently compressed chunks, each described by its minimum, maximum and
+    /// optionally its sum, so that `decompress_where` and `chunked_decompress_range` can skip chunks. Data will be
+    /// stored in little endian byte order.
+    /// @tparam T The data type of the array to compress
+    /// @param data The data array to compress
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outBuffer A byte buffer to write the compressed frame to
+    /// @param params The ZSTD compression level or parameters
+    /// @param options The chunk size and whether to store sums
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t chunked_compress_buffer(const std::span<const T> &data,
+                                   buffer_t &transposeBuffer,
+                                   buffer_t &outBuffer,
+                                   const CompressionParams &params = CompressionParams(),
+                                   const chunked::Options &options = chunked::Options())
+    {
+        chunked::encode(data, transposeBuffer, outBuffer, params, options);
+        return 0;
+    }
+
+    template <typename T>
+    size_t chunked_compress_buffer(const std::vector<T> &data,
+                                   buffer_t &transposeBuffer,
+                                   buffer_t &outBuffer,
+                                   const CompressionParams &params = CompressionParams(),
+                                   const chunked::Options &options = chunked::Options())
+    {
+        return chunked_compress_buffer(std::span<const T>(data.data(), data.size()), transposeBuffer, outBuffer, params, options);
+    }
+
+    template <typename T>
+    size_t chunked_compress_buffer(const std::vector<T> &data,
+                                   buffer_t &outBuffer,
+                                   const CompressionParams &params = CompressionParams(),
+                                   const chunked::Options &options = chunked::Options())
+    {
+        buffer_t transposeBuffer;
+        return chunked_compress_buffer(data, transposeBuffer, outBuffer, params, options);
+    }
+
+    /// @brief Decompress a whole array written by `chunked_compress_buffer`
+    /// @tparam T The data type of the array to decompress
+    /// @param buffer The compressed frame
+    /// @param transposeBuffer An intermediate byte buffer
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t chunked_decompress_buffer(const buffer_span_t &buffer,
+                                     buffer_t &transposeBuffer,
+                                     std::vector<T> &dataBuffer,
+                                     const DecompressionParams &params = DecompressionParams())
+    {
+        dataBuffer.clear();
+        if (buffer.empty())
+        {
+            return 0;
+        }
+        auto index = chunked::read_index<T>(buffer);
+        auto dctx = chunked::make_dctx();
+        dataBuffer.reserve(index.size);
+        std::vector<T> values;
+        for (auto &chunk : index.chunks)
+        {
+            chunked::decode_chunk(dctx.get(), buffer, chunk, transposeBuffer, values, params);
+            dataBuffer.insert(dataBuffer.end(), values.begin(), values.end());
+        }
+        return 0;
+    }
+
+    template <typename T>
+    size_t chunked_decompress_buffer(const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return chunked_decompress_buffer(buffer, transposeBuffer, dataBuffer, params);
+    }
+
+    /// @brief Decompress the values at positions `[begin, end)` of an array written by `chunked_compress_buffer`,
+    /// decoding only the chunks that overlap it. Useful to read the intensities matching positions found by
+    /// `decompress_where` on the m/z array.
+    /// @tparam T The data type of the array to decompress
+    /// @param buffer The compressed frame
+    /// @param begin The first position to read
+    /// @param end One past the last position to read, clamped to the array's length
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t chunked_decompress_range(const buffer_span_t &buffer,
+                                    size_t begin,
+                                    size_t end,
+                                    std::vector<T> &dataBuffer,
+                                    const DecompressionParams &params = DecompressionParams())
+    {
+        dataBuffer.clear();
+        if (buffer.empty())
+        {
+            return 0;
+        }
+        auto index = chunked::read_index<T>(buffer);
+        end = std::min(end, index.size);
+        if (begin >= end)
+        {
+            return 0;
+        }
+        auto dctx = chunked::make_dctx();
+        buffer_t transposeBuffer;
+        std::vector<T> values;
+        for (size_t c = begin / index.chunk_size; c < index.chunks.size() && index.chunks[c].offset < end; c++)
+        {
+            auto &chunk = index.chunks[c];
+            chunked::decode_chunk(dctx.get(), buffer, chunk, transposeBuffer, values, params);
+            auto from = std::max(begin, chunk.offset) - chunk.offset;
+            auto to = std::min(end, chunk.offset + chunk.count) - chunk.offset;
+            dataBuffer.insert(dataBuffer.end(), values.begin() + from, values.begin() + to);
+        }
+        return 0;
+    }
+
+    /// @brief Decompress only the values `v` with `lo <= v <= hi` from an array written by `chunked_compress_buffer`.
+    /// Chunks whose minimum and maximum rule out a match are never decoded; for sorted arrays the matching chunks are
+    /// found by binary search over the chunk index and the matching run within them by binary search over the values.
+    /// @tparam T The data type of the array to decompress
+    /// @param buffer The compressed frame
+    /// @param lo The smallest value to return
+    /// @param hi The largest value to return
+    /// @param dataBuffer The matching values, in array order
+    /// @param positions If not null, receives the position of each matching value in the array
+    /// @param params The ZSTD decompression parameters
+    /// @return The number of chunks that were decoded
+    template <typename T>
+    size_t decompress_where(const buffer_span_t &buffer,
+                            T lo,
+                            T hi,
+                            std::vector<T> &dataBuffer,
+                            std::vector<size_t> *positions = nullptr,
+                            const DecompressionParams &params = DecompressionParams())
+    {
+        dataBuffer.clear();
+        if (positions != nullptr)
+        {
+            positions->clear();
+        }
+        if (buffer.empty() || !(lo <= hi))
+        {
+            return 0;
+        }
+        auto index = chunked::read_index<T>(buffer);
+        auto &chunks = index.chunks;
+        auto first = chunks.begin();
+        auto last = chunks.end();
+        if (index.sorted)
+        {
+            first = std::partition_point(chunks.begin(), chunks.end(), [&](const chunked::ChunkStats<T> &c)
+                                         { return c.max < lo; });
+            last = std::partition_point(first, chunks.end(), [&](const chunked::ChunkStats<T> &c)
+                                        { return !(hi < c.min); });
+        }
+
+        auto dctx = chunked::make_dctx();
+        buffer_t transposeBuffer;
+        std::vector<T> values;
+        size_t decoded = 0;
+        for (auto it = first; it != last; ++it)
+        {
+            if (it->max < lo || hi < it->min)
+            {
+                continue;
+            }
+            chunked::decode_chunk(dctx.get(), buffer, *it, transposeBuffer, values, params);
+            decoded++;
+            size_t from = 0;
+            size_t to = values.size();
+            if (index.sorted)
+            {
+                from = std::lower_bound(values.begin(), values.end(), lo) - values.begin();
+                to = std::upper_bound(values.begin() + from, values.end(), hi) - values.begin();
+            }
+            for (size_t i = from; i < to; i++)
+            {
+                if (lo <= values[i] && values[i] <= hi)
+                {
+                    dataBuffer.push_back(values[i]);
+                    if (positions != nullptr)
+                    {
+                        positions->push_back(it->offset + i);
+                    }
+                }
+            }
+        }
+        return decoded;
+    }
+
+    /// @brief Implementation of a lightweight codec for integer arrays such as charge states, scan numbers and counts.
+    ///
+    /// Values are coded in blocks of 128. Each block stores either its values' offsets from the block minimum
+    /// (frame of reference) or the zigzag-encoded differences between neighbouring values, whichever needs fewer
+    /// bits, bit-packed at that width into 64-bit words. There is no entropy coder, so decoding is a tight unpack and
+    /// (for delta blocks) prefix sum loop. An optional ZSTD stage can follow for arrays with longer-range redundancy.
+    ///
+    /// Frame layout, all integers little endian:
+    ///  - 4 byte magic "MZIP", 1 byte version, 1 byte value size, 1 byte flags (bit 0: ZSTD stage), 1 reserved byte
+    ///  - u64 number of values
+    ///  - the packed blocks, or a ZSTD frame holding them: per block a 1 byte `BlockMode`, a 1 byte bit width,
+    ///    a u64 reference (the minimum, or the first value), then the packed words
+    namespace intpack
+    {
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'I', 'P'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + sizeof(uint64_t);
+        inline constexpr size_t block_size = 128;
+        inline constexpr byte_t zstd_flag = 1;
+
+        enum class BlockMode : uint8_t
+        {
+            /// @brief Values minus the block minimum
+            FrameOfReference = 0,
+            /// @brief Zigzag-encoded differences from the previous value, the first value being the reference
+            Delta = 1,
+        };
+
+        inline uint64_t zigzag(uint64_t value)
+        {
+            return (value << 1) ^ (uint64_t)((int64_t)value >> 63);
+        }
+
+        inline uint64_t unzigzag(uint64_t value)
+        {
+            return (value >> 1) ^ (0 - (value & 1));
+        }
+
+        /// @brief Append `values` to `out` packed at `width` bits each, padded to a whole number of 64-bit words
+        inline void pack(const uint64_t *values, size_t n, unsigned width, buffer_t &out)
+        {
+            if (width == 0)
+            {
+                return;
+            }
+            const size_t words = (n * width + 63) / 64;
+            const size_t start = out.size();
+            out.resize(start + words * sizeof(uint64_t));
+            byte_t *dst = out.data() + start;
+            uint64_t acc = 0;
+            unsigned filled = 0;
+            size_t w = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                const uint64_t v = values[i];
+                acc |= v << filled;
+                if (filled + width >= 64)
+                {
+                    binary::byte_view<uint64_t> view = binary::byte_view<uint64_t>::as_little_endian(acc);
+                    std::memcpy(dst + 8 * w++, view.buffer().data(), 8);
+                    acc = filled == 0 ? 0 : v >> (64 - filled);
+                    filled = filled + width - 64;
+                }
+                else
+                {
+                    filled += width;
+                }
+            }
+            if (filled > 0)
+            {
+                binary::byte_view<uint64_t> view = binary::byte_view<uint64_t>::as_little_endian(acc);
+                std::memcpy(dst + 8 * w, view.buffer().data(), 8);
+            }
+        }
+
+        /// @brief Read `n` values of `width` bits each from the packed words at `src`. Instantiated once per width so
+        /// the shifts and masks are constants the compiler can unroll and vectorize.
+        template <unsigned width>
+        void unpack_width(const byte_t *src, size_t n, uint64_t *values)
+        {
+            if constexpr (width == 0)
+            {
+                std::fill_n(values, n, 0);
+            }
+            else
+            {
+                constexpr uint64_t mask = width == 64 ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1);
+                // Load the block's words once, with a zero word past the end so no value needs a bounds check
+                std::array<uint64_t, 2 * block_size + 1> words;
+                const size_t n_words = (n * width + 63) / 64;
+                std::memcpy(words.data(), src, n_words * sizeof(uint64_t));
+                if constexpr (binary::is_big_endian())
+                {
+                    for (size_t w = 0; w < n_words; w++)
+                    {
+                        words[w] = binary::read_le<uint64_t>(src + 8 * w);
+                    }
+                }
+                words[n_words] = 0;
+                size_t bit = 0;
+                for (size_t i = 0; i < n; i++, bit += width)
+                {
+                    const size_t w = bit / 64;
+                    const unsigned offset = bit % 64;
+                    uint64_t v = words[w] >> offset;
+                    if constexpr (width > 1)
+                    {
+                        // Shifting by 64 is undefined, so split the shift to yield 0 when offset is 0
+                        v |= (words[w + 1] << (63 - offset)) << 1;
+                    }
+                    values[i] = v & mask;
+                }
+            }
+        }
+
+        template <size_t... widths>
+        constexpr auto make_unpack_table(std::index_sequence<widths...>)
+        {
+            return std::array<void (*)(const byte_t *, size_t, uint64_t *), sizeof...(widths)>{&unpack_width<widths>...};
+        }
+
+        /// @brief Read `n` values of `width` bits each from the packed words at `src`
+        inline void unpack(const byte_t *src, size_t n, unsigned width, uint64_t *values)
+        {
+            static constexpr auto table = make_unpack_table(std::make_index_sequence<65>());
+            table[width](src, n, values);
+        }
+
+        inline size_t packed_size(size_t n, unsigned width)
+        {
+            return ((n * width + 63) / 64) * sizeof(uint64_t);
+        }
+
+        /// @brief Append the packed blocks for `data` to `out`
+        template <typename T>
+        void encode_blocks(const std::span<const T> &data, buffer_t &out)
+        {
+            static_assert(std::is_integral_v<T>, "Integer packing requires an integral type");
+            std::array<uint64_t, block_size> offsets;
+            std::array<uint64_t, block_size> deltas;
+            for (size_t start = 0; start < data.size(); start += block_size)
+            {
+                const size_t n = std::min(block_size, data.size() - start);
+                const T *block = data.data() + start;
+                T lo = *std::min_element(block, block + n);
+                uint64_t for_bits = 0;
+                uint64_t delta_bits = 0;
+                for (size_t i = 0; i < n; i++)
+                {
+                    // Wrapping arithmetic in 64 bits keeps both transforms exact for every integer width
+                    offsets[i] = (uint64_t)((uint64_t)(int64_t)block[i] - (uint64_t)(int64_t)lo);
+                    deltas[i] = i == 0 ? 0 : zigzag((uint64_t)(int64_t)block[i] - (uint64_t)(int64_t)block[i - 1]);
+                    for_bits |= offsets[i];
+                    delta_bits |= deltas[i];
+                }
+                unsigned for_width = std::bit_width(for_bits);
+                unsigned delta_width = std::bit_width(delta_bits);
+                bool delta = delta_width < for_width;
+                out.push_back((byte_t)(delta ? BlockMode::Delta : BlockMode::FrameOfReference));
+                out.push_back((byte_t)(delta ? delta_width : for_width));
+                binary::write_le<uint64_t>(out, (uint64_t)(int64_t)(delta ? block[0] : lo));
+                pack(delta ? deltas.data() : offsets.data(), n, delta ? delta_width : for_width, out);
+            }
+        }
+
+        /// @brief Decode `n` values from the packed blocks in `blocks`
+        template <typename T>
+        void decode_blocks(const buffer_span_t &blocks, size_t n, std::vector<T> &dataBuffer)
+        {
+            static_assert(std::is_integral_v<T>, "Integer packing requires an integral type");
+            // Every block takes at least its 10 byte header, so a frame cannot hold more values than that allows.
+            // Checked before sizing the output, so a corrupt count is reported rather than allocated.
+            const size_t block_count = n / block_size + (n % block_size != 0);
+            if (block_count > blocks.size() / 10)
+            {
+                throw std::runtime_error("Malformed packed integer frame, more values than the frame can hold");
+            }
+            dataBuffer.resize(n);
+            std::array<uint64_t, block_size> unpacked;
+            size_t offset = 0;
+            for (size_t start = 0; start < n; start += block_size)
+            {
+                const size_t count = std::min(block_size, n - start);
+                if (blocks.size() - offset < 10)
+                {
+                    throw std::runtime_error("Malformed packed integer frame, truncated block header");
+                }
+                auto mode = (BlockMode)blocks[offset];
+                unsigned width = blocks[offset + 1];
+                uint64_t reference = binary::read_le<uint64_t>(blocks.data() + offset + 2);
+                offset += 10;
+                if (width > 64 || (mode != BlockMode::Delta && mode != BlockMode::FrameOfReference))
+                {
+                    throw std::runtime_error("Malformed packed integer frame, invalid block header");
+                }
+                auto size = packed_size(count, width);
+                if (blocks.size() - offset < size)
+                {
+                    throw std::runtime_error("Malformed packed integer frame, truncated block");
+                }
+                unpack(blocks.data() + offset, count, width, unpacked.data());
+                offset += size;
+                T *out = dataBuffer.data() + start;
+                if (mode == BlockMode::FrameOfReference)
+                {
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        out[i] = (T)(reference + unpacked[i]);
+                    }
+                }
+                else
+                {
+                    uint64_t value = reference;
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        value += unzigzag(unpacked[i]);
+                        out[i] = (T)value;
+                    }
+                }
+            }
+            if (offset != blocks.size())
+            {
+                throw std::runtime_error("Malformed packed integer frame, trailing bytes after the last block");
+            }
+        }
+    }
+
+    /// @brief Compress an array of integers with frame-of-reference or zigzag-delta coding and bit packing, optionally
+    /// followed by ZSTD. Data will be stored in little endian byte order.
+    /// @tparam T The integral type of the array to compress
+    /// @param data The data array to compress
+    /// @param packBuffer An intermediate byte buffer to pack into when the ZSTD stage is used
+    /// @param outBuffer A byte buffer to write the compressed frame to
+    /// @param zstd_stage Whether to compress the packed blocks with ZSTD
+    /// @param params The ZSTD compression level or parameters, used only with `zstd_stage`
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t intpack_compress_buffer(const std::span<const T> &data,
+                                   buffer_t &packBuffer,
+                                   buffer_t &outBuffer,
+                                   bool zstd_stage = false,
+                                   const CompressionParams &params = CompressionParams())
+    {
+        outBuffer.clear();
+        outBuffer.reserve(intpack::header_size + data.size() * sizeof(T));
+        outBuffer.insert(outBuffer.end(), intpack::magic.begin(), intpack::magic.end());
+        outBuffer.push_back(intpack::version);
+        outBuffer.push_back(sizeof(T));
+        outBuffer.push_back(zstd_stage ? intpack::zstd_flag : 0);
+        outBuffer.push_back(0);
+        binary::write_le<uint64_t>(outBuffer, data.size());
+        if (!zstd_stage)
+        {
+            intpack::encode_blocks(data, outBuffer);
+            return 0;
+        }
+        packBuffer.clear();
+        intpack::encode_blocks(data, packBuffer);
+        buffer_t compressed;
+        inner::zstd_compress_into(packBuffer.data(), packBuffer.size(), compressed, params);
+        outBuffer.insert(outBuffer.end(), compressed.begin(), compressed.end());
+        return 0;
+    }
+
+    template <typename T>
+    size_t intpack_compress_buffer(const std::vector<T> &data,
+                                   buffer_t &packBuffer,
+                                   buffer_t &outBuffer,
+                                   bool zstd_stage = false,
+                                   const CompressionParams &params = CompressionParams())
+    {
+        return intpack_compress_buffer(std::span<const T>(data.data(), data.size()), packBuffer, outBuffer, zstd_stage, params);
+    }
+
+    template <typename T>
+    size_t intpack_compress_buffer(const std::vector<T> &data, buffer_t &outBuffer, bool zstd_stage = false, const CompressionParams &params = CompressionParams())
+    {
+        buffer_t packBuffer;
+        return intpack_compress_buffer(data, packBuffer, outBuffer, zstd_stage, params);
+    }
+
+    /// @brief Decompress an array written by `intpack_compress_buffer`
+    /// @tparam T The integral type of the array to decompress
+    /// @param buffer The compressed frame
+    /// @param packBuffer An intermediate byte buffer for the ZSTD stage
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t intpack_decompress_buffer(const buffer_span_t &buffer,
+                                     buffer_t &packBuffer,
+                                     std::vector<T> &dataBuffer,
+                                     const DecompressionParams &params = DecompressionParams())
+    {
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        if (buffer.size() < intpack::header_size || !std::equal(intpack::magic.begin(), intpack::magic.end(), buffer.begin()))
+        {
+            throw std::runtime_error("Not a packed integer buffer");
+        }
+        if (buffer[4] != intpack::version || buffer[5] != sizeof(T))
+        {
+            std::stringstream ss;
+            ss << "Cannot decode packed integer frame version " << (int)buffer[4] << " holding " << (int)buffer[5]
+               << " byte values as " << sizeof(T) << " byte values";
+            throw std::runtime_error(ss.str());
+        }
+        const uint64_t n = binary::read_le<uint64_t>(buffer.data() + 8);
+        auto body = buffer.subspan(intpack::header_size);
+        if (buffer[6] & intpack::zstd_flag)
+        {
+            inner::zstd_decompress_into(body, packBuffer, params);
+            intpack::decode_blocks(packBuffer, n, dataBuffer);
+        }
+        else
+        {
+            intpack::decode_blocks(body, n, dataBuffer);
+        }
+        return 0;
+    }
+
+    template <typename T>
+    size_t intpack_decompress_buffer(const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t packBuffer;
+        return intpack_decompress_buffer(buffer, packBuffer, dataBuffer, params);
+    }
+
+    /// @brief Content-addressed deduplication of whole arrays, e.g. the byte-identical m/z arrays shared by the
+    /// spectra of an imzML continuous mode file or a DIA method. Arrays are hashed with MurmurHash3 (x64, 128 bit)
+    /// and candidates with the same hash are compared byte for byte, so a hash collision never merges two arrays.
+    namespace dedup
+    {
+        /// @brief A 128-bit hash
+        struct Hash128
+        {
+            uint64_t low = 0;
+            uint64_t high = 0;
+
+            bool operator==(const Hash128 &other) const = default;
+        };
+
+        struct Hash128Hasher
+        {
+            size_t operator()(const Hash128 &hash) const
+            {
+                return (size_t)(hash.low ^ (hash.high * 0x9e3779b97f4a7c15ull));
+            }
+        };
+
+        inline uint64_t rotl(uint64_t x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        inline uint64_t fmix(uint64_t k)
+        {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdull;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ull;
+            k ^= k >> 33;
+            return k;
+        }
+
+        /// @brief MurmurHash3_x64_128 of `n` bytes at `data`, reading blocks as little endian words so the hash is
+        /// the same on every platform
+        inline Hash128 murmur3_128(const byte_t *data, size_t n, uint64_t seed = 0)
+        {
+            constexpr uint64_t c1 = 0x87c37b91114253d5ull;
+            constexpr uint64_t c2 = 0x4cf5ad432745937full;
+            uint64_t h1 = seed;
+            uint64_t h2 = seed;
+            const size_t blocks = n / 16;
+            for (size_t i = 0; i < blocks; i++)
+            {
+                uint64_t k1 = binary::read_le<uint64_t>(data + i * 16);
+                uint64_t k2 = binary::read_le<uint64_t>(data + i * 16 + 8);
+                k1 *= c1;
+                k1 = rotl(k1, 31);
+                k1 *= c2;
+                h1 ^= k1;
+                h1 = rotl(h1, 27);
+                h1 += h2;
+                h1 = h1 * 5 + 0x52dce729;
+                k2 *= c2;
+                k2 = rotl(k2, 33);
+                k2 *= c1;
+                h2 ^= k2;
+                h2 = rotl(h2, 31);
+                h2 += h1;
+                h2 = h2 * 5 + 0x38495ab5;
+            }
+
+            const byte_t *tail = data + blocks * 16;
+            uint64_t k1 = 0;
+            uint64_t k2 = 0;
+            switch (n & 15)
+            {
+            case 15:
+                k2 ^= (uint64_t)tail[14] << 48;
+                [[fallthrough]];
+            case 14:
+                k2 ^= (uint64_t)tail[13] << 40;
+                [[fallthrough]];
+            case 13:
+                k2 ^= (uint64_t)tail[12] << 32;
+                [[fallthrough]];
+            case 12:
+                k2 ^= (uint64_t)tail[11] << 24;
+                [[fallthrough]];
+            case 11:
+                k2 ^= (uint64_t)tail[10] << 16;
+                [[fallthrough]];
+            case 10:
+                k2 ^= (uint64_t)tail[9] << 8;
+                [[fallthrough]];
+            case 9:
+                k2 ^= (uint64_t)tail[8];
+                k2 *= c2;
+                k2 = rotl(k2, 33);
+                k2 *= c1;
+                h2 ^= k2;
+                [[fallthrough]];
+            case 8:
+                k1 ^= (uint64_t)tail[7] << 56;
+                [[fallthrough]];
+            case 7:
+                k1 ^= (uint64_t)tail[6] << 48;
+                [[fallthrough]];
+            case 6:
+                k1 ^= (uint64_t)tail[5] << 40;
+                [[fallthrough]];
+            case 5:
+                k1 ^= (uint64_t)tail[4] << 32;
+                [[fallthrough]];
+            case 4:
+                k1 ^= (uint64_t)tail[3] << 24;
+                [[fallthrough]];
+            case 3:
+                k1 ^= (uint64_t)tail[2] << 16;
+                [[fallthrough]];
+            case 2:
+                k1 ^= (uint64_t)tail[1] << 8;
+                [[fallthrough]];
+            case 1:
+                k1 ^= (uint64_t)tail[0];
+                k1 *= c1;
+                k1 = rotl(k1, 31);
+                k1 *= c2;
+                h1 ^= k1;
+            }
+
+            h1 ^= n;
+            h2 ^= n;
+            h1 += h2;
+            h2 += h1;
+            h1 = fmix(h1);
+            h2 = fmix(h2);
+            h1 += h2;
+            h2 += h1;
+            return Hash128{h1, h2};
+        }
+    }
+
+    /// @brief Finds arrays identical to one seen before, for deduplicating batch and container writes.
+    ///
+    /// By default only views of the arrays are kept for the byte-for-byte check on a hash match, so the arrays
+    /// passed in must outlive the deduplicator. With `retain` set, a copy of each distinct array is kept instead,
+    /// for writers that release arrays as soon as they are written.
+    /// @tparam T The data type of the arrays
+    template <typename T>
+    class ArrayDeduplicator
+    {
+    public:
+        /// @brief Hashes the bytes of an array, `dedup::murmur3_128` unless another function is given
+        using hash_t = std::function<dedup::Hash128(const byte_t *data, size_t size)>;
+
+        explicit ArrayDeduplicator(bool retain = false, hash_t hash = nullptr) : retain_(retain), hash_(std::move(hash)) {}
+
+        /// @brief Look `data` up among the arrays seen so far
+        /// @return The index of the first identical array, or the index `data` is now registered under if it is new.
+        /// Indices count the calls to `find_or_insert`, starting at 0.
+        size_t find_or_insert(const std::span<const T> &data)
+        {
+            const size_t index = seen_++;
+            const auto bytes = std::as_bytes(data);
+            const auto hash = hash_ ? hash_((const byte_t *)bytes.data(), bytes.size()) : dedup::murmur3_128((const byte_t *)bytes.data(), bytes.size());
+            auto &candidates = by_hash_[hash];
+            for (auto candidate : candidates)
+            {
+                const auto &known = arrays_[candidate];
+                // Empty spans may have null data, which memcmp must not be given
+                if (known.size() == data.size() && (data.empty() || std::memcmp(known.data(), data.data(), data.size_bytes()) == 0))
+                {
+                    duplicates_++;
+                    return candidate;
+                }
+                collisions_++;
+            }
+            candidates.push_back(index);
+            if (retain_)
+            {
+                owned_.emplace_back(data.begin(), data.end());
+                arrays_.emplace(index, std::span<const T>(owned_.back().data(), owned_.back().size()));
+            }
+            else
+            {
+                arrays_.emplace(index, data);
+            }
+            return index;
+        }
+
+        /// @brief The number of arrays looked up so far
+        size_t seen() const
+        {
+            return seen_;
+        }
+
+        /// @brief The number of arrays that repeated an earlier one
+        size_t duplicates() const
+        {
+            return duplicates_;
+        }
+
+        /// @brief The number of hash matches that turned out to be different arrays
+        size_t collisions() const
+        {
+            return collisions_;
+        }
+
+    private:
+        bool retain_;
+        hash_t hash_;
+        size_t seen_ = 0;
+        size_t duplicates_ = 0;
+        size_t collisions_ = 0;
+        std::unordered_map<dedup::Hash128, std::vector<size_t>, dedup::Hash128Hasher> by_hash_;
+        std::unordered_map<size_t, std::span<const T>> arrays_;
+        std::deque<std::vector<T>> owned_;
+    };
+
+    /// @brief Implementation of batch compression, storing many small arrays of one type in a single ZSTD frame so
+    /// redundancy between them is shared and only one frame header is paid for the whole batch.
+    ///
+    /// Each member is byte shuffled on its own and the members are concatenated, so member `i` occupies one
+    /// contiguous byte range of the decompressed stream. A single member is extracted by streaming the frame only up
+    /// to the end of that range, without decompressing the members after it.
+    ///
+    /// A member identical to an earlier one is not stored again. The table refers to the earlier member instead, and
+    /// decoding shares or copies its values.
+    ///
+    /// Frame layout, all integers little endian:
+    ///  - 4 byte magic "MZBT", 1 byte version, 1 byte value size, 1 byte flags (bit 0: deduplicated), 1 reserved byte
+    ///  - u64 number of members, u64 number of stored values, u64 offsets table size
+    ///  - the offsets table, the varint length of each member (the differences between consecutive offsets). In a
+    ///    deduplicated frame each member starts with a varint distance back to the member it repeats, 0 for a stored
+    ///    member, and only stored members are followed by their length.
+    ///  - a ZSTD frame holding the shuffled stored members one after another
+    namespace batch
+    {
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'B', 'T'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + 3 * sizeof(uint64_t);
+
+        inline constexpr byte_t deduplicated_flag = 1;
+
+        /// @brief The parsed header and offsets table of a batch frame
+        struct Layout
+        {
+            /// @brief The offset of each member into the decoded batch, with the total number of values last
+            std::vector<uint64_t> offsets;
+            /// @brief The member each member's values are stored with, itself unless it repeats an earlier member
+            std::vector<uint64_t> sources;
+            /// @brief The offset of each member's values into the stored values
+            std::vector<uint64_t> stored;
+            /// @brief The number of stored values
+            uint64_t stored_total = 0;
+            /// @brief The ZSTD frame holding the shuffled members
+            buffer_span_t frame;
+
+            size_t members() const
+            {
+                return offsets.size() - 1;
+            }
+
+            size_t length(size_t member) const
+            {
+                return offsets[member + 1] - offsets[member];
+            }
+        };
+
+        template <typename T>
+        Layout read_layout(const buffer_span_t &buffer)
+        {
+            if (buffer.size() < header_size || !std::equal(magic.begin(), magic.end(), buffer.begin()))
+            {
+                throw std::runtime_error("Not a batch-compressed buffer");
+            }
+            if (buffer[4] != version || buffer[5] != sizeof(T) || (buffer[6] & ~deduplicated_flag) != 0)
+            {
+                std::stringstream ss;
+                ss << "Cannot decode batch frame version " << (int)buffer[4] << " holding " << (int)buffer[5]
+                   << " byte values as " << sizeof(T) << " byte values";
+                throw std::runtime_error(ss.str());
+            }
+            const bool deduplicated = buffer[6] & deduplicated_flag;
+            const uint64_t members = binary::read_le<uint64_t>(buffer.data() + 8);
+            const uint64_t total = binary::read_le<uint64_t>(buffer.data() + 16);
+            const uint64_t table_size = binary::read_le<uint64_t>(buffer.data() + 24);
+            if (table_size > buffer.size() - header_size || members > table_size)
+            {
+                throw std::runtime_error("Malformed batch frame, offsets table overflows the buffer");
+            }
+            Layout layout;
+            auto table = buffer.subspan(header_size, table_size);
+            layout.offsets.reserve(members + 1);
+            layout.sources.reserve(members);
+            layout.stored.reserve(members);
+            layout.offsets.push_back(0);
+            size_t offset = 0;
+            for (uint64_t i = 0; i < members; i++)
+            {
+                const uint64_t back = deduplicated ? binary::read_varint(table, offset) : 0;
+                uint64_t length;
+                if (back == 0)
+                {
+                    length = binary::read_varint(table, offset);
+                    if (length > total - layout.stored_total)
+                    {
+                        throw std::runtime_error("Malformed batch frame, member lengths exceed the total");
+                    }
+                    layout.sources.push_back(i);
+                    layout.stored.push_back(layout.stored_total);
+                    layout.stored_total += length;
+                }
+                else
+                {
+                    if (back > i || layout.sources[i - back] != i - back)
+                    {
+                        throw std::runtime_error("Malformed batch frame, member repeats one that is not stored");
+                    }
+                    const auto source = i - back;
+                    length = layout.length(source);
+                    layout.sources.push_back(source);
+                    layout.stored.push_back(layout.stored[source]);
+                }
+                layout.offsets.push_back(layout.offsets.back() + length);
+            }
+            if (offset != table.size() || layout.stored_total != total)
+            {
+                throw std::runtime_error("Malformed batch frame, member lengths do not match the total");
+            }
+            layout.frame = buffer.subspan(header_size + table_size);
+            return layout;
+        }
+
+        /// @brief Reassemble `n` values of `T` from their shuffled bytes in `bytes` into `out`
+        template <typename T>
+        void unshuffle(const byte_t *bytes, size_t n, T *out)
+        {
+            std::array<byte_t, sizeof(T)> value;
+            for (size_t j = 0; j < n; j++)
+            {
+                for (size_t i = 0; i < sizeof(T); i++)
+                {
+                    value[i] = bytes[i * n + j];
+                }
+                out[j] = binary::read_le<T>(value.data());
+            }
+        }
+
+        template <typename T>
+        void encode(const std::vector<std::span<const T>> &arrays, buffer_t &transposeBuffer, buffer_t &outBuffer, const CompressionParams &params, bool deduplicate)
+        {
+            // The member each member repeats, itself if it is stored
+            std::vector<size_t> sources(arrays.size());
+            bool any_repeat = false;
+            if (deduplicate)
+            {
+                ArrayDeduplicator<T> deduplicator;
+                for (size_t i = 0; i < arrays.size(); i++)
+                {
+                    sources[i] = deduplicator.find_or_insert(arrays[i]);
+                }
+                any_repeat = deduplicator.duplicates() != 0;
+            }
+            else
+            {
+                std::iota(sources.begin(), sources.end(), 0);
+            }
+
+            buffer_t table;
+            size_t total = 0;
+            for (size_t i = 0; i < arrays.size(); i++)
+            {
+                if (any_repeat)
+                {
+                    binary::write_varint(table, i - sources[i]);
+                }
+                if (sources[i] == i)
+                {
+                    binary::write_varint(table, arrays[i].size());
+                    total += arrays[i].size();
+                }
+            }
+            buffer_t payload;
+            payload.reserve(total * sizeof(T));
+            for (size_t i = 0; i < arrays.size(); i++)
+            {
+                if (sources[i] == i)
+                {
+                    inner::transpose<T>(arrays[i], transposeBuffer);
+                    payload.insert(payload.end(), transposeBuffer.begin(), transposeBuffer.end());
+                }
+            }
+            buffer_t compressed;
+            inner::zstd_compress_into(payload.data(), payload.size(), compressed, params);
+
+            outBuffer.clear();
+            outBuffer.reserve(header_size + table.size() + compressed.size());
+            outBuffer.insert(outBuffer.end(), magic.begin(), magic.end());
+            outBuffer.push_back(version);
+            outBuffer.push_back(sizeof(T));
+            outBuffer.push_back(any_repeat ? deduplicated_flag : 0);
+            outBuffer.push_back(0);
+            binary::write_le<uint64_t>(outBuffer, arrays.size());
+            binary::write_le<uint64_t>(outBuffer, total);
+            binary::write_le<uint64_t>(outBuffer, table.size());
+            outBuffer.insert(outBuffer.end(), table.begin(), table.end());
+            outBuffer.insert(outBuffer.end(), compressed.begin(), compressed.end());
+        }
+
+        /// @brief Stream the ZSTD frame in `frame` only as far as byte `end`, copying bytes `[begin, end)` into `out`
+        inline void decompress_range(ZSTD_DCtx *dctx, const buffer_span_t &frame, size_t begin, size_t end, buffer_t &out, const DecompressionParams &params)
+        {
+            out.resize(end - begin);
+            if (begin == end)
+            {
+                return;
+            }
+            ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+            params.check_frame(frame.data(), frame.size());
+            params.apply(dctx);
+            std::array<byte_t, 1 << 15> block;
+            ZSTD_inBuffer in = {frame.data(), frame.size(), 0};
+            size_t position = 0;
+            while (position < end)
+            {
+                // Once the member starts, decompress straight into `out`
+                ZSTD_outBuffer dst = position < begin
+                                         ? ZSTD_outBuffer{block.data(), std::min(block.size(), begin - position), 0}
+                                         : ZSTD_outBuffer{out.data() + (position - begin), end - position, 0};
+                auto consumed = in.pos;
+                auto remaining = inner::check_zstd_error(ZSTD_decompressStream(dctx, &dst, &in));
+                position += dst.pos;
+                if (dst.pos == 0 && (remaining == 0 || (in.pos == consumed && in.pos == in.size)))
+                {
+                    throw std::runtime_error("Malformed batch frame, data ends before the requested member");
+                }
+            }
+        }
+    }
+
+    /// @brief Compress many arrays of one type, e.g. the m/z arrays of a block of spectra, into a single frame with
+    /// an offsets table. Data will be stored in little endian byte order.
+    /// @tparam T The data type of the arrays to compress
+    /// @param arrays The arrays to compress, in order
+    /// @param transposeBuffer An intermediate byte buffer to shuffle bytes into
+    /// @param outBuffer A byte buffer to write the compressed frame to
+    /// @param params The ZSTD compression level or parameters
+    /// @param deduplicate Whether to store arrays identical to an earlier one as a reference to it
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t batch_compress_buffer(const std::vector<std::span<const T>> &arrays,
+                                 buffer_t &transposeBuffer,
+                                 buffer_t &outBuffer,
+                                 const CompressionParams &params = CompressionParams(),
+                                 bool deduplicate = true)
+    {
+        batch::encode(arrays, transposeBuffer, outBuffer, params, deduplicate);
+        return 0;
+    }
+
+    template <typename T>
+    size_t batch_compress_buffer(const std::vector<std::vector<T>> &arrays,
+                                 buffer_t &transposeBuffer,
+                                 buffer_t &outBuffer,
+                                 const CompressionParams &params = CompressionParams(),
+                                 bool deduplicate = true)
+    {
+        std::vector<std::span<const T>> views(arrays.begin(), arrays.end());
+        return batch_compress_buffer(views, transposeBuffer, outBuffer, params, deduplicate);
+    }
+
+    template <typename T>
+    size_t batch_compress_buffer(const std::vector<std::vector<T>> &arrays,
+                                 buffer_t &outBuffer,
+                                 const CompressionParams &params = CompressionParams(),
+                                 bool deduplicate = true)
+    {
+        buffer_t transposeBuffer;
+        return batch_compress_buffer(arrays, transposeBuffer, outBuffer, params, deduplicate);
+    }
+
+    /// @brief The number of member arrays in a frame written by `batch_compress_buffer`
+    template <typename T>
+    size_t batch_member_count(const buffer_span_t &buffer)
+    {
+        return batch::read_layout<T>(buffer).members();
+    }
+
+    /// @brief Decompress every member of a frame written by `batch_compress_buffer` into one contiguous array, in
+    /// compressed sparse row form
+    /// @tparam T The data type of the arrays to decompress
+    /// @param buffer The compressed frame
+    /// @param transposeBuffer An intermediate byte buffer
+    /// @param values The concatenated values of all members
+    /// @param offsets Where each member starts in `values`, with `values.size()` appended, so member `i` is
+    /// `values[offsets[i]]` up to `values[offsets[i + 1]]`
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t batch_decompress_buffer(const buffer_span_t &buffer,
+                                   buffer_t &transposeBuffer,
+                                   std::vector<T> &values,
+                                   std::vector<uint64_t> &offsets,
+                                   const DecompressionParams &params = DecompressionParams())
+    {
+        auto layout = batch::read_layout<T>(buffer);
+        if (layout.stored_total == 0)
+        {
+            transposeBuffer.clear();
+        }
+        else
+        {
+            inner::zstd_decompress_into(layout.frame, transposeBuffer, params);
+        }
+        if (transposeBuffer.size() != layout.stored_total * sizeof(T))
+        {
+            throw std::runtime_error("Malformed batch frame, payload size does not match header");
+        }
+        values.resize(layout.offsets.back());
+        for (size_t i = 0; i < layout.members(); i++)
+        {
+            auto begin = layout.offsets[i];
+            auto source = layout.sources[i];
+            if (source == i)
+            {
+                batch::unshuffle<T>(transposeBuffer.data() + layout.stored[i] * sizeof(T), layout.length(i), values.data() + begin);
+            }
+            else
+            {
+                // Repeats are copied from their first occurrence rather than unshuffled again
+                std::copy_n(values.begin() + layout.offsets[source], layout.length(i), values.begin() + begin);
+            }
+        }
+        offsets = std::move(layout.offsets);
+        return 0;
+    }
+
+    template <typename T>
+    size_t batch_decompress_buffer(const buffer_span_t &buffer,
+                                   std::vector<T> &values,
+                                   std::vector<uint64_t> &offsets,
+                                   const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return batch_decompress_buffer(buffer, transposeBuffer, values, offsets, params);
+    }
+
+    /// @brief Decompress one member of a frame written by `batch_compress_buffer`. The frame is streamed only up to
+    /// the end of that member, and only the member itself is buffered and un-shuffled.
+    /// @tparam T The data type of the arrays to decompress
+    /// @param buffer The compressed frame
+    /// @param index The position of the member in the batch
+    /// @param transposeBuffer An intermediate byte buffer
+    /// @param dataBuffer The data array to decompress the member into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t batch_decompress_member(const buffer_span_t &buffer,
+                                   size_t index,
+                                   buffer_t &transposeBuffer,
+                                   std::vector<T> &dataBuffer,
+                                   const DecompressionParams &params = DecompressionParams())
+    {
+        auto layout = batch::read_layout<T>(buffer);
+        if (index >= layout.members())
+        {
+            std::stringstream ss;
+            ss << "Batch member " << index << " requested from a batch of " << layout.members();
+            throw std::runtime_error(ss.str());
+        }
+        std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        if (!dctx)
+        {
+            throw std::runtime_error("Failed to allocate ZSTD decompression context");
+        }
+        // A repeated member is read from its first occurrence, which is earlier in the frame
+        const size_t begin = layout.stored[index];
+        const size_t length = layout.length(index);
+        batch::decompress_range(dctx.get(), layout.frame, begin * sizeof(T), (begin + length) * sizeof(T), transposeBuffer, params);
+        dataBuffer.resize(length);
+        batch::unshuffle<T>(transposeBuffer.data(), length, dataBuffer.data());
+        return 0;
+    }
+
+    template <typename T>
+    size_t batch_decompress_member(const buffer_span_t &buffer, size_t index, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return batch_decompress_member(buffer, index, transposeBuffer, dataBuffer, params);
+    }
+
+    /// @brief Decompress every member of a frame written by `batch_compress_buffer` into its own shared, read-only
+    /// array. Members that repeat an earlier member share its decoded array instead of holding a copy.
+    /// @tparam T The data type of the arrays to decompress
+    /// @param buffer The compressed frame
+    /// @param transposeBuffer An intermediate byte buffer
+    /// @param members The decoded members, in order
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t batch_decompress_shared(const buffer_span_t &buffer,
+                                   buffer_t &transposeBuffer,
+                                   std::vector<std::shared_ptr<const std::vector<T>>> &members,
+                                   const DecompressionParams &params = DecompressionParams())
+    {
+        auto layout = batch::read_layout<T>(buffer);
+        if (layout.stored_total == 0)
+        {
+            transposeBuffer.clear();
+        }
+        else
+        {
+            inner::zstd_decompress_into(layout.frame, transposeBuffer, params);
+        }
+        if (transposeBuffer.size() != layout.stored_total * sizeof(T))
+        {
+            throw std::runtime_error("Malformed batch frame, payload size does not match header");
+        }
+        members.clear();
+        members.reserve(layout.members());
+        for (size_t i = 0; i < layout.members(); i++)
+        {
+            if (layout.sources[i] != i)
+            {
+                members.push_back(members[layout.sources[i]]);
+                continue;
+            }
+            auto decoded = std::make_shared<std::vector<T>>(layout.length(i));
+            batch::unshuffle<T>(transposeBuffer.data() + layout.stored[i] * sizeof(T), layout.length(i), decoded->data());
+            members.push_back(std::move(decoded));
+        }
+        return 0;
+    }
+
+    template <typename T>
+    size_t batch_decompress_shared(const buffer_span_t &buffer,
+                                   std::vector<std::shared_ptr<const std::vector<T>>> &members,
+                                   const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return batch_decompress_shared(buffer, transposeBuffer, members, params);
+    }
+
+    /// @brief Implementation of an XOR-with-previous codec for floating point time series, in the style of Chimp.
+    ///
+    /// Each value is XORed with the one before it, and the XOR is stored with a 2 bit flag:
+    ///  - 00: the value repeats
+    ///  - 01: the XOR has many trailing zeros, stored as a 3 bit leading zero class, the number of bits between the
+    ///    leading and trailing zeros, and those bits
+    ///  - 10: the XOR has the same leading zero class as the previous one, stored as the bits after it
+    ///  - 11: a new leading zero class, stored as a 3 bit class and the bits after it
+    ///
+    /// No entropy coder is involved, so values can be appended one at a time, e.g. to a chromatogram while the
+    /// acquisition is running, and the stream is readable after every append.
+    ///
+    /// Frame layout: 4 byte magic "MZXR", 1 byte version, 1 byte value size, 2 reserved bytes, the u64 number of
+    /// values, little endian, then the bit stream. Bits are packed least significant first, so the stream reads the
+    /// same as a sequence of little endian words. The first value is stored whole.
+    namespace xorstream
+    {
+        using binary::uint_of;
+
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'X', 'R'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + sizeof(uint64_t);
+        /// @brief The leading zero counts a XOR's leading zeros are rounded down to
+        inline constexpr std::array<uint8_t, 8> leading_classes = {0, 8, 12, 16, 18, 20, 22, 24};
+        /// @brief XORs with more trailing zeros than this store only their center bits
+        inline constexpr int trailing_threshold = 6;
+
+        enum Flag : uint8_t
+        {
+            Repeat = 0,
+            Center = 1,
+            SameLeading = 2,
+            NewLeading = 3,
+        };
+
+        /// @brief The class code of the largest leading zero class not above `leading`
+        inline uint8_t leading_class_of(int leading)
+        {
+            size_t code = 0;
+            while (code + 1 < leading_classes.size() && leading_classes[code + 1] <= leading)
+            {
+                code++;
+            }
+            return (uint8_t)code;
+        }
+
+        /// @brief The number of bits used to store a center bit count for values of `width` bits
+        constexpr unsigned center_width(unsigned width)
+        {
+            return width == 64 ? 6 : 5;
+        }
+
+        inline uint64_t low_bits(unsigned n)
+        {
+            return n >= 64 ? ~0ull : (1ull << n) - 1;
+        }
+
+        /// @brief Appends bits, least significant first, to a byte buffer whose last byte may be partially filled
+        struct BitWriter
+        {
+            buffer_t &buffer;
+            uint64_t &bits;
+
+            void write(uint64_t value, unsigned n)
+            {
+                value &= low_bits(n);
+                unsigned used = bits % 8;
+                if (used != 0 && n != 0)
+                {
+                    unsigned take = std::min(n, 8 - used);
+                    buffer.back() |= (byte_t)(value << used);
+                    value >>= take;
+                    n -= take;
+                    bits += take;
+                }
+                while (n >= 8)
+                {
+                    buffer.push_back((byte_t)value);
+                    value >>= 8;
+                    n -= 8;
+                    bits += 8;
+                }
+                if (n != 0)
+                {
+                    buffer.push_back((byte_t)value);
+                    bits += n;
+                }
+            }
+        };
+
+        /// @brief Reads bits, least significant first, with one unaligned 64-bit load per read
+        struct BitReader
+        {
+            buffer_span_t data;
+            size_t bit = 0;
+
+            /// @brief Read up to 56 bits
+            uint64_t read(unsigned n)
+            {
+                if (bit + n > data.size() * 8)
+                {
+                    throw std::runtime_error("Truncated XOR stream");
+                }
+                const size_t offset = bit / 8;
+                uint64_t word;
+                if (offset + 8 <= data.size())
+                {
+                    word = binary::read_le<uint64_t>(data.data() + offset);
+                }
+                else
+                {
+                    std::array<byte_t, 8> tail = {};
+                    std::memcpy(tail.data(), data.data() + offset, data.size() - offset);
+                    word = binary::read_le<uint64_t>(tail.data());
+                }
+                auto value = (word >> (bit % 8)) & low_bits(n);
+                bit += n;
+                return value;
+            }
+
+            /// @brief Read up to 64 bits
+            uint64_t read_wide(unsigned n)
+            {
+                if (n <= 56)
+                {
+                    return read(n);
+                }
+                auto low = read(32);
+                return low | (read(n - 32) << 32);
+            }
+        };
+
+        /// @brief The state carried from one value to the next, shared by the encoder and decoder
+        template <typename U>
+        struct State
+        {
+            U previous = 0;
+            /// @brief The leading zero class of the last XOR, or an impossible value when the next XOR may not reuse it
+            int leading = -1;
+        };
+
+        template <typename U>
+        void encode_value(U bits, State<U> &state, BitWriter &writer, bool first)
+        {
+            constexpr unsigned width = sizeof(U) * 8;
+            if (first)
+            {
+                writer.write(bits, width);
+                state.previous = bits;
+                return;
+            }
+            const U x = bits ^ state.previous;
+            state.previous = bits;
+            if (x == 0)
+            {
+                writer.write(Repeat, 2);
+                return;
+            }
+            const auto code = leading_class_of(std::countl_zero(x));
+            const int leading = leading_classes[code];
+            const int trailing = std::countr_zero(x);
+            if (trailing > trailing_threshold)
+            {
+                const unsigned center = width - leading - trailing;
+                writer.write(Center, 2);
+                writer.write(code, 3);
+                writer.write(center == width ? 0 : center, center_width(width));
+                writer.write(x >> trailing, center);
+                state.leading = -1;
+            }
+            else if (leading == state.leading)
+            {
+                writer.write(SameLeading, 2);
+                writer.write(x, width - leading);
+            }
+            else
+            {
+                writer.write(NewLeading, 2);
+                writer.write(code, 3);
+                writer.write(x, width - leading);
+                state.leading = leading;
+            }
+        }
+
+        template <typename U>
+        U decode_value(State<U> &state, BitReader &reader, bool first)
+        {
+            constexpr unsigned width = sizeof(U) * 8;
+            if (first)
+            {
+                state.previous = (U)reader.read_wide(width);
+                return state.previous;
+            }
+            U x = 0;
+            switch (reader.read(2))
+            {
+            case Repeat:
+                return state.previous;
+            case Center:
+            {
+                const int leading = leading_classes[reader.read(3)];
+                unsigned center = (unsigned)reader.read(center_width(width));
+                center = center == 0 ? width : center;
+                if (leading + center > width)
+                {
+                    throw std::runtime_error("Malformed XOR stream, center bits overflow the value");
+                }
+                const unsigned trailing = width - leading - center;
+                x = (U)(reader.read_wide(center) << trailing);
+                state.leading = -1;
+                break;
+            }
+            case SameLeading:
+                if (state.leading < 0)
+                {
+                    throw std::runtime_error("Malformed XOR stream, no leading zero class to reuse");
+                }
+                x = (U)reader.read_wide(width - state.leading);
+                break;
+            default:
+                state.leading = leading_classes[reader.read(3)];
+                x = (U)reader.read_wide(width - state.leading);
+                break;
+            }
+            state.previous ^= x;
+            return state.previous;
+        }
+
+        /// @brief Check the header of an XOR stream holding `T` and return its number of values
+        template <typename T>
+        uint64_t read_header(const buffer_span_t &buffer)
+        {
+            if (buffer.size() < header_size || !std::equal(magic.begin(), magic.end(), buffer.begin()))
+            {
+                throw std::runtime_error("Not an XOR stream buffer");
+            }
+            if (buffer[4] != version || buffer[5] != sizeof(T))
+            {
+                std::stringstream ss;
+                ss << "Cannot decode XOR stream version " << (int)buffer[4] << " holding " << (int)buffer[5]
+                   << " byte values as " << sizeof(T) << " byte values";
+                throw std::runtime_error(ss.str());
+            }
+            return binary::read_le<uint64_t>(buffer.data() + 8);
+        }
+    }
+
+    /// @brief Encodes floating point values one at a time into an XOR stream. The encoded bytes in `buffer()` form
+    /// a complete, decodable frame after every append; only its last byte and the value count in its header change
+    /// when more values are appended.
+    /// @tparam T `float` or `double`
+    template <typename T>
+    class XorStreamEncoder
+    {
+        static_assert(std::is_floating_point_v<T> && (sizeof(T) == 4 || sizeof(T) == 8), "XOR streams hold float or double values");
+        using U = binary::uint_of<sizeof(T)>;
+
+    public:
+        XorStreamEncoder()
+        {
+            reset();
+        }
+
+        /// @brief Continue appending to a stream written earlier, e.g. one re-opened from disk
+        static XorStreamEncoder resume(const buffer_span_t &buffer)
+        {
+            XorStreamEncoder encoder;
+            const auto count = xorstream::read_header<T>(buffer);
+            xorstream::BitReader reader{buffer.subspan(xorstream::header_size)};
+            for (uint64_t i = 0; i < count; i++)
+            {
+                xorstream::decode_value(encoder.state_, reader, i == 0);
+            }
+            encoder.buffer_.assign(buffer.begin(), buffer.begin() + xorstream::header_size + (reader.bit + 7) / 8);
+            encoder.bits_ = reader.bit;
+            encoder.count_ = count;
+            return encoder;
+        }
+
+        /// @brief Append one value to the stream
+        void append(T value)
+        {
+            xorstream::BitWriter writer{buffer_, bits_};
+            xorstream::encode_value(std::bit_cast<U>(value), state_, writer, count_ == 0);
+            count_++;
+            auto count = binary::byte_view<uint64_t>::as_little_endian(count_);
+            std::copy(count.begin(), count.end(), buffer_.begin() + 8);
+        }
+
+        /// @brief Append every value of `values` to the stream
+        void append(const std::span<const T> &values)
+        {
+            buffer_.reserve(buffer_.size() + values.size() * sizeof(T) / 2);
+            for (auto value : values)
+            {
+                append(value);
+            }
+        }
+
+        /// @brief The number of values appended so far
+        uint64_t size() const
+        {
+            return count_;
+        }
+
+        /// @brief The encoded frame holding every value appended so far
+        const buffer_t &buffer() const
+        {
+            return buffer_;
+        }
+
+        /// @brief Discard every value and start a new stream
+        void reset()
+        {
+            buffer_.clear();
+            buffer_.insert(buffer_.end(), xorstream::magic.begin(), xorstream::magic.end());
+            buffer_.push_back(xorstream::version);
+            buffer_.push_back(sizeof(T));
+            buffer_.push_back(0);
+            buffer_.push_back(0);
+            binary::write_le<uint64_t>(buffer_, 0);
+            bits_ = 0;
+            count_ = 0;
+            state_ = xorstream::State<U>();
+        }
+
+    private:
+        buffer_t buffer_;
+        uint64_t bits_ = 0;
+        uint64_t count_ = 0;
+        xorstream::State<U> state_;
+    };
+
+    /// @brief Compress a floating point array with the XOR-with-previous codec, for arrays written incrementally like
+    /// chromatograms. Data will be stored in little endian byte order.
+    /// @tparam T `float` or `double`
+    /// @param data The data array to compress
+    /// @param outBuffer A byte buffer to write the XOR stream to
+    /// @return 0 if successful
+    template <typename T>
+    size_t xor_compress_buffer(const std::span<const T> &data, buffer_t &outBuffer)
+    {
+        XorStreamEncoder<T> encoder;
+        encoder.append(data);
+        outBuffer = encoder.buffer();
+        return 0;
+    }
+
+    template <typename T>
+    size_t xor_compress_buffer(const std::vector<T> &data, buffer_t &outBuffer)
+    {
+        return xor_compress_buffer(std::span<const T>(data.data(), data.size()), outBuffer);
+    }
+
+    /// @brief Decompress an array written by `xor_compress_buffer` or `XorStreamEncoder`
+    /// @tparam T `float` or `double`
+    /// @param buffer The XOR stream
+    /// @param dataBuffer The data array to decompress into
+    /// @return 0 if successful
+    template <typename T>
+    size_t xor_decompress_buffer(const buffer_span_t &buffer, std::vector<T> &dataBuffer)
+    {
+        static_assert(std::is_floating_point_v<T> && (sizeof(T) == 4 || sizeof(T) == 8), "XOR streams hold float or double values");
+        using U = binary::uint_of<sizeof(T)>;
+        if (buffer.empty())
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        const auto count = xorstream::read_header<T>(buffer);
+        auto stream = buffer.subspan(xorstream::header_size);
+        // Every value but the first takes at least 2 bits
+        if (count > stream.size() * 4 + 1)
+        {
+            throw std::runtime_error("Malformed XOR stream, more values than the stream can hold");
+        }
+        dataBuffer.resize(count);
+        xorstream::BitReader reader{stream};
+        xorstream::State<U> state;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            dataBuffer[i] = std::bit_cast<T>(xorstream::decode_value(state, reader, i == 0));
+        }
+        return 0;
+    }
+
+    /// @brief Implementation of the float field split codec, which stores the sign, exponent and mantissa of IEEE-754
+    /// values as separate streams. Byte shuffling cuts a double's 11 bit exponent across bytes 6 and 7, mixing the
+    /// slowly changing exponent with the top mantissa bits. Here the exponent gets a stream of its own.
+    ///
+    /// Streams:
+    ///  - signs, one bit per value, least significant bit first
+    ///  - exponents, as 1 (float) or 2 (double) byte planes. Either the zigzag encoded difference from the previous
+    ///    exponent, which suits sorted arrays like m/z, or the exponent itself, which suits unordered arrays like
+    ///    intensities, whichever has the lower byte entropy on a sample.
+    ///  - mantissas, byte shuffled into 3 (float) or 7 (double) planes, the top plane holding the highest bits
+    ///
+    /// Frame layout: 4 byte magic "MZFS", 1 byte version, 1 byte value size, 1 byte flags (bit 0: delta coded
+    /// exponents), 1 reserved byte, then the u64 number of values, u64 size of the sign frame and u64 size of the
+    /// exponent frame, little endian. The sign, exponent and mantissa streams follow as one ZSTD frame each, omitted
+    /// for an empty array.
+    namespace fields
+    {
+        inline constexpr std::array<byte_t, 4> magic = {'M', 'Z', 'F', 'S'};
+        inline constexpr byte_t version = 1;
+        inline constexpr size_t header_size = 8 + 3 * sizeof(uint64_t);
+        inline constexpr byte_t delta_flag = 1;
+        /// @brief The number of consecutive pairs of values the exponent coding is chosen on
+        inline constexpr size_t sample_pairs = 1 << 14;
+
+        /// @brief The field widths of `T`
+        template <typename T>
+        struct Fields
+        {
+            static_assert(std::numeric_limits<T>::is_iec559 && (sizeof(T) == 4 || sizeof(T) == 8), "Field splitting needs IEEE-754 float or double values");
+            using U = binary::uint_of<sizeof(T)>;
+            /// @brief The unsigned type an exponent code is stored as
+            using E = std::conditional_t<sizeof(T) == 8, uint16_t, uint8_t>;
+
+            static constexpr unsigned width = sizeof(T) * 8;
+            static constexpr unsigned mantissa_bits = std::numeric_limits<T>::digits - 1;
+            static constexpr unsigned exponent_bits = width - 1 - mantissa_bits;
+            static constexpr size_t mantissa_bytes = (mantissa_bits + 7) / 8;
+            static constexpr U exponent_mask = (U(1) << exponent_bits) - 1;
+            static constexpr U mantissa_mask = (U(1) << mantissa_bits) - 1;
+
+            static E exponent(U bits)
+            {
+                return (E)((bits >> mantissa_bits) & exponent_mask);
+            }
+        };
+
+        template <typename E>
+        inline E zigzag(E value)
+        {
+            return (E)((E)(value << 1) ^ (E)(0 - (value >> (sizeof(E) * 8 - 1))));
+        }
+
+        template <typename E>
+        inline E unzigzag(E value)
+        {
+            return (E)((E)(value >> 1) ^ (E)(0 - (value & 1)));
+        }
+
+        /// @brief The number of bytes of exponent and mantissa planes for `n` values
+        template <typename T>
+        constexpr size_t plane_bytes(size_t n)
+        {
+            return n * (sizeof(typename Fields<T>::E) + Fields<T>::mantissa_bytes);
+        }
+
+        /// @brief Whether delta coding the exponents of `values` gives a lower order-0 entropy than storing them as
+        /// they are, judged on evenly spaced pairs of consecutive values
+        template <typename T>
+        bool prefer_delta(const T *values, size_t n)
+        {
+            using F = Fields<T>;
+            using U = typename F::U;
+            if (n < 2)
+            {
+                return false;
+            }
+            // The zigzag code of a difference between two exponents takes one more bit than an exponent
+            std::vector<uint32_t> raw((size_t)F::exponent_mask + 1);
+            std::vector<uint32_t> delta(((size_t)F::exponent_mask + 1) * 2);
+            const size_t pairs = std::min(n - 1, sample_pairs);
+            for (size_t k = 0; k < pairs; k++)
+            {
+                const size_t i = 1 + k * (n - 1) / pairs;
+                const auto current = F::exponent(std::bit_cast<U>(values[i]));
+                const auto previous = F::exponent(std::bit_cast<U>(values[i - 1]));
+                raw[current]++;
+                delta[zigzag((typename F::E)(current - previous))]++;
+            }
+            auto entropy = [pairs](const std::vector<uint32_t> &counts)
+            {
+                double bits = 0;
+                for (auto count : counts)
+                {
+                    if (count != 0)
+                    {
+                        bits -= count * std::log2((double)count / pairs);
+                    }
+                }
+                return bits;
+            };
+            return entropy(delta) < entropy(raw);
+        }
+
+        /// @brief Split values `begin` to `n` into the exponent and mantissa planes of `planes`, exponents first,
+        /// and pack their sign bits into `signs`. `begin` must be a multiple of 8.
+        template <typename T>
+        void split_scalar(const T *values, size_t begin, size_t n, bool delta, byte_t *signs, byte_t *planes)
+        {
+            using F = Fields<T>;
+            using U = typename F::U;
+            using E = typename F::E;
+            byte_t *mantissas = planes + sizeof(E) * n;
+            E previous = (delta && begin > 0) ? F::exponent(std::bit_cast<U>(values[begin - 1])) : 0;
+            for (size_t i = begin; i < n; i++)
+            {
+                const U bits = std::bit_cast<U>(values[i]);
+                const E exponent = F::exponent(bits);
+                const E code = delta ? zigzag((E)(exponent - previous)) : exponent;
+                previous = delta ? exponent : 0;
+                for (size_t b = 0; b < sizeof(E); b++)
+                {
+                    planes[b * n + i] = (byte_t)(code >> (8 * b));
+                }
+                const U mantissa = bits & F::mantissa_mask;
+                for (size_t b = 0; b < F::mantissa_bytes; b++)
+                {
+                    mantissas[b * n + i] = (byte_t)(mantissa >> (8 * b));
+                }
+            }
+            for (size_t i = begin; i < n; i += 8)
+            {
+                byte_t packed = 0;
+                for (size_t k = 0; k < 8 && i + k < n; k++)
+                {
+                    packed |= (byte_t)((std::bit_cast<U>(values[i + k]) >> (F::width - 1)) << k);
+                }
+                signs[i / 8] = packed;
+            }
+        }
+
+        /// @brief Reassemble values `begin` to `n` from the sign bits and planes written by `split_scalar`, reading
+        /// the running exponent from the value before `begin`
+        template <typename T>
+        void merge_scalar(const byte_t *signs, const byte_t *planes, size_t begin, size_t n, bool delta, T *values)
+        {
+            using F = Fields<T>;
+            using U = typename F::U;
+            using E = typename F::E;
+            const byte_t *mantissas = planes + sizeof(E) * n;
+            E exponent = (delta && begin > 0) ? F::exponent(std::bit_cast<U>(values[begin - 1])) : 0;
+            for (size_t i = begin; i < n; i++)
+            {
+                E code = 0;
+                for (size_t b = 0; b < sizeof(E); b++)
+                {
+                    code |= (E)(planes[b * n + i] << (8 * b));
+                }
+                exponent = delta ? (E)(exponent + unzigzag(code)) : code;
+                U mantissa = 0;
+                for (size_t b = 0; b < F::mantissa_bytes; b++)
+                {
+                    mantissa |= (U)mantissas[b * n + i] << (8 * b);
+                }
+                const U sign = (signs[i / 8] >> (i % 8)) & 1;
+                values[i] = std::bit_cast<T>((sign << (F::width - 1)) | ((U)(exponent & F::exponent_mask) << F::mantissa_bits) | (mantissa & F::mantissa_mask));
+            }
+        }
+
+#ifdef MZD_X86_SIMD
+        inline bool has_avx2()
+        {
+            static const bool supported = __builtin_cpu_supports("avx2");
+            return supported;
+        }
+
+        /// @brief Transpose the bytes of 16 8 byte words into 8 planes of 16 bytes
+        MZD_TARGET("avx2")
+        inline void transpose_words8(const __m256i (&words)[4], __m128i (&planes)[8])
+        {
+            const __m256i group = _mm256_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15,
+                                                   0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+            const __m256i interleave = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+                                                        0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+            // Each 128 bit lane now holds byte b of its two words at 16 bit unit b
+            const __m256i a0 = _mm256_shuffle_epi8(words[0], group);
+            const __m256i a1 = _mm256_shuffle_epi8(words[1], group);
+            const __m256i a2 = _mm256_shuffle_epi8(words[2], group);
+            const __m256i a3 = _mm256_shuffle_epi8(words[3], group);
+            const __m256i t0 = _mm256_unpacklo_epi16(a0, a1);
+            const __m256i t1 = _mm256_unpackhi_epi16(a0, a1);
+            const __m256i t2 = _mm256_unpacklo_epi16(a2, a3);
+            const __m256i t3 = _mm256_unpackhi_epi16(a2, a3);
+            const __m256i s[4] = {_mm256_unpacklo_epi32(t0, t2), _mm256_unpackhi_epi32(t0, t2),
+                                  _mm256_unpacklo_epi32(t1, t3), _mm256_unpackhi_epi32(t1, t3)};
+            for (int k = 0; k < 4; k++)
+            {
+                // Bring the even and odd word pairs of each unit together, then interleave them back into order
+                const __m256i x = _mm256_shuffle_epi8(_mm256_permute4x64_epi64(s[k], _MM_SHUFFLE(3, 1, 2, 0)), interleave);
+                planes[2 * k] = _mm256_castsi256_si128(x);
+                planes[2 * k + 1] = _mm256_extracti128_si256(x, 1);
+            }
+        }
+
+        /// @brief The inverse of `transpose_words8`
+        MZD_TARGET("avx2")
+        inline void untranspose_words8(const __m128i (&planes)[8], __m256i (&words)[4])
+        {
+            const __m256i ungroup = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+                                                     0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+            const __m256i deinterleave = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15,
+                                                          0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+            __m256 s[4];
+            for (int k = 0; k < 4; k++)
+            {
+                const __m256i x = _mm256_set_m128i(planes[2 * k + 1], planes[2 * k]);
+                s[k] = _mm256_castsi256_ps(_mm256_permute4x64_epi64(_mm256_shuffle_epi8(x, deinterleave), _MM_SHUFFLE(3, 1, 2, 0)));
+            }
+            const __m256i t0 = _mm256_shuffle_epi8(_mm256_castps_si256(_mm256_shuffle_ps(s[0], s[1], _MM_SHUFFLE(2, 0, 2, 0))), deinterleave);
+            const __m256i t2 = _mm256_shuffle_epi8(_mm256_castps_si256(_mm256_shuffle_ps(s[0], s[1], _MM_SHUFFLE(3, 1, 3, 1))), deinterleave);
+            const __m256i t1 = _mm256_shuffle_epi8(_mm256_castps_si256(_mm256_shuffle_ps(s[2], s[3], _MM_SHUFFLE(2, 0, 2, 0))), deinterleave);
+            const __m256i t3 = _mm256_shuffle_epi8(_mm256_castps_si256(_mm256_shuffle_ps(s[2], s[3], _MM_SHUFFLE(3, 1, 3, 1))), deinterleave);
+            words[0] = _mm256_shuffle_epi8(_mm256_unpacklo_epi64(t0, t1), ungroup);
+            words[1] = _mm256_shuffle_epi8(_mm256_unpackhi_epi64(t0, t1), ungroup);
+            words[2] = _mm256_shuffle_epi8(_mm256_unpacklo_epi64(t2, t3), ungroup);
+            words[3] = _mm256_shuffle_epi8(_mm256_unpackhi_epi64(t2, t3), ungroup);
+        }
+
+        /// @brief Transpose the bytes of 32 4 byte words into 4 planes of 32 bytes
+        MZD_TARGET("avx2")
+        inline void transpose_words4(const __m256i (&words)[4], __m256i (&planes)[4])
+        {
+            const __m256i group = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                                                   0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+            const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+            const __m256i a0 = _mm256_shuffle_epi8(words[0], group);
+            const __m256i a1 = _mm256_shuffle_epi8(words[1], group);
+            const __m256i a2 = _mm256_shuffle_epi8(words[2], group);
+            const __m256i a3 = _mm256_shuffle_epi8(words[3], group);
+            const __m256i t0 = _mm256_unpacklo_epi32(a0, a1);
+            const __m256i t1 = _mm256_unpackhi_epi32(a0, a1);
+            const __m256i t2 = _mm256_unpacklo_epi32(a2, a3);
+            const __m256i t3 = _mm256_unpackhi_epi32(a2, a3);
+            planes[0] = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t0, t2), order);
+            planes[1] = _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(t0, t2), order);
+            planes[2] = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(t1, t3), order);
+            planes[3] = _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(t1, t3), order);
+        }
+
+        /// @brief The inverse of `transpose_words4`
+        MZD_TARGET("avx2")
+        inline void untranspose_words4(const __m256i (&planes)[4], __m256i (&words)[4])
+        {
+            // Grouping 4 bytes of 4 words is its own inverse
+            const __m256i group = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                                                   0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+            const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+            const __m256i s0 = _mm256_permutevar8x32_epi32(planes[0], order);
+            const __m256i s1 = _mm256_permutevar8x32_epi32(planes[1], order);
+            const __m256i s2 = _mm256_permutevar8x32_epi32(planes[2], order);
+            const __m256i s3 = _mm256_permutevar8x32_epi32(planes[3], order);
+            const __m256 t0 = _mm256_castsi256_ps(_mm256_unpacklo_epi64(s0, s1));
+            const __m256 t2 = _mm256_castsi256_ps(_mm256_unpackhi_epi64(s0, s1));
+            const __m256 t1 = _mm256_castsi256_ps(_mm256_unpacklo_epi64(s2, s3));
+            const __m256 t3 = _mm256_castsi256_ps(_mm256_unpackhi_epi64(s2, s3));
+            words[0] = _mm256_shuffle_epi8(_mm256_castps_si256(_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0))), group);
+            words[1] = _mm256_shuffle_epi8(_mm256_castps_si256(_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1))), group);
+            words[2] = _mm256_shuffle_epi8(_mm256_castps_si256(_mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(2, 0, 2, 0))), group);
+            words[3] = _mm256_shuffle_epi8(_mm256_castps_si256(_mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 1, 3, 1))), group);
+        }
+
+        /// @brief Split doubles 16 at a time, returning how many were split
+        MZD_TARGET("avx2")
+        inline size_t split_avx2(const double *values, size_t n, bool delta, byte_t *signs, byte_t *planes)
+        {
+            const __m256i exponent_mask = _mm256_set1_epi64x(0x7ff);
+            const __m256i mantissa_mask = _mm256_set1_epi64x((int64_t)Fields<double>::mantissa_mask);
+            const __m256i code_mask = _mm256_set1_epi64x(0xffff);
+            const __m256i one = _mm256_set1_epi64x(1);
+            const __m256i keep = _mm256_set1_epi64x(delta ? -1 : 0);
+            __m256i carry = _mm256_setzero_si256();
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                __m256i mantissas[4];
+                __m256i codes[4];
+                uint32_t sign_bits = 0;
+                for (int k = 0; k < 4; k++)
+                {
+                    const __m256i bits = _mm256_loadu_si256((const __m256i *)(values + i + 4 * k));
+                    const __m256i exponent = _mm256_and_si256(_mm256_srli_epi64(bits, 52), exponent_mask);
+                    const __m256i previous = _mm256_blend_epi32(_mm256_permute4x64_epi64(exponent, _MM_SHUFFLE(2, 1, 0, 0)), carry, 0x03);
+                    carry = _mm256_permute4x64_epi64(exponent, _MM_SHUFFLE(3, 3, 3, 3));
+                    const __m256i difference = _mm256_sub_epi64(exponent, _mm256_and_si256(previous, keep));
+                    const __m256i negative = _mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(_mm256_srli_epi64(difference, 15), one));
+                    const __m256i zigzagged = _mm256_and_si256(_mm256_xor_si256(_mm256_slli_epi64(difference, 1), negative), code_mask);
+                    codes[k] = _mm256_blendv_epi8(exponent, zigzagged, keep);
+                    mantissas[k] = _mm256_and_si256(bits, mantissa_mask);
+                    sign_bits |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(bits)) << (4 * k);
+                }
+                __m128i code_planes[8];
+                __m128i mantissa_planes[8];
+                transpose_words8(codes, code_planes);
+                transpose_words8(mantissas, mantissa_planes);
+                for (size_t b = 0; b < 2; b++)
+                {
+                    _mm_storeu_si128((__m128i *)(planes + b * n + i), code_planes[b]);
+                }
+                for (size_t b = 0; b < Fields<double>::mantissa_bytes; b++)
+                {
+                    _mm_storeu_si128((__m128i *)(planes + (2 + b) * n + i), mantissa_planes[b]);
+                }
+                signs[i / 8] = (byte_t)sign_bits;
+                signs[i / 8 + 1] = (byte_t)(sign_bits >> 8);
+            }
+            return i;
+        }
+
+        /// @brief Split floats 32 at a time, returning how many were split. The exponent code takes the place of
+        /// each float's top byte, so one transpose yields the 3 mantissa planes and the exponent plane.
+        MZD_TARGET("avx2")
+        inline size_t split_avx2(const float *values, size_t n, bool delta, byte_t *signs, byte_t *planes)
+        {
+            const __m256i exponent_mask = _mm256_set1_epi32(0xff);
+            const __m256i mantissa_mask = _mm256_set1_epi32((int32_t)Fields<float>::mantissa_mask);
+            const __m256i code_mask = _mm256_set1_epi32(0xff);
+            const __m256i one = _mm256_set1_epi32(1);
+            const __m256i keep = _mm256_set1_epi32(delta ? -1 : 0);
+            const __m256i shift = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+            const __m256i last = _mm256_set1_epi32(7);
+            __m256i carry = _mm256_setzero_si256();
+            size_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                __m256i words[4];
+                for (int k = 0; k < 4; k++)
+                {
+                    const __m256i bits = _mm256_loadu_si256((const __m256i *)(values + i + 8 * k));
+                    const __m256i exponent = _mm256_and_si256(_mm256_srli_epi32(bits, 23), exponent_mask);
+                    const __m256i previous = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(exponent, shift), carry, 0x01);
+                    carry = _mm256_permutevar8x32_epi32(exponent, last);
+                    const __m256i difference = _mm256_sub_epi32(exponent, _mm256_and_si256(previous, keep));
+                    const __m256i negative = _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(_mm256_srli_epi32(difference, 7), one));
+                    const __m256i zigzagged = _mm256_and_si256(_mm256_xor_si256(_mm256_slli_epi32(difference, 1), negative), code_mask);
+                    const __m256i code = _mm256_blendv_epi8(exponent, zigzagged, keep);
+                    words[k] = _mm256_or_si256(_mm256_and_si256(bits, mantissa_mask), _mm256_slli_epi32(code, 24));
+                    signs[i / 8 + k] = (byte_t)_mm256_movemask_ps(_mm256_castsi256_ps(bits));
+                }
+                __m256i word_planes[4];
+                transpose_words4(words, word_planes);
+                _mm256_storeu_si256((__m256i *)(planes + i), word_planes[3]);
+                for (size_t b = 0; b < Fields<float>::mantissa_bytes; b++)
+                {
+                    _mm256_storeu_si256((__m256i *)(planes + (1 + b) * n + i), word_planes[b]);
+                }
+            }
+            return i;
+        }
+
+        /// @brief Expand 4 sign bits into the sign bit of 4 64 bit lanes
+        MZD_TARGET("avx2")
+        inline __m256i expand_signs64(uint32_t bits)
+        {
+            const __m256i select = _mm256_setr_epi64x(1, 2, 4, 8);
+            const __m256i set = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(bits), select), select);
+            return _mm256_slli_epi64(set, 63);
+        }
+
+        /// @brief Expand 8 sign bits into the sign bit of 8 32 bit lanes
+        MZD_TARGET("avx2")
+        inline __m256i expand_signs32(uint32_t bits)
+        {
+            const __m256i select = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+            const __m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), select), select);
+            return _mm256_slli_epi32(set, 31);
+        }
+
+        /// @brief Merge doubles 16 at a time, returning how many were merged
+        MZD_TARGET("avx2")
+        inline size_t merge_avx2(const byte_t *signs, const byte_t *planes, size_t n, bool delta, double *values)
+        {
+            const __m256i exponent_mask = _mm256_set1_epi64x(0x7ff);
+            const __m256i one = _mm256_set1_epi64x(1);
+            __m256i carry = _mm256_setzero_si256();
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                __m128i code_planes[8] = {};
+                __m128i mantissa_planes[8] = {};
+                for (size_t b = 0; b < 2; b++)
+                {
+                    code_planes[b] = _mm_loadu_si128((const __m128i *)(planes + b * n + i));
+                }
+                for (size_t b = 0; b < Fields<double>::mantissa_bytes; b++)
+                {
+                    mantissa_planes[b] = _mm_loadu_si128((const __m128i *)(planes + (2 + b) * n + i));
+                }
+                __m256i codes[4];
+                __m256i mantissas[4];
+                untranspose_words8(code_planes, codes);
+                untranspose_words8(mantissa_planes, mantissas);
+                const uint32_t sign_bits = signs[i / 8] | ((uint32_t)signs[i / 8 + 1] << 8);
+                for (int k = 0; k < 4; k++)
+                {
+                    __m256i exponent = codes[k];
+                    if (delta)
+                    {
+                        // Undo the zigzag, then take a prefix sum across the lanes on top of the previous exponent
+                        exponent = _mm256_xor_si256(_mm256_srli_epi64(exponent, 1), _mm256_sub_epi64(_mm256_setzero_si256(), _mm256_and_si256(exponent, one)));
+                        exponent = _mm256_add_epi64(exponent, _mm256_blend_epi32(_mm256_setzero_si256(), _mm256_permute4x64_epi64(exponent, _MM_SHUFFLE(2, 1, 0, 0)), 0xfc));
+                        exponent = _mm256_add_epi64(exponent, _mm256_blend_epi32(_mm256_setzero_si256(), _mm256_permute4x64_epi64(exponent, _MM_SHUFFLE(1, 0, 0, 0)), 0xf0));
+                        exponent = _mm256_add_epi64(exponent, carry);
+                        carry = _mm256_permute4x64_epi64(exponent, _MM_SHUFFLE(3, 3, 3, 3));
+                    }
+                    const __m256i bits = _mm256_or_si256(_mm256_or_si256(mantissas[k], _mm256_slli_epi64(_mm256_and_si256(exponent, exponent_mask), 52)),
+                                                         expand_signs64(sign_bits >> (4 * k)));
+                    _mm256_storeu_si256((__m256i *)(values + i + 4 * k), bits);
+                }
+            }
+            return i;
+        }
+
+        /// @brief Merge floats 32 at a time, returning how many were merged
+        MZD_TARGET("avx2")
+        inline size_t merge_avx2(const byte_t *signs, const byte_t *planes, size_t n, bool delta, float *values)
+        {
+            const __m256i exponent_mask = _mm256_set1_epi32(0xff);
+            const __m256i mantissa_mask = _mm256_set1_epi32((int32_t)Fields<float>::mantissa_mask);
+            const __m256i one = _mm256_set1_epi32(1);
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i shift1 = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+            const __m256i shift2 = _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5);
+            const __m256i shift4 = _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3);
+            const __m256i last = _mm256_set1_epi32(7);
+            __m256i carry = zero;
+            size_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                __m256i word_planes[4];
+                word_planes[3] = _mm256_loadu_si256((const __m256i *)(planes + i));
+                for (size_t b = 0; b < Fields<float>::mantissa_bytes; b++)
+                {
+                    word_planes[b] = _mm256_loadu_si256((const __m256i *)(planes + (1 + b) * n + i));
+                }
+                __m256i words[4];
+                untranspose_words4(word_planes, words);
+                for (int k = 0; k < 4; k++)
+                {
+                    __m256i exponent = _mm256_srli_epi32(words[k], 24);
+                    if (delta)
+                    {
+                        exponent = _mm256_xor_si256(_mm256_srli_epi32(exponent, 1), _mm256_sub_epi32(zero, _mm256_and_si256(exponent, one)));
+                        exponent = _mm256_add_epi32(exponent, _mm256_blend_epi32(zero, _mm256_permutevar8x32_epi32(exponent, shift1), 0xfe));
+                        exponent = _mm256_add_epi32(exponent, _mm256_blend_epi32(zero, _mm256_permutevar8x32_epi32(exponent, shift2), 0xfc));
+                        exponent = _mm256_add_epi32(exponent, _mm256_blend_epi32(zero, _mm256_permutevar8x32_epi32(exponent, shift4), 0xf0));
+                        exponent = _mm256_add_epi32(exponent, carry);
+                        carry = _mm256_permutevar8x32_epi32(exponent, last);
+                    }
+                    const __m256i bits = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(words[k], mantissa_mask), _mm256_slli_epi32(_mm256_and_si256(exponent, exponent_mask), 23)),
+                                                         expand_signs32(signs[i / 8 + k]));
+                    _mm256_storeu_si256((__m256i *)(values + i + 8 * k), bits);
+                }
+            }
+            return i;
+        }
+#endif
+
+        /// @brief Split `n` values into sign bits and exponent and mantissa planes, using AVX2 where the CPU has it
+        template <typename T>
+        void split(const T *values, size_t n, bool delta, byte_t *signs, byte_t *planes)
+        {
+            size_t done = 0;
+#ifdef MZD_X86_SIMD
+            if (has_avx2())
+            {
+                done = split_avx2(values, n, delta, signs, planes);
+            }
+#endif
+            split_scalar(values, done, n, delta, signs, planes);
+        }
+
+        /// @brief Reassemble `n` values from sign bits and exponent and mantissa planes, using AVX2 where the CPU has it
+        template <typename T>
+        void merge(const byte_t *signs, const byte_t *planes, size_t n, bool delta, T *values)
+        {
+            size_t done = 0;
+#ifdef MZD_X86_SIMD
+            if (has_avx2())
+            {
+                done = merge_avx2(signs, planes, n, delta, values);
+            }
+#endif
+            merge_scalar(signs, planes, done, n, delta, values);
+        }
+
+        template <typename T>
+        uint64_t read_header(const buffer_span_t &buffer)
+        {
+            if (buffer.size() < header_size || !std::equal(magic.begin(), magic.end(), buffer.begin()))
+            {
+                throw std::runtime_error("Not a float field split buffer");
+            }
+            if (buffer[4] != version || buffer[5] != sizeof(T) || (buffer[6] & ~delta_flag) != 0)
+            {
+                std::stringstream ss;
+                ss << "Cannot decode float field split version " << (int)buffer[4] << " holding " << (int)buffer[5]
+                   << " byte values as " << sizeof(T) << " byte values";
+                throw std::runtime_error(ss.str());
+            }
+            return binary::read_le<uint64_t>(buffer.data() + 8);
+        }
+    }
+
+    /// @brief Compress a floating point array by storing its signs, exponents and mantissas as separate ZSTD
+    /// compressed streams, with the exponents delta coded and the mantissas byte shuffled. Data will be stored in
+    /// little endian byte order.
+    /// @tparam T `float` or `double`
+    /// @param data The data array to compress
+    /// @param transposeBuffer An intermediate byte buffer to split the values into
+    /// @param outBuffer A byte buffer to write the compressed frame to
+    /// @param params The ZSTD compression level or parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t fields_compress_buffer(const std::span<const T> &data, buffer_t &transposeBuffer, buffer_t &outBuffer, const CompressionParams &params = CompressionParams())
+    {
+        const size_t n = data.size();
+        outBuffer.clear();
+        outBuffer.insert(outBuffer.end(), fields::magic.begin(), fields::magic.end());
+        outBuffer.push_back(fields::version);
+        outBuffer.push_back(sizeof(T));
+        outBuffer.push_back(0);
+        outBuffer.push_back(0);
+        binary::write_le<uint64_t>(outBuffer, n);
+        if (n == 0)
+        {
+            binary::write_le<uint64_t>(outBuffer, 0);
+            binary::write_le<uint64_t>(outBuffer, 0);
+            return 0;
+        }
+
+        const bool delta = fields::prefer_delta(data.data(), n);
+        outBuffer[6] = delta ? fields::delta_flag : 0;
+        buffer_t signs((n + 7) / 8);
+        transposeBuffer.resize(fields::plane_bytes<T>(n));
+        fields::split(data.data(), n, delta, signs.data(), transposeBuffer.data());
+
+        std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+        if (!cctx)
+        {
+            throw std::runtime_error("Failed to allocate ZSTD compression context");
+        }
+        const size_t exponent_bytes = n * sizeof(typename fields::Fields<T>::E);
+        buffer_t sign_frame;
+        buffer_t exponent_frame;
+        buffer_t mantissa_frame;
+        inner::zstd_compress_into(cctx.get(), signs.data(), signs.size(), sign_frame, params);
+        inner::zstd_compress_into(cctx.get(), transposeBuffer.data(), exponent_bytes, exponent_frame, params);
+        inner::zstd_compress_into(cctx.get(), transposeBuffer.data() + exponent_bytes, transposeBuffer.size() - exponent_bytes, mantissa_frame, params);
+
+        binary::write_le<uint64_t>(outBuffer, sign_frame.size());
+        binary::write_le<uint64_t>(outBuffer, exponent_frame.size());
+        outBuffer.reserve(outBuffer.size() + sign_frame.size() + exponent_frame.size() + mantissa_frame.size());
+        outBuffer.insert(outBuffer.end(), sign_frame.begin(), sign_frame.end());
+        outBuffer.insert(outBuffer.end(), exponent_frame.begin(), exponent_frame.end());
+        outBuffer.insert(outBuffer.end(), mantissa_frame.begin(), mantissa_frame.end());
+        return 0;
+    }
+
+    template <typename T>
+    size_t fields_compress_buffer(const std::vector<T> &data, buffer_t &transposeBuffer, buffer_t &outBuffer, const CompressionParams &params = CompressionParams())
+    {
+        return fields_compress_buffer(std::span<const T>(data.data(), data.size()), transposeBuffer, outBuffer, params);
+    }
+
+    template <typename T>
+    size_t fields_compress_buffer(const std::vector<T> &data, buffer_t &outBuffer, const CompressionParams &params = CompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return fields_compress_buffer(data, transposeBuffer, outBuffer, params);
+    }
+
+    /// @brief Decompress an array written by `fields_compress_buffer`
+    /// @tparam T `float` or `double`
+    /// @param buffer The compressed frame
+    /// @param transposeBuffer An intermediate byte buffer to decompress the exponent and mantissa planes into
+    /// @param dataBuffer The data array to decompress into
+    /// @param params The ZSTD decompression parameters
+    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    template <typename T>
+    size_t fields_decompress_buffer(const buffer_span_t &buffer, buffer_t &transposeBuffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        const uint64_t n = fields::read_header<T>(buffer);
+        const uint64_t sign_size = binary::read_le<uint64_t>(buffer.data() + 16);
+        const uint64_t exponent_size = binary::read_le<uint64_t>(buffer.data() + 24);
+        const size_t available = buffer.size() - fields::header_size;
+        if (sign_size > available || exponent_size > available - sign_size)
+        {
+            throw std::runtime_error("Malformed float field split frame, stream sizes overflow the buffer");
+        }
+        if (n == 0)
+        {
+            dataBuffer.clear();
+            return 0;
+        }
+        auto sign_frame = buffer.subspan(fields::header_size, sign_size);
+        auto exponent_frame = buffer.subspan(fields::header_size + sign_size, exponent_size);
+        auto mantissa_frame = buffer.subspan(fields::header_size + sign_size + exponent_size);
+        // Checked before allocating, so a corrupt count is caught by the mantissa frame's own header
+        if (inner::zstd_content_size(mantissa_frame) != fields::plane_bytes<T>(n) - n * sizeof(typename fields::Fields<T>::E))
+        {
+            throw std::runtime_error("Malformed float field split frame, mantissa size does not match header");
+        }
+
+        std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        if (!dctx)
+        {
+            throw std::runtime_error("Failed to allocate ZSTD decompression context");
+        }
+        const size_t exponent_bytes = n * sizeof(typename fields::Fields<T>::E);
+        buffer_t signs((n + 7) / 8);
+        transposeBuffer.resize(fields::plane_bytes<T>(n));
+        if (inner::zstd_decompress_into(dctx.get(), sign_frame, signs.data(), signs.size(), params) != signs.size() ||
+            inner::zstd_decompress_into(dctx.get(), exponent_frame, transposeBuffer.data(), exponent_bytes, params) != exponent_bytes ||
+            inner::zstd_decompress_into(dctx.get(), mantissa_frame, transposeBuffer.data() + exponent_bytes, transposeBuffer.size() - exponent_bytes, params) != transposeBuffer.size() - exponent_bytes)
+        {
+            throw std::runtime_error("Malformed float field split frame, stream sizes do not match header");
+        }
+        dataBuffer.resize(n);
+        fields::merge(signs.data(), transposeBuffer.data(), n, (buffer[6] & fields::delta_flag) != 0, dataBuffer.data());
+        return 0;
+    }
+
+    template <typename T>
+    size_t fields_decompress_buffer(const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params = DecompressionParams())
+    {
+        buffer_t transposeBuffer;
+        return fields_decompress_buffer(buffer, transposeBuffer, dataBuffer, params);
+    }
+
+    /// @brief Which resource an `AdaptiveLevelController` tries to keep within budget
+    enum class BudgetKind
+    {
+        /// @brief Keep the achieved compression throughput, in MB/s of input, at or above the target
+        Throughput,
+        /// @brief Keep the fraction of wall-clock time spent compressing at or below the target (0, 1]
+        CpuShare,
+    };
+
+    /// @brief Why an `AdaptiveLevelController` changed the compression level of an array class
+    enum class DecisionReason
+    {
+        /// @brief The budget was exceeded, so the level was lowered
+        OverBudget,
+        /// @brief There was spare budget, so the level was raised
+        UnderBudget,
+        /// @brief The last raise did not improve the compression ratio enough to be worth its cost
+        NoRatioGain,
+    };
+
+    /// @brief Configuration for `AdaptiveLevelController`
+    struct AdaptiveLevelConfig
+    {
+        /// @brief The kind of budget `target` describes
+        BudgetKind budget = BudgetKind::Throughput;
+        /// @brief MB/s (10^6 bytes) of input for `BudgetKind::Throughput`, or a fraction of wall-clock time for `BudgetKind::CpuShare`
+        double target = 200.0;
+        /// @brief The relative width of the dead band around `target` in which the level is left alone
+        double tolerance = 0.15;
+        /// @brief The level each array class starts at
+        int initial_level = ZSTD_defaultCLevel();
+        /// @brief The lowest level to use. Negative levels select ZSTD's fast modes.
+        int min_level = -5;
+        /// @brief The highest level to use
+        int max_level = 9;
+        /// @brief The number of observations of an array class between level decisions
+        size_t window = 8;
+        /// @brief The weight of the newest observation in the moving averages
+        double smoothing = 0.25;
+        /// @brief The minimum relative ratio improvement a raised level must deliver to be kept
+        double min_ratio_gain = 0.01;
+        /// @brief The number of recent decisions to retain
+        size_t max_decisions = 256;
+    };
+
+    /// @brief A single level change made by an `AdaptiveLevelController`
+    struct LevelDecision
+    {
+        uint32_t array_class;
+        int from_level;
+        int to_level;
+        DecisionReason reason;
+        /// @brief The smoothed throughput of the array class when the decision was made
+        double mb_per_sec;
+        /// @brief The smoothed fraction of wall-clock time spent compressing when the decision was made
+        double cpu_share;
+        /// @brief The smoothed compression ratio of the array class when the decision was made
+        double ratio;
+        /// @brief The total number of observations made before this decision
+        uint64_t observation;
+    };
+
+    /// @brief Running statistics for one array class tracked by an `AdaptiveLevelController`
+    struct ArrayClassStats
+    {
+        int level = 0;
+        uint64_t calls = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        double busy_seconds = 0.0;
+        /// @brief Smoothed throughput at the current level
+        double mb_per_sec = 0.0;
+        /// @brief Smoothed compression ratio at the current level
+        double ratio = 0.0;
+        uint64_t raises = 0;
+        uint64_t lowers = 0;
+        /// @brief The highest level the ratio check currently permits
+        int ceiling = 0;
+
+        size_t since_decision = 0;
+        bool probing = false;
+        double ratio_before_raise = 0.0;
+    };
+
+    /// @brief Moves the ZSTD compression level of each array class to keep compression within a throughput or CPU-time budget.
+    ///
+    /// Array classes are caller-chosen identifiers (e.g. one for m/z arrays, one for intensity arrays) so that data with
+    /// very different compressibility are tuned independently. The controller is fed one observation per compressed
+    /// array and is not thread-safe.
+    class AdaptiveLevelController
+    {
+    public:
+        AdaptiveLevelController(AdaptiveLevelConfig config = AdaptiveLevelConfig()) : config_(config)
+        {
+            config_.min_level = std::max(config_.min_level, ZSTD_minCLevel());
+            config_.max_level = std::min(config_.max_level, ZSTD_maxCLevel());
+            if (config_.min_level > config_.max_level)
+            {
+                throw std::invalid_argument("Adaptive level controller requires min_level <= max_level");
+            }
+            if (config_.initial_level == 0)
+            {
+                config_.initial_level = ZSTD_defaultCLevel();
+            }
+            config_.initial_level = std::clamp(config_.initial_level, config_.min_level, config_.max_level);
+            config_.window = std::max<size_t>(config_.window, 1);
+        }
+
+        const AdaptiveLevelConfig &config() const
+        {
+            return config_;
+        }
+
+        /// @brief The level the next array of `array_class` should be compressed at
+        int level_for(uint32_t array_class)
+        {
+            return class_stats(array_class).level;
+        }
+
+        /// @brief Record the cost of compressing one array and possibly move the level of its class
+        /// @param array_class The class the array belongs to
+        /// @param bytes_in The uncompressed size of the array
+        /// @param bytes_out The compressed size of the array
+        /// @param busy_seconds The time spent compressing the array
+        /// @param wall_seconds The wall-clock time elapsed since the previous observation ended, including `busy_seconds`
+        /// @return The level the next array of `array_class` should be compressed at
+        int observe(uint32_t array_class, size_t bytes_in, size_t bytes_out, double busy_seconds, double wall_seconds)
+        {
+            auto &st = class_stats(array_class);
+            observations_ += 1;
+            st.calls += 1;
+            st.bytes_in += bytes_in;
+            st.bytes_out += bytes_out;
+            st.busy_seconds += busy_seconds;
+
+            double mb_per_sec = busy_seconds > 0 ? (bytes_in / 1e6) / busy_seconds : std::numeric_limits<double>::max();
+            double ratio = bytes_out > 0 ? (double)bytes_in / (double)bytes_out : 1.0;
+            double share = wall_seconds > 0 ? std::min(1.0, busy_seconds / wall_seconds) : 1.0;
+
+            if (st.since_decision == 0)
+            {
+                st.mb_per_sec = mb_per_sec;
+                st.ratio = ratio;
+            }
+            else
+            {
+                st.mb_per_sec += config_.smoothing * (mb_per_sec - st.mb_per_sec);
+                st.ratio += config_.smoothing * (ratio - st.ratio);
+            }
+            cpu_share_ = observations_ == 1 ? share : cpu_share_ + config_.smoothing * (share - cpu_share_);
+
+            st.since_decision += 1;
+            if (st.since_decision >= config_.window)
+            {
+                decide(array_class, st);
+            }
+            return st.level;
+        }
+
+        /// @brief The smoothed fraction of wall-clock time spent compressing
+        double cpu_share() const
+        {
+            return cpu_share_;
+        }
+
+        uint64_t observations() const
+        {
+            return observations_;
+        }
+
+        /// @brief Per-array class statistics, keyed by array class
+        const std::map<uint32_t, ArrayClassStats> &stats() const
+        {
+            return stats_;
+        }
+
+        /// @brief The most recent level changes, oldest first
+        const std::deque<LevelDecision> &decisions() const
+        {
+            return decisions_;
+        }
+
+        /// @brief The level after `level`, skipping 0 which ZSTD treats as "default"
+        static int step_up(int level)
+        {
+            return level == -1 ? 1 : level + 1;
+        }
+
+        /// @brief The level before `level`, skipping 0 which ZSTD treats as "default"
+        static int step_down(int level)
+        {
+            return level == 1 ? -1 : level - 1;
+        }
+
+    private:
+        AdaptiveLevelConfig config_;
+        std::map<uint32_t, ArrayClassStats> stats_;
+        std::deque<LevelDecision> decisions_;
+        double cpu_share_ = 0.0;
+        uint64_t observations_ = 0;
+
+        ArrayClassStats &class_stats(uint32_t array_class)
+        {
+            auto it = stats_.find(array_class);
+            if (it == stats_.end())
+            {
+                ArrayClassStats st;
+                st.level = config_.initial_level;
+                st.ceiling = config_.max_level;
+                it = stats_.emplace(array_class, st).first;
+            }
+            return it->second;
+        }
+
+        void change_level(uint32_t array_class, ArrayClassStats &st, int to_level, DecisionReason reason)
+        {
+            decisions_.push_back(LevelDecision{array_class, st.level, to_level, reason, st.mb_per_sec, cpu_share_, st.ratio, observations_});
+            while (decisions_.size() > config_.max_decisions)
+            {
+                decisions_.pop_front();
+            }
+            if (to_level > st.level)
+            {
+                st.raises += 1;
+            }
+            else
+            {
+                st.lowers += 1;
+            }
+            st.level = to_level;
+        }
+
+        void decide(uint32_t array_class, ArrayClassStats &st)
+        {
+            st.since_decision = 0;
+
+            bool over_budget;
+            bool under_budget;
+            if (config_.budget == BudgetKind::Throughput)
+            {
+                over_budget = st.mb_per_sec < config_.target * (1.0 - config_.tolerance);
+                under_budget = st.mb_per_sec > config_.target * (1.0 + config_.tolerance);
+            }
+            else
+            {
+                over_budget = cpu_share_ > config_.target * (1.0 + config_.tolerance);
+                under_budget = cpu_share_ < config_.target * (1.0 - config_.tolerance);
+            }
+
+            bool was_probing = st.probing;
+            st.probing = false;
+
+            if (over_budget)
+            {
+                if (st.level > config_.min_level)
+                {
+                    change_level(array_class, st, std::max(step_down(st.level), config_.min_level), DecisionReason::OverBudget);
+                }
+                // The budget, not the ratio, is now the binding constraint so allow probing upwards again later
+                st.ceiling = config_.max_level;
+                return;
+            }
+
+            if (was_probing && st.ratio < st.ratio_before_raise * (1.0 + config_.min_ratio_gain))
+            {
+                auto lower = std::max(step_down(st.level), config_.min_level);
+                st.ceiling = lower;
+                change_level(array_class, st, lower, DecisionReason::NoRatioGain);
+                return;
+            }
+
+            if (under_budget && st.level < std::min(config_.max_level, st.ceiling))
+            {
+                st.ratio_before_raise = st.ratio;
+                st.probing = true;
+                change_level(array_class, st, step_up(st.level), DecisionReason::UnderBudget);
+            }
+        }
+    };
+
+    /// @brief Re-usable compression state for a long-running writer or reader.
+    ///
+    /// A session owns a ZSTD compression and decompression context and the intermediate buffers the codecs need,
+    /// so repeated calls do not re-allocate them. Sessions are not thread-safe; use one per thread.
+    ///
+    /// When adaptive mode is enabled, each compress call is timed and the level for its array class is chosen by
+    /// an `AdaptiveLevelController`.
+    class CompressionSession
     {
-        if (buffer.empty())
+    public:
+        CompressionSession(const CompressionParams &params = CompressionParams(),
+                           const DecompressionParams &decompression_params = DecompressionParams())
+            : params_(params), decompression_params_(decompression_params), cctx_(ZSTD_createCCtx()), dctx_(ZSTD_createDCtx())
+        {
+            if (cctx_ == nullptr || dctx_ == nullptr)
+            {
+                ZSTD_freeCCtx(cctx_);
+                ZSTD_freeDCtx(dctx_);
+                throw std::runtime_error("Failed to allocate ZSTD context");
+            }
+        }
+
+        CompressionSession(const CompressionSession &) = delete;
+        CompressionSession &operator=(const CompressionSession &) = delete;
+
+        CompressionSession(CompressionSession &&other) noexcept
+        {
+            *this = std::move(other);
+        }
+
+        CompressionSession &operator=(CompressionSession &&other) noexcept
+        {
+            if (this != &other)
+            {
+                ZSTD_freeCCtx(cctx_);
+                ZSTD_freeDCtx(dctx_);
+                params_ = other.params_;
+                decompression_params_ = other.decompression_params_;
+                cctx_ = std::exchange(other.cctx_, nullptr);
+                dctx_ = std::exchange(other.dctx_, nullptr);
+                transposeBuffer_ = std::move(other.transposeBuffer_);
+                dictBuffer_ = std::move(other.dictBuffer_);
+                adaptive_ = std::move(other.adaptive_);
+                adaptive_enabled_ = other.adaptive_enabled_;
+                last_end_ = other.last_end_;
+                has_last_end_ = other.has_last_end_;
+            }
+            return *this;
+        }
+
+        ~CompressionSession()
+        {
+            ZSTD_freeCCtx(cctx_);
+            ZSTD_freeDCtx(dctx_);
+        }
+
+        /// @brief The fixed compression level used when adaptive mode is disabled
+        int level() const
+        {
+            return params_.level;
+        }
+
+        void set_level(int level)
+        {
+            params_.level = level;
+        }
+
+        /// @brief The compression parameters. In adaptive mode the level is chosen per call and the other parameters are kept.
+        const CompressionParams &params() const
+        {
+            return params_;
+        }
+
+        void set_params(const CompressionParams &params)
+        {
+            params_ = params;
+        }
+
+        const DecompressionParams &decompression_params() const
+        {
+            return decompression_params_;
+        }
+
+        void set_decompression_params(const DecompressionParams &params)
+        {
+            decompression_params_ = params;
+        }
+
+        /// @brief Choose compression levels per array class with an `AdaptiveLevelController`
+        void enable_adaptive(AdaptiveLevelConfig config = AdaptiveLevelConfig())
+        {
+            adaptive_ = AdaptiveLevelController(config);
+            adaptive_enabled_ = true;
+            has_last_end_ = false;
+        }
+
+        void disable_adaptive()
+        {
+            adaptive_enabled_ = false;
+        }
+
+        bool is_adaptive() const
+        {
+            return adaptive_enabled_;
+        }
+
+        /// @brief The adaptive controller, whose `stats` and `decisions` describe the levels chosen so far
+        const AdaptiveLevelController &adaptive() const
+        {
+            return adaptive_;
+        }
+
+        /// @brief The level the next array of `array_class` will be compressed at
+        int level_for(uint32_t array_class = 0)
+        {
+            return adaptive_enabled_ ? adaptive_.level_for(array_class) : params_.level;
+        }
+
+        /// @brief Compress an array using byte shuffling and ZSTD compression, see `byteshuffle_compress_buffer`
+        /// @param data The data array to compress
+        /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
+        /// @param array_class The adaptive array class `data` belongs to
+        /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+        template <typename T>
+        size_t byteshuffle_compress(const std::span<const T> &data, buffer_t &outBuffer, uint32_t array_class = 0)
+        {
+            return timed(array_class, data.size_bytes(), outBuffer, [&](const CompressionParams &params)
+                         {
+                             inner::transpose<T>(data, transposeBuffer_);
+                             return inner::zstd_compress_into(cctx_, transposeBuffer_.data(), transposeBuffer_.size(), outBuffer, params); });
+        }
+
+        template <typename T>
+        size_t byteshuffle_compress(const std::vector<T> &data, buffer_t &outBuffer, uint32_t array_class = 0)
+        {
+            return byteshuffle_compress(std::span<const T>(data.data(), data.size()), outBuffer, array_class);
+        }
+
+        /// @brief Compress an array using dictionary encoding and ZSTD compression, see `dict_compress_buffer`
+        /// @param data The data array to compress
+        /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
+        /// @param array_class The adaptive array class `data` belongs to
+        /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+        template <typename T>
+        size_t dict_compress(const std::span<const T> &data, buffer_t &outBuffer, uint32_t array_class = 0)
+        {
+            return timed(array_class, data.size_bytes(), outBuffer, [&](const CompressionParams &params)
+                         {
+                             dictBuffer_.clear();
+                             dict::dictionary_encode<T>(data, transposeBuffer_, dictBuffer_);
+                             return inner::zstd_compress_into(cctx_, dictBuffer_.data(), dictBuffer_.size(), outBuffer, params); });
+        }
+
+        template <typename T>
+        size_t dict_compress(const std::vector<T> &data, buffer_t &outBuffer, uint32_t array_class = 0)
+        {
+            return dict_compress(std::span<const T>(data.data(), data.size()), outBuffer, array_class);
+        }
+
+        /// @brief Compress an array using ZSTD compression alone, see `compress_buffer`
+        /// @param data The data array to compress
+        /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
+        /// @param array_class The adaptive array class `data` belongs to
+        /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+        template <typename T>
+        size_t compress(const std::span<const T> &data, buffer_t &outBuffer, uint32_t array_class = 0)
+        {
+            return timed(array_class, data.size_bytes(), outBuffer, [&](const CompressionParams &params)
+                         {
+                             if constexpr (binary::is_big_endian() && sizeof(T) > 1)
+                             {
+                                 transposeBuffer_.clear();
+                                 for (const T val : data)
+                                 {
+                                     auto view = binary::byte_view<T>::as_little_endian(val);
+                                     transposeBuffer_.insert(transposeBuffer_.end(), view.begin(), view.end());
+                                 }
+                                 return inner::zstd_compress_into(cctx_, transposeBuffer_.data(), transposeBuffer_.size(), outBuffer, params);
+                             }
+                             else
+                             {
+                                 return inner::zstd_compress_into(cctx_, data.data(), data.size_bytes(), outBuffer, params);
+                             } });
+        }
+
+        template <typename T>
+        size_t compress(const std::vector<T> &data, buffer_t &outBuffer, uint32_t array_class = 0)
+        {
+            return compress(std::span<const T>(data.data(), data.size()), outBuffer, array_class);
+        }
+
+        /// @brief Decompress a buffer written by `byteshuffle_compress`, `byteshuffle_compress_buffer` or
+        /// `byteshuffle_planes_compress_buffer`
+        template <typename T>
+        size_t byteshuffle_decompress(const buffer_span_t &buffer, std::vector<T> &dataBuffer)
+        {
+            if (buffer.empty())
+            {
+                dataBuffer.clear();
+                return 0;
+            }
+            if (planes::is_plane_frame(buffer))
+            {
+                planes::decode(dctx_, buffer, sizeof(T), transposeBuffer_, decompression_params_);
+            }
+            else
+            {
+                inner::zstd_decompress_into(dctx_, buffer, transposeBuffer_, decompression_params_);
+            }
+            inner::reverse_transpose(transposeBuffer_, dataBuffer);
+            return 0;
+        }
+
+        /// @brief Decompress a buffer written by `dict_compress` or `dict_compress_buffer`
+        template <typename T>
+        size_t dict_decompress(const buffer_span_t &buffer, std::vector<T> &dataBuffer)
+        {
+            dataBuffer.clear();
+            if (buffer.empty())
+            {
+                return 0;
+            }
+            inner::zstd_decompress_into(dctx_, buffer, dictBuffer_, decompression_params_);
+            return dict::dictionary_decode(dictBuffer_, dataBuffer);
+        }
+
+        /// @brief Decompress a buffer written by `compress` or `compress_buffer`
+        template <typename T>
+        size_t decompress(const buffer_span_t &buffer, std::vector<T> &dataBuffer)
+        {
+            if (buffer.empty())
+            {
+                dataBuffer.clear();
+                return 0;
+            }
+            auto outputBound = inner::zstd_content_size(buffer);
+            dataBuffer.resize((outputBound + sizeof(T) - 1) / sizeof(T));
+            auto used = inner::zstd_decompress_into(dctx_, buffer, (void *)dataBuffer.data(), outputBound, decompression_params_);
+            dataBuffer.resize(used / sizeof(T));
+            if constexpr (binary::is_big_endian() && sizeof(T) > 1)
+            {
+                for (size_t i = 0; i < dataBuffer.size(); i++)
+                {
+                    binary::byte_view<T> view(dataBuffer[i]);
+                    view.byteswap();
+                    dataBuffer[i] = view.value();
+                }
+            }
+            return 0;
+        }
+
+    private:
+        using clock_t = std::chrono::steady_clock;
+
+        CompressionParams params_;
+        DecompressionParams decompression_params_;
+        ZSTD_CCtx *cctx_ = nullptr;
+        ZSTD_DCtx *dctx_ = nullptr;
+        buffer_t transposeBuffer_;
+        buffer_t dictBuffer_;
+        AdaptiveLevelController adaptive_;
+        bool adaptive_enabled_ = false;
+        clock_t::time_point last_end_;
+        bool has_last_end_ = false;
+
+        template <typename F>
+        size_t timed(uint32_t array_class, size_t bytes_in, buffer_t &outBuffer, F &&compress_at)
+        {
+            if (!adaptive_enabled_)
+            {
+                compress_at(params_);
+                return 0;
+            }
+            CompressionParams params = params_;
+            params.level = adaptive_.level_for(array_class);
+            auto start = clock_t::now();
+            compress_at(params);
+            auto end = clock_t::now();
+            double busy = std::chrono::duration<double>(end - start).count();
+            double wall = has_last_end_ ? std::chrono::duration<double>(end - last_end_).count() : busy;
+            last_end_ = end;
+            has_last_end_ = true;
+            adaptive_.observe(array_class, bytes_in, outBuffer.size(), busy, wall);
+            return 0;
+        }
+    };
+    /// @brief Which codec a `CompressionPipeline` compresses a submitted array with
+    enum class PipelineCodec
+    {
+        ByteShuffle,
+        Dict,
+        Zstd,
+    };
+
+    /// @brief Configuration for `CompressionPipeline`
+    struct PipelineConfig
+    {
+        /// @brief The number of worker threads, each with its own `CompressionSession`
+        size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        /// @brief The most input bytes that may be submitted but not yet handed to the sink. `submit` blocks until
+        /// enough earlier arrays have been released, except that one array larger than the budget is always admitted
+        /// when nothing else is in flight.
+        size_t max_in_flight_bytes = 64 << 20;
+        /// @brief The parameters each worker's session compresses with
+        CompressionParams params = CompressionParams();
+        /// @brief Applied to each worker's session once, e.g. to call `enable_adaptive`
+        std::function<void(CompressionSession &)> configure_session;
+    };
+
+    /// @brief Compresses arrays on a pool of worker threads and releases the compressed buffers to a sink strictly in
+    /// submission order, e.g. so a file writer can append them as they arrive. Submission blocks while the input bytes
+    /// in flight exceed the configured budget, which caps memory use under bursty load.
+    ///
+    /// The sink is called from whichever worker completes the next array due, never from two threads at once. An
+    /// array whose compression fails is skipped by the sink and its future holds the exception. The sink and
+    /// `on_complete` callbacks must not call `submit` or `flush`, which would wait on the release they are part of;
+    /// doing so throws `std::runtime_error`.
+    class CompressionPipeline
+    {
+    public:
+        /// @brief Receives each compressed buffer with its submission sequence number, in order
+        using sink_t = std::function<void(uint64_t sequence, buffer_t &&compressed)>;
+        /// @brief A compression task run on a worker's session, writing to the output buffer it is given
+        using task_t = std::function<void(CompressionSession &session, buffer_t &outBuffer)>;
+
+        CompressionPipeline(sink_t sink, PipelineConfig config = PipelineConfig())
+            : sink_(std::move(sink)), config_(std::move(config))
+        {
+            const size_t n = std::max<size_t>(config_.workers, 1);
+            workers_.reserve(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                workers_.emplace_back([this]()
+                                      { work(); });
+            }
+        }
+
+        CompressionPipeline(const CompressionPipeline &) = delete;
+        CompressionPipeline &operator=(const CompressionPipeline &) = delete;
+
+        /// @brief Waits for every submitted array to reach the sink, then stops the workers
+        ~CompressionPipeline()
+        {
+            wait_released();
+            {
+                std::lock_guard<std::mutex> guard(lock_);
+                stopping_ = true;
+            }
+            work_ready_.notify_all();
+            for (auto &worker : workers_)
+            {
+                worker.join();
+            }
+        }
+
+        /// @brief Queue `data` for compression with `codec`, blocking while the in-flight byte budget is exhausted
+        /// @param data The array to compress, moved into the pipeline
+        /// @param codec The codec to compress it with
+        /// @param array_class The adaptive array class, see `CompressionSession`
+        /// @return A future holding the compressed size once the buffer has been handed to the sink
+        template <typename T>
+        std::future<size_t> submit(std::vector<T> data, PipelineCodec codec = PipelineCodec::ByteShuffle, uint32_t array_class = 0)
+        {
+            const size_t bytes = data.size() * sizeof(T);
+            return enqueue(bytes, make_task(std::move(data), codec, array_class), nullptr);
+        }
+
+        /// @brief Queue `data` for compression with `codec`, blocking while the in-flight byte budget is exhausted.
+        /// `on_complete` is called with the compressed size, or the exception that prevented it, right after the sink
+        /// has received the buffer. An exception thrown by `on_complete` is rethrown by the next `flush`.
+        template <typename T>
+        void submit(std::vector<T> data, PipelineCodec codec, std::function<void(size_t, std::exception_ptr)> on_complete, uint32_t array_class = 0)
+        {
+            const size_t bytes = data.size() * sizeof(T);
+            enqueue(bytes, make_task(std::move(data), codec, array_class), std::move(on_complete));
+        }
+
+        /// @brief Queue an arbitrary compression task accounting for `bytes` of input against the budget
+        /// @return A future holding the compressed size once the buffer has been handed to the sink
+        std::future<size_t> submit_task(size_t bytes, task_t task)
+        {
+            return enqueue(bytes, std::move(task), nullptr);
+        }
+
+        /// @brief Block until every array submitted so far has been handed to the sink, then rethrow the first
+        /// exception an `on_complete` callback threw since the last flush, if any
+        void flush()
+        {
+            wait_released();
+            std::exception_ptr error;
+            {
+                std::lock_guard<std::mutex> guard(lock_);
+                error = std::exchange(callback_error_, nullptr);
+            }
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+
+        /// @brief The input bytes submitted but not yet handed to the sink
+        size_t in_flight_bytes() const
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            return in_flight_bytes_;
+        }
+
+        /// @brief The most input bytes that were ever in flight at once
+        size_t peak_in_flight_bytes() const
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            return peak_in_flight_bytes_;
+        }
+
+        /// @brief The number of arrays handed to the sink, or skipped because they failed
+        uint64_t released() const
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            return next_release_;
+        }
+
+    private:
+        struct Job
+        {
+            uint64_t sequence = 0;
+            size_t bytes = 0;
+            task_t task;
+            std::promise<size_t> promise;
+            std::function<void(size_t, std::exception_ptr)> on_complete;
+            buffer_t compressed;
+            std::exception_ptr error;
+        };
+
+        sink_t sink_;
+        PipelineConfig config_;
+        std::vector<std::thread> workers_;
+
+        mutable std::mutex lock_;
+        std::condition_variable work_ready_;
+        std::condition_variable budget_free_;
+        std::condition_variable all_released_;
+        std::deque<Job> queue_;
+        std::map<uint64_t, Job> completed_;
+        uint64_t next_sequence_ = 0;
+        uint64_t next_release_ = 0;
+        size_t in_flight_bytes_ = 0;
+        size_t peak_in_flight_bytes_ = 0;
+        bool releasing_ = false;
+        /// @brief The worker running the sink while `releasing_` is set
+        std::thread::id releaser_;
+        std::exception_ptr callback_error_;
+        bool stopping_ = false;
+
+        /// @brief Throw if called from the sink or a callback, where waiting on the pipeline would never return.
+        /// Expects `lock_` to be held.
+        void check_not_releasing(const char *operation) const
+        {
+            if (releasing_ && releaser_ == std::this_thread::get_id())
+            {
+                std::stringstream ss;
+                ss << "CompressionPipeline cannot " << operation << " from its sink or an on_complete callback";
+                throw std::runtime_error(ss.str());
+            }
+        }
+
+        void wait_released()
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            check_not_releasing("flush");
+            all_released_.wait(guard, [&]()
+                               { return next_release_ == next_sequence_; });
+        }
+
+        template <typename T>
+        static task_t make_task(std::vector<T> &&data, PipelineCodec codec, uint32_t array_class)
+        {
+            auto owned = std::make_shared<std::vector<T>>(std::move(data));
+            return [owned, codec, array_class](CompressionSession &session, buffer_t &outBuffer)
+            {
+                switch (codec)
+                {
+                case PipelineCodec::ByteShuffle:
+                    session.byteshuffle_compress(*owned, outBuffer, array_class);
+                    break;
+                case PipelineCodec::Dict:
+                    session.dict_compress(*owned, outBuffer, array_class);
+                    break;
+                case PipelineCodec::Zstd:
+                    session.compress(*owned, outBuffer, array_class);
+                    break;
+                }
+                // The input is no longer needed once compressed
+                std::vector<T>().swap(*owned);
+            };
+        }
+
+        std::future<size_t> enqueue(size_t bytes, task_t task, std::function<void(size_t, std::exception_ptr)> on_complete)
         {
-            dataBuffer.clear();
-            return 0;
+            std::unique_lock<std::mutex> guard(lock_);
+            check_not_releasing("submit");
+            budget_free_.wait(guard, [&]()
+                              { return in_flight_bytes_ == 0 || in_flight_bytes_ + bytes <= config_.max_in_flight_bytes; });
+            Job job;
+            job.sequence = next_sequence_++;
+            job.bytes = bytes;
+            job.task = std::move(task);
+            job.on_complete = std::move(on_complete);
+            auto future = job.promise.get_future();
+            in_flight_bytes_ += bytes;
+            peak_in_flight_bytes_ = std::max(peak_in_flight_bytes_, in_flight_bytes_);
+            queue_.push_back(std::move(job));
+            guard.unlock();
+            work_ready_.notify_one();
+            return future;
         }
-        transposeBuffer.clear();
-        auto outputBound = ZSTD_getFrameContentSize(buffer.data(), buffer.size());
-        if (ZSTD_isError(outputBound))
+
+        void work()
         {
-            auto errCode = ZSTD_getErrorCode(outputBound);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            CompressionSession session(config_.params);
+            if (config_.configure_session)
+            {
+                config_.configure_session(session);
+            }
+            while (true)
+            {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> guard(lock_);
+                    work_ready_.wait(guard, [&]()
+                                     { return stopping_ || !queue_.empty(); });
+                    if (queue_.empty())
+                    {
+                        return;
+                    }
+                    job = std::move(queue_.front());
+                    queue_.pop_front();
+                }
+                try
+                {
+                    job.task(session, job.compressed);
+                }
+                catch (...)
+                {
+                    job.error = std::current_exception();
+                }
+                job.task = nullptr;
+                release(std::move(job));
+            }
         }
-        transposeBuffer.resize(outputBound);
-        auto used = ZSTD_decompress(
-            (void *)transposeBuffer.data(),
-            outputBound,
-            (void *)buffer.data(),
-            buffer.size());
-        if (ZSTD_isError(used))
+
+        /// @brief Record a finished job and, unless another thread already is, hand every job now due to the sink
+        void release(Job &&finished)
         {
-            auto errCode = ZSTD_getErrorCode(used);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            std::unique_lock<std::mutex> guard(lock_);
+            auto sequence = finished.sequence;
+            completed_.emplace(sequence, std::move(finished));
+            if (releasing_)
+            {
+                return;
+            }
+            releasing_ = true;
+            releaser_ = std::this_thread::get_id();
+            while (true)
+            {
+                auto it = completed_.find(next_release_);
+                if (it == completed_.end())
+                {
+                    break;
+                }
+                Job job = std::move(it->second);
+                completed_.erase(it);
+                guard.unlock();
+
+                size_t size = job.compressed.size();
+                if (!job.error)
+                {
+                    try
+                    {
+                        sink_(job.sequence, std::move(job.compressed));
+                    }
+                    catch (...)
+                    {
+                        job.error = std::current_exception();
+                    }
+                }
+                if (job.error)
+                {
+                    job.promise.set_exception(job.error);
+                }
+                else
+                {
+                    job.promise.set_value(size);
+                }
+                if (job.on_complete)
+                {
+                    try
+                    {
+                        job.on_complete(job.error ? 0 : size, job.error);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> callback_guard(lock_);
+                        if (!callback_error_)
+                        {
+                            callback_error_ = std::current_exception();
+                        }
+                    }
+                }
+
+                guard.lock();
+                next_release_++;
+                in_flight_bytes_ -= job.bytes;
+                budget_free_.notify_all();
+                all_released_.notify_all();
+            }
+            releasing_ = false;
         }
-        transposeBuffer.resize(used);
-        inner::reverse_transpose(transposeBuffer, dataBuffer);
-        return 0;
-    }
+    };
 
-    /// @brief Compress an array of numerical data using dictionary encoding and ZSTD compression. Data will be stored in little-endian byte order
-    /// @tparam T The data type of the array to compress
-    /// @param data The data array to compress
-    /// @param dictBuffer An intermediate byte buffer to hold the dictionary encoded bytes in
-    /// @param transposeBuffer An intermediate byte buffer to hold the intermediate shuffled bytes in
-    /// @param outBuffer A byte buffer to write ZSTD-compressed bytes to
-    /// @param level The ZSTD compression level
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
+    /// @brief Configuration for `DecodeCache`
+    struct DecodeCacheConfig
+    {
+        /// @brief The most decoded bytes kept across all shards. Each shard holds an equal share of this budget, and
+        /// an array larger than that share is decoded but never kept, so with the defaults arrays over 16 MiB always
+        /// miss. Use fewer shards to cache larger arrays.
+        size_t max_bytes = 256 << 20;
+        /// @brief The number of independently locked shards keys are spread over
+        size_t shards = 16;
+        /// @brief The ZSTD decompression parameters used on a miss
+        DecompressionParams params = DecompressionParams();
+    };
+
+    /// @brief Counters describing how well a `DecodeCache` is doing
+    struct DecodeCacheStats
+    {
+        /// @brief Lookups answered from the cache
+        uint64_t hits = 0;
+        /// @brief Lookups that had to decode
+        uint64_t misses = 0;
+        /// @brief Arrays dropped to stay within the byte budget
+        uint64_t evictions = 0;
+        /// @brief Arrays decoded ahead of time by the prefetch thread
+        uint64_t prefetched = 0;
+        /// @brief Decoded arrays not kept because they are larger than a shard's share of the byte budget
+        uint64_t oversized = 0;
+        /// @brief The decoded bytes currently held
+        size_t bytes = 0;
+        /// @brief The arrays currently held
+        size_t entries = 0;
+    };
+
+    /// @brief A thread-safe least-recently-used cache of decoded arrays for repeated random access, e.g. a viewer
+    /// scrolling back and forth over the same spectra. Keys are caller-chosen ids, or `key_of` a compressed buffer.
+    /// Decoded arrays are shared read-only, so a caller may keep using one after it has been evicted.
+    ///
+    /// Arrays looked up by buffer alone also remember the buffer's full 128-bit hash and size, and a hit must match
+    /// both, so two buffers sharing a 64-bit key never return each other's values.
+    ///
+    /// Keys are spread over several shards, each with its own lock and an equal share of the byte budget, so
+    /// concurrent readers rarely contend. Two threads missing the same key at once may both decode it.
+    /// `prefetch` decodes keys on a background thread, which needs the fetch callable to be thread-safe.
+    /// @tparam T The data type of the decoded arrays
     template <typename T>
-    size_t dict_compress_buffer(
-        const std::span<const T> &data,
-        buffer_t &dictBuffer,
-        buffer_t &transposeBuffer,
-        buffer_t &outBuffer,
-        int level = ZSTD_defaultCLevel())
+    class DecodeCache
     {
-        dictBuffer.clear();
-        dict::dictionary_encode<T>(data, transposeBuffer, dictBuffer);
-        dictBuffer.shrink_to_fit();
+    public:
+        /// @brief A decoded array, shared with the cache
+        using value_t = std::shared_ptr<const std::vector<T>>;
+        /// @brief A callable returning the compressed buffer for a key
+        using fetch_t = std::function<buffer_span_t(uint64_t)>;
+        /// @brief A callable decoding a compressed buffer into an array
+        using decode_t = std::function<void(const buffer_span_t &, std::vector<T> &, const DecompressionParams &)>;
 
-        auto outputBound = ZSTD_compressBound(dictBuffer.size());
-        if (ZSTD_isError(outputBound))
+        /// @param fetch Returns the buffer for a key, needed by `get(key)` and `prefetch`
+        /// @param config The byte budget, shard count and decompression parameters
+        /// @param decode Decodes a buffer, `byteshuffle_decompress_buffer` if not given
+        DecodeCache(fetch_t fetch = nullptr, DecodeCacheConfig config = DecodeCacheConfig(), decode_t decode = nullptr)
+            : fetch_(std::move(fetch)), decode_(std::move(decode)), params_(config.params),
+              shards_(std::max<size_t>(config.shards, 1)),
+              shard_budget_(config.max_bytes / std::max<size_t>(config.shards, 1))
         {
-            auto errCode = ZSTD_getErrorCode(outputBound);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            if (!decode_)
+            {
+                decode_ = [](const buffer_span_t &buffer, std::vector<T> &dataBuffer, const DecompressionParams &params)
+                {
+                    buffer_t transposeBuffer;
+                    byteshuffle_decompress_buffer(buffer, transposeBuffer, dataBuffer, params);
+                };
+            }
         }
-        outBuffer.resize(outputBound);
-        auto used = ZSTD_compress(
-            (void *)outBuffer.data(),
-            outputBound,
-            (void *)dictBuffer.data(),
-            dictBuffer.size(),
-            level);
-        if (ZSTD_isError(used))
+
+        DecodeCache(const DecodeCache &) = delete;
+        DecodeCache &operator=(const DecodeCache &) = delete;
+
+        ~DecodeCache()
         {
-            auto errCode = ZSTD_getErrorCode(used);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            {
+                std::lock_guard<std::mutex> guard(prefetch_lock_);
+                stopping_ = true;
+            }
+            prefetch_ready_.notify_all();
+            if (prefetcher_.joinable())
+            {
+                prefetcher_.join();
+            }
         }
-        outBuffer.resize(used);
-        return 0;
-    }
 
-    template <typename T>
-    size_t dict_compress_buffer(
-        const std::vector<T> &data,
-        buffer_t &dictBuffer,
-        buffer_t &outBuffer,
-        int level = ZSTD_defaultCLevel())
-    {
-        buffer_t transposeBuffer;
-        return dict_compress_buffer<T>(data, dictBuffer, transposeBuffer, outBuffer, level);
-    }
+        /// @brief A key for a compressed buffer derived from its contents
+        static uint64_t key_of(const buffer_span_t &buffer)
+        {
+            return content_of(buffer).hash.low;
+        }
 
-    /// @brief Decompress an array of numerical data using dictionary encoding and ZSTD compression
-    /// @tparam T The data type of the array to compress
-    /// @param buffer A byte buffer containing ZSTD-compressed bytes
-    /// @param dictBuffer An intermediate byte buffer to hold the dictionary encoded bytes
-    /// @param dataBuffer The data array to decompress into
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
-    template <typename T>
-    size_t dict_decompress_buffer(
-        const buffer_span_t &buffer,
-        buffer_t &dictBuffer,
-        std::vector<T> &dataBuffer)
-    {
-        if (buffer.empty())
+        /// @brief The decoded array for `key`, fetching and decoding its buffer on a miss
+        value_t get(uint64_t key)
         {
-            dataBuffer.clear();
-            return 0;
+            if (auto value = lookup(key))
+            {
+                return value;
+            }
+            return insert(key, decode(fetch(key)), misses_);
         }
-        dictBuffer.clear();
-        auto outputBound = ZSTD_getFrameContentSize(buffer.data(), buffer.size());
-        if (ZSTD_isError(outputBound))
+
+        /// @brief The decoded array for `key`, decoding `buffer` on a miss
+        value_t get(uint64_t key, const buffer_span_t &buffer)
         {
-            auto errCode = ZSTD_getErrorCode(outputBound);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            if (auto value = lookup(key))
+            {
+                return value;
+            }
+            return insert(key, decode(buffer), misses_);
         }
-        dictBuffer.resize(outputBound);
-        auto used = ZSTD_decompress(
-            (void *)dictBuffer.data(),
-            outputBound,
-            (void *)buffer.data(),
-            buffer.size());
-        if (ZSTD_isError(used))
+
+        /// @brief The decoded array for `buffer`, keyed by `key_of(buffer)` and checked against its full hash
+        value_t get(const buffer_span_t &buffer)
         {
-            auto errCode = ZSTD_getErrorCode(used);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            const auto content = content_of(buffer);
+            if (auto value = lookup(content.hash.low, content))
+            {
+                return value;
+            }
+            return insert(content.hash.low, decode(buffer), misses_, content);
         }
-        dataBuffer.clear();
-        return dict::dictionary_decode(
-            dictBuffer,
-            dataBuffer);
-    }
 
-    /// @brief Compress an array of numerical data using ZSTD compression. Data will be stored in little-endian byte order
-    /// @tparam T The data type of the array to compress
-    /// @param data The data array to compress
-    /// @param outBuffer The byte buffer to compress into
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
-    template <typename T>
-    size_t compress_buffer(const std::span<const T> &data,
-                           buffer_t &outBuffer,
-                           int level = ZSTD_defaultCLevel())
-    {
-        auto outputBound = ZSTD_compressBound(data.size() * sizeof(T));
-        if (ZSTD_isError(outputBound))
+        /// @brief Queue `keys` to be decoded on the background thread if they are not cached yet. Keys whose fetch or
+        /// decode fails are skipped, so neighbours past either end of a run of keys are harmless.
+        void prefetch(const std::vector<uint64_t> &keys)
         {
-            auto errCode = ZSTD_getErrorCode(outputBound);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            if (!fetch_)
+            {
+                throw std::runtime_error("DecodeCache cannot prefetch without a fetch callable");
+            }
+            {
+                std::lock_guard<std::mutex> guard(prefetch_lock_);
+                prefetch_queue_.insert(prefetch_queue_.end(), keys.begin(), keys.end());
+                if (!prefetcher_.joinable())
+                {
+                    prefetcher_ = std::thread([this]()
+                                              { prefetch_work(); });
+                }
+            }
+            prefetch_ready_.notify_one();
         }
-        outBuffer.resize(outputBound);
-        if constexpr (binary::is_big_endian() && sizeof(T) > 1)
+
+        /// @brief Queue the `radius` keys on either side of `key` to be decoded on the background thread
+        void prefetch_around(uint64_t key, size_t radius = 1)
         {
-            buffer_t revEndian;
-            revEndian.reserve(data.size() * sizeof(T));
-            for (size_t i = 0; i < data.size(); i++)
+            std::vector<uint64_t> keys;
+            for (size_t i = 1; i <= radius; i++)
             {
-                const T val = data[i];
-                binary::byte_view<T> view = binary::byte_view<T>::as_little_endian(val);
-                std::copy(view.begin(), view.end(), std::back_inserter(revEndian));
+                keys.push_back(key + i);
+                if (key >= i)
+                {
+                    keys.push_back(key - i);
+                }
             }
-            auto used = ZSTD_compress(
-                (void *)outBuffer.data(),
-                outputBound,
-                (void *)revEndian.data(),
-                revEndian.size(),
-                level);
-            if (ZSTD_isError(used))
+            prefetch(keys);
+        }
+
+        /// @brief Block until every queued prefetch has finished
+        void wait_prefetch()
+        {
+            std::unique_lock<std::mutex> guard(prefetch_lock_);
+            prefetch_idle_.wait(guard, [&]()
+                                { return prefetch_queue_.empty() && !prefetch_busy_; });
+        }
+
+        /// @brief Whether `key` is cached, without counting a hit or miss or refreshing it
+        bool contains(uint64_t key) const
+        {
+            auto &shard = shards_[shard_index(key)];
+            std::lock_guard<std::mutex> guard(shard.lock);
+            return shard.entries.count(key) != 0;
+        }
+
+        /// @brief Drop `key` from the cache if it is there
+        void erase(uint64_t key)
+        {
+            auto &shard = shards_[shard_index(key)];
+            std::lock_guard<std::mutex> guard(shard.lock);
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end())
             {
-                auto errCode = ZSTD_getErrorCode(used);
-                std::stringstream ss;
-                ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-                throw std::runtime_error(ss.str());
+                shard.bytes -= it->second.bytes;
+                shard.order.erase(it->second.position);
+                shard.entries.erase(it);
             }
-            outBuffer.resize(used);
         }
-        else
+
+        /// @brief Drop every cached array
+        void clear()
         {
-            auto used = ZSTD_compress(
-                (void *)outBuffer.data(),
-                outputBound,
-                (void *)data.data(),
-                data.size() * sizeof(T),
-                level);
-            if (ZSTD_isError(used))
+            for (auto &shard : shards_)
             {
-                auto errCode = ZSTD_getErrorCode(used);
-                std::stringstream ss;
-                ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-                throw std::runtime_error(ss.str());
+                std::lock_guard<std::mutex> guard(shard.lock);
+                shard.entries.clear();
+                shard.order.clear();
+                shard.bytes = 0;
             }
-            outBuffer.resize(used);
         }
-        return 0;
-    }
 
-    /// @brief Decompress Zstd-compressed data back into it's native format.
-    /// @tparam T The data type of the array to decompress to
-    /// @param buffer A byte buffer containing containing little endian ZSTD-compressed bytes
-    /// @param dataBuffer The data array to decompress into. Data will be in native byte ordering
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
-    template <typename T>
-    size_t decompress_buffer(const buffer_span_t &buffer, std::vector<T> &dataBuffer)
-    {
-        if (buffer.empty())
+        DecodeCacheStats stats() const
         {
-            dataBuffer.clear();
-            return 0;
+            DecodeCacheStats result;
+            result.hits = hits_.load();
+            result.misses = misses_.load();
+            result.evictions = evictions_.load();
+            result.prefetched = prefetched_.load();
+            result.oversized = oversized_.load();
+            for (auto &shard : shards_)
+            {
+                std::lock_guard<std::mutex> guard(shard.lock);
+                result.bytes += shard.bytes;
+                result.entries += shard.entries.size();
+            }
+            return result;
         }
-        auto outputBound = ZSTD_getFrameContentSize(buffer.data(), buffer.size());
-        if (ZSTD_isError(outputBound))
+
+    private:
+        /// @brief What a buffer looked up by content is checked against on a hit
+        struct Content
         {
-            auto errCode = ZSTD_getErrorCode(outputBound);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            dedup::Hash128 hash;
+            size_t size = 0;
+
+            bool operator==(const Content &other) const = default;
+        };
+
+        struct Entry
+        {
+            value_t value;
+            size_t bytes = 0;
+            std::list<uint64_t>::iterator position;
+            /// @brief Set for arrays looked up by buffer alone
+            std::optional<Content> content;
+        };
+
+        struct Shard
+        {
+            mutable std::mutex lock;
+            /// @brief Keys from most to least recently used
+            std::list<uint64_t> order;
+            std::unordered_map<uint64_t, Entry> entries;
+            size_t bytes = 0;
+        };
+
+        fetch_t fetch_;
+        decode_t decode_;
+        DecompressionParams params_;
+        std::vector<Shard> shards_;
+        size_t shard_budget_;
+
+        std::atomic<uint64_t> hits_ = 0;
+        std::atomic<uint64_t> misses_ = 0;
+        std::atomic<uint64_t> evictions_ = 0;
+        std::atomic<uint64_t> prefetched_ = 0;
+        std::atomic<uint64_t> oversized_ = 0;
+
+        std::mutex prefetch_lock_;
+        std::condition_variable prefetch_ready_;
+        std::condition_variable prefetch_idle_;
+        std::deque<uint64_t> prefetch_queue_;
+        std::thread prefetcher_;
+        bool prefetch_busy_ = false;
+        bool stopping_ = false;
+
+        size_t shard_index(uint64_t key) const
+        {
+            // Mix the key so sequential ids spread evenly over the shards
+            auto mixed = (key ^ (key >> 33)) * 0xff51afd7ed558ccdull;
+            return (mixed ^ (mixed >> 33)) % shards_.size();
         }
-        dataBuffer.resize(outputBound / sizeof(T));
-        auto used = ZSTD_decompress(
-            (void *)dataBuffer.data(),
-            outputBound,
-            (void *)buffer.data(),
-            buffer.size());
-        if (ZSTD_isError(used))
+
+        buffer_span_t fetch(uint64_t key)
         {
-            auto errCode = ZSTD_getErrorCode(used);
-            std::stringstream ss;
-            ss << "Zstd error: " << errCode << " " << std::string(ZSTD_getErrorName(errCode)) << " " << std::string(ZSTD_getErrorString(errCode));
-            throw std::runtime_error(ss.str());
+            if (!fetch_)
+            {
+                throw std::runtime_error("DecodeCache cannot look up a key without a fetch callable");
+            }
+            return fetch_(key);
         }
-        dataBuffer.resize(used / sizeof(T));
-        if constexpr (binary::is_big_endian() && sizeof(T) > 1)
+
+        value_t decode(const buffer_span_t &buffer)
         {
-            for (size_t i = 0; i < dataBuffer.size(); i++)
+            auto decoded = std::make_shared<std::vector<T>>();
+            decode_(buffer, *decoded, params_);
+            return decoded;
+        }
+
+        static Content content_of(const buffer_span_t &buffer)
+        {
+            return Content{dedup::murmur3_128(buffer.data(), buffer.size()), buffer.size()};
+        }
+
+        /// @brief The cached array for `key`, which must also match `content` if given
+        value_t lookup(uint64_t key, const std::optional<Content> &content = std::nullopt)
+        {
+            auto &shard = shards_[shard_index(key)];
+            std::lock_guard<std::mutex> guard(shard.lock);
+            auto it = shard.entries.find(key);
+            if (it == shard.entries.end() || (content && it->second.content != content))
             {
-                T val = dataBuffer[i];
-                binary::byte_view<T> view(val);
-                view.byteswap();
-                dataBuffer[i] = view.value();
+                return nullptr;
             }
+            shard.order.splice(shard.order.begin(), shard.order, it->second.position);
+            hits_++;
+            return it->second.value;
         }
-        return 0;
-    }
 
-    /// @brief Compress an array of numerical data using ZSTD compression. Data will be stored in little-endian byte order.
-    /// @tparam T The data type of the array to compress
-    /// @param data The data array to compress
-    /// @param outBuffer The byte buffer to compress into
-    /// @return 0 if successful, some other value corresponding to a ZSTD error code otherwise
-    template <typename T>
-    size_t compress_buffer(const std::vector<T> &data,
-                           buffer_t &outBuffer,
-                           int level = ZSTD_defaultCLevel())
-    {
-        const std::span<const T> view(data.data(), data.size());
-        return compress_buffer(view, outBuffer, level);
-    }
+        /// @brief Store a freshly decoded array, evicting the least recently used ones to make room. An array larger
+        /// than a whole shard's budget is handed back without being kept, as is one whose key is already held by a
+        /// different buffer.
+        value_t insert(uint64_t key, value_t value, std::atomic<uint64_t> &counter, const std::optional<Content> &content = std::nullopt)
+        {
+            counter++;
+            const size_t bytes = value->size() * sizeof(T);
+            if (bytes > shard_budget_)
+            {
+                oversized_++;
+                return value;
+            }
+            auto &shard = shards_[shard_index(key)];
+            std::lock_guard<std::mutex> guard(shard.lock);
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end())
+            {
+                // Another thread decoded it first, share its copy, unless the key belongs to another buffer
+                return (content && it->second.content != content) ? value : it->second.value;
+            }
+            while (shard.bytes + bytes > shard_budget_)
+            {
+                auto victim = shard.entries.find(shard.order.back());
+                shard.bytes -= victim->second.bytes;
+                shard.entries.erase(victim);
+                shard.order.pop_back();
+                evictions_++;
+            }
+            shard.order.push_front(key);
+            shard.entries.emplace(key, Entry{value, bytes, shard.order.begin(), content});
+            shard.bytes += bytes;
+            return value;
+        }
+
+        void prefetch_work()
+        {
+            std::unique_lock<std::mutex> guard(prefetch_lock_);
+            while (true)
+            {
+                prefetch_ready_.wait(guard, [&]()
+                                     { return stopping_ || !prefetch_queue_.empty(); });
+                if (stopping_)
+                {
+                    return;
+                }
+                auto key = prefetch_queue_.front();
+                prefetch_queue_.pop_front();
+                prefetch_busy_ = true;
+                guard.unlock();
+                if (!contains(key))
+                {
+                    try
+                    {
+                        insert(key, decode(fetch_(key)), prefetched_);
+                    }
+                    catch (...)
+                    {
+                        // Prefetching is only a hint, a key that cannot be fetched or decoded is skipped
+                    }
+                }
+                guard.lock();
+                prefetch_busy_ = false;
+                if (prefetch_queue_.empty())
+                {
+                    prefetch_idle_.notify_all();
+                }
+            }
+        }
+    };
 }
 
-#endif
\ No newline at end of file
+#endif
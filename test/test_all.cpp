@@ -3,6 +3,8 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <cmath>
+#include <atomic>
 
 #include "../src/mzd.hpp"
 
@@ -73,6 +75,1254 @@ int test_decode_empty() {
     return 0;
 }
 
+template <typename T>
+int test_session(std::vector<T> &data)
+{
+    mzd::CompressionSession session;
+    buffer_t buffer;
+    std::vector<T> revert;
+
+    assert(session.byteshuffle_compress(data, buffer) == 0);
+    session.byteshuffle_decompress(buffer, revert);
+    assert(revert == data);
+
+    assert(session.dict_compress(data, buffer) == 0);
+    session.dict_decompress(buffer, revert);
+    assert(revert == data);
+
+    assert(session.compress(data, buffer) == 0);
+    session.decompress(buffer, revert);
+    assert(revert == data);
+
+    mzd::AdaptiveLevelConfig config;
+    config.window = 2;
+    session.enable_adaptive(config);
+    for (int i = 0; i < 8; i++)
+    {
+        assert(session.byteshuffle_compress(data, buffer, 1) == 0);
+        session.byteshuffle_decompress(buffer, revert);
+        assert(revert == data);
+    }
+    assert(session.adaptive().stats().at(1).calls == 8);
+    return 0;
+}
+
+int test_adaptive_controller()
+{
+    mzd::AdaptiveLevelConfig config;
+    config.budget = mzd::BudgetKind::Throughput;
+    config.target = 100.0;
+    config.window = 4;
+    config.initial_level = 3;
+    config.min_level = -3;
+    config.max_level = 6;
+    mzd::AdaptiveLevelController controller(config);
+
+    // 10 MB/s is far too slow, so the level should walk down through 1 into the negative fast levels and stop at the floor
+    for (int i = 0; i < 40; i++)
+    {
+        controller.observe(0, 1000000, 250000, 0.1, 0.1);
+    }
+    assert(controller.level_for(0) == -3);
+    assert(controller.stats().at(0).lowers == 5);
+    for (auto &decision : controller.decisions())
+    {
+        assert(decision.to_level != 0);
+        assert(decision.reason == mzd::DecisionReason::OverBudget);
+    }
+
+    // A separate array class is tuned independently. At 1000 MB/s it is raised, but each raise is only kept while the ratio improves
+    for (int i = 0; i < 24; i++)
+    {
+        int level = controller.level_for(1);
+        double ratio = 2.0 + 0.1 * std::min(level, 5);
+        controller.observe(1, 1000000, (size_t)(1000000 / ratio), 0.001, 0.01);
+    }
+    assert(controller.level_for(0) == -3);
+    assert(controller.level_for(1) == 5);
+    assert(controller.stats().at(1).raises == 3);
+    assert(controller.stats().at(1).ceiling == 5);
+    assert(controller.decisions().back().reason == mzd::DecisionReason::NoRatioGain);
+    assert(controller.decisions().back().from_level == 6);
+
+    mzd::AdaptiveLevelConfig cpu_config;
+    cpu_config.budget = mzd::BudgetKind::CpuShare;
+    cpu_config.target = 0.5;
+    cpu_config.window = 2;
+    cpu_config.initial_level = 3;
+    mzd::AdaptiveLevelController cpu_controller(cpu_config);
+    for (int i = 0; i < 4; i++)
+    {
+        cpu_controller.observe(0, 1000000, 500000, 0.09, 0.1);
+    }
+    assert(cpu_controller.level_for(0) == 1);
+    return 0;
+}
+
+int test_base64()
+{
+    std::vector<std::pair<std::string, std::string>> cases = {
+        {"", ""}, {"f", "Zg=="}, {"fo", "Zm8="}, {"foo", "Zm9v"}, {"foob", "Zm9vYg=="}, {"fooba", "Zm9vYmE="}, {"foobar", "Zm9vYmFy"}};
+    for (auto &[plain, encoded] : cases)
+    {
+        buffer_t bytes(plain.begin(), plain.end());
+        std::string text;
+        mzd::base64::encode(bytes, text);
+        assert(text == encoded);
+        buffer_t decoded;
+        mzd::base64::decode(text, decoded);
+        assert(decoded == bytes);
+    }
+
+    // Long enough inputs to exercise the vectorized paths, checked against a simple reference encoder
+    const char *alphabet = mzd::base64::alphabet;
+    for (size_t n = 0; n < 300; n++)
+    {
+        buffer_t bytes(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            bytes[i] = (byte_t)((i * 7919 + n * 31) >> 3);
+        }
+        std::string expected;
+        for (size_t i = 0; i < n; i += 3)
+        {
+            uint32_t group = bytes[i] << 16 | (i + 1 < n ? bytes[i + 1] << 8 : 0) | (i + 2 < n ? bytes[i + 2] : 0);
+            expected += alphabet[(group >> 18) & 63];
+            expected += alphabet[(group >> 12) & 63];
+            expected += i + 1 < n ? alphabet[(group >> 6) & 63] : '=';
+            expected += i + 2 < n ? alphabet[group & 63] : '=';
+        }
+        std::string text;
+        mzd::base64::encode(bytes, text);
+        assert(text == expected);
+        buffer_t decoded;
+        mzd::base64::decode(text, decoded);
+        assert(decoded == bytes);
+    }
+
+    bool threw = false;
+    try
+    {
+        buffer_t decoded;
+        mzd::base64::decode("Zm9vY!FyZm9vYmFyZm9vYmFyZm9vYmFy", decoded);
+    }
+    catch (std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    return 0;
+}
+
+template <typename T>
+int test_base64_codecs(std::vector<T> &data)
+{
+    std::string text;
+    buffer_t buffer;
+    buffer_t transposeBuffer;
+    std::vector<T> revert;
+
+    // The fused encoders must produce text any base64 decoder + the binary codec can read
+    mzd::byteshuffle_compress_base64(data, text);
+    mzd::base64::decode(text, buffer);
+    mzd::byteshuffle_decompress_buffer(buffer, transposeBuffer, revert);
+    assert(revert == data);
+    revert.clear();
+    mzd::byteshuffle_decompress_base64(text, transposeBuffer, revert);
+    assert(revert == data);
+
+    // and the fused decoders must read text produced by base64-encoding the binary codec's output
+    mzd::byteshuffle_compress_buffer(data, buffer);
+    text.clear();
+    mzd::base64::encode(buffer, text);
+    mzd::byteshuffle_decompress_base64(text, transposeBuffer, revert);
+    assert(revert == data);
+
+    buffer_t dictBuffer;
+    mzd::dict_compress_base64(data, dictBuffer, text);
+    mzd::dict_decompress_base64(text, dictBuffer, revert);
+    assert(revert == data);
+
+    mzd::compress_base64(data, text);
+    mzd::decompress_base64(text, revert);
+    assert(revert == data);
+    return 0;
+}
+
+int test_compression_params()
+{
+    std::vector<double> data;
+    for (size_t i = 0; i < 300000; i++)
+    {
+        data.push_back(200.0 + (i % 50000) * 0.000242);
+    }
+    buffer_t buffer;
+    buffer_t transposeBuffer;
+    std::vector<double> revert;
+
+    mzd::CompressionParams params(5);
+    params.long_distance_matching = true;
+    params.strategy = ZSTD_btopt;
+    params.checksum = true;
+    mzd::byteshuffle_compress_buffer(data, transposeBuffer, buffer, params);
+    mzd::byteshuffle_decompress_buffer(buffer, transposeBuffer, revert);
+    assert(revert == data);
+
+    // A frame with a 2^20 byte window is rejected when the decoder only permits 2^16
+    params = mzd::CompressionParams(3);
+    params.window_log = 20;
+    mzd::compress_buffer(data, buffer, params);
+    mzd::DecompressionParams limited;
+    limited.max_window_log = 16;
+    bool threw = false;
+    try
+    {
+        mzd::decompress_buffer(buffer, revert, limited);
+    }
+    catch (std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    limited.max_window_log = 20;
+    mzd::decompress_buffer(buffer, revert, limited);
+    assert(revert == data);
+
+    std::string text;
+    mzd::compress_base64(data, text, params);
+    limited.max_window_log = 16;
+    threw = false;
+    try
+    {
+        mzd::decompress_base64(text, revert, limited);
+    }
+    catch (std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    threw = false;
+    try
+    {
+        params.strategy = 1000;
+        mzd::compress_buffer(data, buffer, params);
+    }
+    catch (std::invalid_argument &)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    mzd::CompressionParams session_params(1);
+    session_params.long_distance_matching = true;
+    mzd::CompressionSession session(session_params);
+    session.dict_compress(data, buffer);
+    session.dict_decompress(buffer, revert);
+    assert(revert == data);
+    return 0;
+}
+
+template <typename T>
+std::vector<T> make_scan(size_t scan, size_t peaks)
+{
+    // A shared sampling grid where every scan drops a different subset of points
+    std::vector<T> mz;
+    for (size_t i = 0; i < peaks; i++)
+    {
+        if ((i * 7 + scan * 13) % 10 < 3)
+        {
+            continue;
+        }
+        double x = std::sqrt(200.0 + i * 0.37);
+        mz.push_back((T)(x * x + ((i + scan) % 5) * 1e-7));
+    }
+    return mz;
+}
+
+template <typename T>
+int test_reference()
+{
+    auto anchor = make_scan<T>(0, 20000);
+    auto data = make_scan<T>(1, 20000);
+    buffer_t buffer;
+    buffer_t transposeBuffer;
+    std::vector<T> revert;
+    for (auto mode : {mzd::reference::ResidualMode::Xor, mzd::reference::ResidualMode::Delta})
+    {
+        mzd::reference_compress_buffer(data, anchor, buffer, mode, 1, 3);
+        mzd::reference_decompress_buffer(buffer, anchor, revert);
+        assert(revert == data);
+    }
+
+    // Unsorted data is paired with the reference by position, including past its end
+    std::vector<T> shuffled(data.rbegin(), data.rend());
+    shuffled.insert(shuffled.end(), anchor.begin(), anchor.end());
+    mzd::reference_compress_buffer(shuffled, anchor, buffer);
+    mzd::reference_decompress_buffer(buffer, anchor, revert);
+    assert(revert == shuffled);
+
+    bool threw = false;
+    try
+    {
+        mzd::reference_decompress_buffer(buffer, data, revert);
+    }
+    catch (std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    for (auto target : {mzd::ReferenceTarget::Anchor, mzd::ReferenceTarget::Previous})
+    {
+        mzd::ReferenceConfig config;
+        config.target = target;
+        config.max_chain = 3;
+        mzd::ReferenceEncoder<T> encoder(config);
+        std::vector<std::vector<T>> scans;
+        std::vector<buffer_t> frames;
+        for (size_t i = 0; i < 10; i++)
+        {
+            scans.push_back(i == 6 ? make_scan<T>(i, 5000) : make_scan<T>(i, 20000));
+            frames.emplace_back();
+            auto info = encoder.encode(scans.back(), frames.back());
+            // Chains are cut every 3 frames, and on either side of the short scan 6
+            assert(info.is_anchor() == (i == 0 || i == 4 || i == 6 || i == 7));
+        }
+        mzd::ReferenceDecoder<T> decoder([&](uint64_t i)
+                                         { return buffer_span_t(frames[i]); });
+        for (size_t i : {9, 2, 3, 0, 7, 8})
+        {
+            decoder.decode(i, revert);
+            assert(revert == scans[i]);
+        }
+    }
+    return 0;
+}
+
+template <typename T>
+int test_grid(const std::vector<T> &profile)
+{
+    buffer_t buffer;
+    buffer_t shuffled;
+    std::vector<T> revert;
+    mzd::grid_compress_buffer(profile, buffer);
+    mzd::grid_decompress_buffer(buffer, revert);
+    assert(revert == profile);
+
+    // A TOF grid with gaps between peaks, and an Orbitrap grid, both sampled exactly
+    std::vector<T> tof;
+    std::vector<T> orbitrap;
+    for (size_t i = 0; i < 100000; i++)
+    {
+        if ((i / 40) % 3 == 1)
+        {
+            continue;
+        }
+        double r = std::sqrt(200.0) + 8.5e-6 * i;
+        tof.push_back((T)(r * r));
+        double f = 1.0 / std::sqrt(150.0) - 2.0e-7 * i;
+        orbitrap.push_back((T)(1.0 / (f * f)));
+    }
+    for (auto *grid : {&tof, &orbitrap})
+    {
+        mzd::grid_compress_buffer(*grid, buffer);
+        mzd::grid_decompress_buffer(buffer, revert);
+        assert(revert == *grid);
+        mzd::byteshuffle_compress_buffer(*grid, shuffled);
+        // Single precision keeps a rounding residual of about one unit in the last place, double precision far less
+        assert(buffer.size() * (sizeof(T) == 8 ? 20 : 1) < shuffled.size());
+    }
+
+    // Segments that fit no model, such as noise, zeros and non-finite values, are kept verbatim
+    std::vector<T> mixed(tof.begin(), tof.begin() + 5000);
+    for (size_t i = 0; i < 5000; i++)
+    {
+        mixed.push_back((T)((i * 7919) % 1013) - (T)500);
+    }
+    mixed.push_back(std::numeric_limits<T>::quiet_NaN());
+    mixed.push_back(std::numeric_limits<T>::infinity());
+    mixed.push_back((T)0);
+    mzd::grid_compress_buffer(mixed, buffer);
+    mzd::grid_decompress_buffer(buffer, revert);
+    assert(revert.size() == mixed.size() && std::memcmp(revert.data(), mixed.data(), mixed.size() * sizeof(T)) == 0);
+
+    std::vector<T> empty;
+    mzd::grid_compress_buffer(empty, buffer);
+    mzd::grid_decompress_buffer(buffer, revert);
+    assert(revert.empty());
+    return 0;
+}
+
+template <typename T>
+int test_sparse(const std::vector<T> &data)
+{
+    buffer_t buffer;
+    std::vector<T> revert;
+    mzd::sparse_compress_buffer(data, buffer);
+    mzd::sparse_decompress_buffer(buffer, revert);
+    assert(revert == data);
+
+    // Peaks separated by zeros are stored as runs; scattered values as a bitmap
+    std::vector<T> peaks(100000, T());
+    std::vector<T> scattered(100000, T());
+    uint32_t state = 12345;
+    auto next = [&state]()
+    {
+        state = state * 1103515245u + 12345u;
+        return (state >> 16) & 0x7fff;
+    };
+    for (size_t i = 0; i < peaks.size(); i += 200 + next() % 400)
+    {
+        for (size_t k = i; k < std::min(i + 12, peaks.size()); k++)
+        {
+            peaks[k] = (T)(next() % 1000 + 1);
+        }
+    }
+    for (size_t i = 0; i < scattered.size(); i++)
+    {
+        if (next() % 3 == 0)
+        {
+            scattered[i] = (T)(next() % 100 + 1);
+        }
+    }
+    buffer_t dense;
+    for (auto *array : {&peaks, &scattered})
+    {
+        mzd::sparse_compress_buffer(*array, buffer);
+        assert(buffer[6] == (array == &peaks ? (uint8_t)mzd::sparse::Layout::Runs : (uint8_t)mzd::sparse::Layout::Bitmap));
+        mzd::sparse_decompress_buffer(buffer, revert);
+        assert(revert == *array);
+        mzd::byteshuffle_compress_buffer(*array, dense);
+        assert(buffer.size() < dense.size());
+    }
+
+    std::vector<T> zeros(1000, T());
+    mzd::sparse_compress_buffer(zeros, buffer);
+    mzd::sparse_decompress_buffer(buffer, revert);
+    assert(revert == zeros);
+    return 0;
+}
+
+template <typename Stored, typename Out>
+int test_decode_as(const std::vector<Stored> &data)
+{
+    std::vector<Out> expected(data.begin(), data.end());
+    buffer_t buffer;
+    buffer_t scratch;
+    std::vector<Out> revert;
+    constexpr auto stored = mzd::dtype_of<Stored>();
+
+    mzd::byteshuffle_compress_buffer(data, buffer);
+    mzd::byteshuffle_decompress_buffer_as<Stored>(buffer, scratch, revert);
+    assert(revert == expected);
+    revert.clear();
+    mzd::byteshuffle_decompress_buffer_as(stored, buffer, scratch, revert);
+    assert(revert == expected);
+
+    mzd::dict_compress_buffer(data, scratch, buffer);
+    mzd::dict_decompress_buffer_as<Stored>(buffer, scratch, revert);
+    assert(revert == expected);
+    mzd::dict_decompress_buffer_as(stored, buffer, scratch, revert);
+    assert(revert == expected);
+
+    mzd::compress_buffer(data, buffer);
+    mzd::decompress_buffer_as<Stored>(buffer, revert);
+    assert(revert == expected);
+    revert.clear();
+    mzd::decompress_buffer_as(stored, buffer, revert);
+    assert(revert == expected);
+    return 0;
+}
+
+int test_dtype_conversion()
+{
+    static_assert(mzd::dtype_of<int8_t>() == mzd::DType::Int8);
+    static_assert(mzd::dtype_of<uint16_t>() == mzd::DType::UInt16);
+    static_assert(mzd::dtype_of<int64_t>() == mzd::DType::Int64);
+    static_assert(mzd::dtype_of<float>() == mzd::DType::Float32);
+
+    // Long enough that the streaming decoder hands over several blocks, with values straddling block boundaries
+    std::vector<float> intensities;
+    std::vector<int32_t> counts;
+    std::vector<uint8_t> charges;
+    for (size_t i = 0; i < 100001; i++)
+    {
+        intensities.push_back(i % 3 == 0 ? 0.0f : 1000.0f + (float)(i % 977) * 0.125f);
+        counts.push_back((int32_t)(i * 2654435761u % 100000) - 50000);
+        charges.push_back((uint8_t)(i % 5));
+    }
+    assert((test_decode_as<float, double>(intensities) == 0));
+    assert((test_decode_as<float, float>(intensities) == 0));
+    assert((test_decode_as<int32_t, double>(counts) == 0));
+    assert((test_decode_as<int32_t, int64_t>(counts) == 0));
+    assert((test_decode_as<uint8_t, float>(charges) == 0));
+    // Narrowing goes through the streaming decoder rather than widening in place
+    assert((test_decode_as<double, float>(std::vector<double>(intensities.begin(), intensities.end())) == 0));
+    return 0;
+}
+
+int test_chunked()
+{
+    std::vector<double> mz;
+    std::vector<float> intensity;
+    for (size_t i = 0; i < 50000; i++)
+    {
+        mz.push_back(200.0 + i * 0.0242);
+        intensity.push_back((float)((i * 7919) % 1000));
+    }
+    buffer_t mzBuffer;
+    buffer_t intensityBuffer;
+    std::vector<double> revert;
+    mzd::chunked::Options options;
+    options.chunk_size = 1000;
+    mzd::chunked_compress_buffer(mz, mzBuffer, 3, options);
+    mzd::chunked_decompress_buffer(mzBuffer, revert);
+    assert(revert == mz);
+
+    // A narrow m/z window in a sorted array decodes a single chunk
+    std::vector<size_t> positions;
+    auto decoded = mzd::decompress_where(mzBuffer, 500.1, 500.3, revert, &positions);
+    assert(decoded == 1);
+    std::vector<double> expected;
+    for (auto value : mz)
+    {
+        if (500.1 <= value && value <= 500.3)
+        {
+            expected.push_back(value);
+        }
+    }
+    assert(!expected.empty() && revert == expected);
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        assert(mz[positions[i]] == revert[i]);
+    }
+
+    // The matching intensities are read from just the chunks holding those positions
+    options.store_sums = true;
+    mzd::chunked_compress_buffer(intensity, intensityBuffer, 3, options);
+    std::vector<float> peaks;
+    mzd::chunked_decompress_range(intensityBuffer, positions.front(), positions.back() + 1, peaks);
+    assert(peaks.size() == positions.size());
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        assert(peaks[i] == intensity[positions[i]]);
+    }
+
+    // Unsorted arrays check each chunk's range, and sums total an array without decoding it
+    auto index = mzd::chunked::read_index<float>(intensityBuffer);
+    assert(!index.sorted && index.has_sums && index.chunks.size() == 50);
+    double total = 0;
+    for (auto &chunk : index.chunks)
+    {
+        total += chunk.sum;
+    }
+    double direct = 0;
+    for (auto value : intensity)
+    {
+        direct += value;
+    }
+    assert(total == direct);
+    std::vector<float> loud;
+    mzd::decompress_where(intensityBuffer, 990.0f, 2000.0f, loud);
+    assert(loud.size() == (size_t)std::count_if(intensity.begin(), intensity.end(), [](float v)
+                                                 { return v >= 990.0f; }));
+    assert(mzd::decompress_where(intensityBuffer, 1000.0f, 2000.0f, loud) == 0 && loud.empty());
+
+    std::vector<double> empty;
+    mzd::chunked_compress_buffer(empty, mzBuffer);
+    mzd::chunked_decompress_buffer(mzBuffer, revert);
+    assert(revert.empty());
+    assert(mzd::decompress_where(mzBuffer, 0.0, 1.0, revert) == 0);
+    return 0;
+}
+
+template <typename T>
+int test_intpack(const std::vector<T> &data)
+{
+    buffer_t buffer;
+    std::vector<T> revert;
+    for (bool zstd_stage : {false, true})
+    {
+        mzd::intpack_compress_buffer(data, buffer, zstd_stage);
+        mzd::intpack_decompress_buffer(buffer, revert);
+        assert(revert == data);
+    }
+    return 0;
+}
+
+int test_integer_packing()
+{
+    std::vector<int32_t> scans;
+    std::vector<int8_t> charges;
+    std::vector<uint16_t> counts;
+    std::vector<int64_t> extremes = {std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(), 0, -1, 1};
+    std::vector<uint64_t> wide = {std::numeric_limits<uint64_t>::max(), 0, 1ull << 63, 12345};
+    for (size_t i = 0; i < 1000; i++)
+    {
+        scans.push_back((int32_t)(i * 3 + (i % 7)));
+        charges.push_back((int8_t)(i % 11 == 0 ? -1 : 1 + i % 4));
+        counts.push_back((uint16_t)((i * 2654435761u) >> 20));
+    }
+    assert(test_intpack(scans) == 0);
+    assert(test_intpack(charges) == 0);
+    assert(test_intpack(counts) == 0);
+    assert(test_intpack(extremes) == 0);
+    assert(test_intpack(wide) == 0);
+    assert(test_intpack(std::vector<int32_t>()) == 0);
+    assert(test_intpack(std::vector<int32_t>(300, 42)) == 0);
+
+    // Sorted scan numbers are stored as small deltas, a few bits per value
+    buffer_t buffer;
+    mzd::intpack_compress_buffer(scans, buffer);
+    assert(buffer.size() < scans.size());
+
+    // A header claiming more values than its blocks can hold is rejected before the output is sized
+    buffer_t scratch;
+    mzd::intpack_compress_buffer(scans, scratch, buffer, false);
+    buffer_t corrupt(buffer.begin(), buffer.begin() + mzd::intpack::header_size);
+    for (size_t i = 0; i < 8; i++)
+    {
+        corrupt[8 + i] = i == 7 ? 0x10 : 0;
+    }
+    std::string message;
+    try
+    {
+        std::vector<int32_t> revert;
+        mzd::intpack_decompress_buffer(corrupt, revert);
+    }
+    catch (std::runtime_error &e)
+    {
+        message = e.what();
+    }
+    assert(message.find("Malformed packed integer frame") != std::string::npos);
+    return 0;
+}
+
+template <typename T>
+int test_batch()
+{
+    std::vector<std::vector<T>> arrays;
+    size_t separate = 0;
+    uint32_t state = 7;
+    for (size_t i = 0; i < 300; i++)
+    {
+        std::vector<T> values;
+        size_t n = i % 50 == 0 ? 0 : 20 + (i * 31) % 400;
+        T value = (T)100;
+        for (size_t j = 0; j < n; j++)
+        {
+            state = state * 1664525u + 1013904223u;
+            value += (T)(1 + (state >> 28));
+            values.push_back(value);
+        }
+        buffer_t compressed;
+        mzd::byteshuffle_compress_buffer(values, compressed);
+        separate += compressed.size();
+        arrays.push_back(std::move(values));
+    }
+
+    buffer_t batched;
+    mzd::batch_compress_buffer(arrays, batched);
+    assert(mzd::batch_member_count<T>(batched) == arrays.size());
+    assert(batched.size() < separate);
+
+    std::vector<T> values;
+    std::vector<uint64_t> offsets;
+    mzd::batch_decompress_buffer(batched, values, offsets);
+    assert(offsets.size() == arrays.size() + 1);
+    for (size_t i = 0; i < arrays.size(); i++)
+    {
+        assert(std::equal(arrays[i].begin(), arrays[i].end(), values.begin() + offsets[i], values.begin() + offsets[i + 1]));
+    }
+
+    buffer_t scratch;
+    for (size_t i : {0ul, 1ul, 150ul, 299ul})
+    {
+        std::vector<T> member;
+        mzd::batch_decompress_member(batched, i, scratch, member);
+        assert(member == arrays[i]);
+    }
+
+    bool threw = false;
+    try
+    {
+        std::vector<T> member;
+        mzd::batch_decompress_member(batched, arrays.size(), member);
+    }
+    catch (std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    return 0;
+}
+
+int test_pipeline()
+{
+    std::vector<std::vector<double>> arrays;
+    for (size_t i = 0; i < 200; i++)
+    {
+        std::vector<double> values;
+        // Bursts of large arrays between small ones
+        size_t n = i % 25 == 0 ? 20000 : 100 + (i * 37) % 900;
+        for (size_t j = 0; j < n; j++)
+        {
+            values.push_back(200.0 + j * 0.001 + i);
+        }
+        arrays.push_back(std::move(values));
+    }
+
+    std::vector<uint64_t> order;
+    std::vector<buffer_t> written;
+    mzd::PipelineConfig config;
+    config.workers = 4;
+    config.max_in_flight_bytes = 64 * 1024;
+    size_t callbacks = 0;
+    {
+        mzd::CompressionPipeline pipeline([&](uint64_t sequence, buffer_t &&compressed)
+                                          {
+                                              order.push_back(sequence);
+                                              written.push_back(std::move(compressed)); },
+                                          config);
+        std::vector<std::future<size_t>> sizes;
+        for (size_t i = 0; i < arrays.size(); i++)
+        {
+            auto codec = i % 3 == 0 ? mzd::PipelineCodec::Dict : (i % 3 == 1 ? mzd::PipelineCodec::ByteShuffle : mzd::PipelineCodec::Zstd);
+            if (i % 10 == 0)
+            {
+                pipeline.submit(arrays[i], codec, [&](size_t size, std::exception_ptr error)
+                                {
+                                    assert(!error && size > 0);
+                                    callbacks++; });
+                sizes.emplace_back();
+            }
+            else
+            {
+                sizes.push_back(pipeline.submit(arrays[i], codec));
+            }
+        }
+        pipeline.flush();
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            if (sizes[i].valid())
+            {
+                assert(sizes[i].get() == written[i].size());
+            }
+        }
+        // The budget holds except for a single oversized array admitted on its own
+        assert(pipeline.peak_in_flight_bytes() <= std::max<size_t>(config.max_in_flight_bytes, 20000 * sizeof(double)));
+        assert(pipeline.in_flight_bytes() == 0 && pipeline.released() == arrays.size());
+
+        // A failing task is skipped by the sink and reported through its future
+        auto failed = pipeline.submit_task(8, [](mzd::CompressionSession &, buffer_t &)
+                                           { throw std::runtime_error("task failed"); });
+        bool threw = false;
+        try
+        {
+            failed.get();
+        }
+        catch (std::runtime_error &)
+        {
+            threw = true;
+        }
+        assert(threw);
+    }
+    assert(callbacks == 20);
+
+    // A throwing callback is reported by flush instead of escaping the worker, and a sink that submits is refused
+    {
+        size_t refused = 0;
+        mzd::CompressionPipeline *self = nullptr;
+        mzd::CompressionPipeline pipeline([&](uint64_t, buffer_t &&)
+                                          {
+                                              try
+                                              {
+                                                  self->submit(std::vector<double>(10, 1.0));
+                                              }
+                                              catch (std::runtime_error &)
+                                              {
+                                                  refused++;
+                                              } },
+                                          config);
+        self = &pipeline;
+        pipeline.submit(arrays[1], mzd::PipelineCodec::ByteShuffle, [](size_t, std::exception_ptr)
+                        { throw std::runtime_error("callback failed"); });
+        auto after = pipeline.submit(arrays[2]);
+        bool threw = false;
+        try
+        {
+            pipeline.flush();
+        }
+        catch (std::runtime_error &)
+        {
+            threw = true;
+        }
+        assert(threw && after.get() > 0 && refused == 2);
+        pipeline.flush();
+    }
+
+    assert(order.size() == arrays.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        assert(order[i] == i);
+        std::vector<double> revert;
+        buffer_t scratch;
+        if (i % 3 == 0)
+        {
+            mzd::dict_decompress_buffer(written[i], scratch, revert);
+        }
+        else if (i % 3 == 1)
+        {
+            mzd::byteshuffle_decompress_buffer(written[i], scratch, revert);
+        }
+        else
+        {
+            mzd::decompress_buffer(written[i], revert);
+        }
+        assert(revert == arrays[i]);
+    }
+    return 0;
+}
+
+int test_decode_cache()
+{
+    std::vector<std::vector<double>> arrays;
+    std::vector<buffer_t> buffers;
+    for (size_t i = 0; i < 50; i++)
+    {
+        std::vector<double> values;
+        for (size_t j = 0; j < 1000; j++)
+        {
+            values.push_back(100.0 + i + j * 0.01);
+        }
+        buffer_t compressed;
+        mzd::byteshuffle_compress_buffer(values, compressed);
+        arrays.push_back(std::move(values));
+        buffers.push_back(std::move(compressed));
+    }
+    auto fetch = [&](uint64_t key) -> buffer_span_t
+    {
+        if (key >= buffers.size())
+        {
+            throw std::runtime_error("No such array");
+        }
+        return buffers[key];
+    };
+
+    // Room for 8 arrays in each of two shards
+    mzd::DecodeCacheConfig config;
+    config.shards = 2;
+    config.max_bytes = 2 * 8 * 1000 * sizeof(double);
+    mzd::DecodeCache<double> cache(fetch, config);
+
+    auto first = cache.get(3);
+    assert(*first == arrays[3]);
+    assert(cache.get(3) == first);
+    assert(cache.stats().hits == 1 && cache.stats().misses == 1);
+
+    for (uint64_t key = 0; key < buffers.size(); key++)
+    {
+        assert(*cache.get(key) == arrays[key]);
+    }
+    auto stats = cache.stats();
+    assert(stats.evictions > 0 && stats.bytes <= config.max_bytes && stats.entries <= 16);
+    // An evicted array stays valid for whoever still holds it
+    assert(!cache.contains(3) && *first == arrays[3]);
+
+    // Keyed by content when the caller has no id
+    auto by_content = cache.get(buffer_span_t(buffers[7]));
+    assert(*by_content == arrays[7]);
+    assert(cache.contains(mzd::DecodeCache<double>::key_of(buffers[7])));
+    assert(cache.get(buffer_span_t(buffers[7])) == by_content);
+
+    // A key held by a different buffer, as after a 64-bit collision, is not trusted by a content lookup
+    const auto taken = mzd::DecodeCache<double>::key_of(buffers[9]);
+    assert(*cache.get(taken, buffers[8]) == arrays[8]);
+    assert(*cache.get(buffer_span_t(buffers[9])) == arrays[9]);
+    assert(*cache.get(taken) == arrays[8]);
+
+    // Arrays over a shard's share of the budget are decoded but not kept
+    std::vector<double> large(10000, 1.5);
+    buffer_t large_buffer;
+    mzd::byteshuffle_compress_buffer(large, large_buffer);
+    const auto oversized = cache.stats().oversized;
+    assert(*cache.get(1000, large_buffer) == large);
+    assert(!cache.contains(1000) && cache.stats().oversized == oversized + 1);
+    mzd::DecodeCacheConfig single = config;
+    single.shards = 1;
+    mzd::DecodeCache<double> unsharded(fetch, single);
+    assert(*unsharded.get(1000, large_buffer) == large);
+    assert(unsharded.contains(1000) && unsharded.stats().oversized == 0);
+
+    // Neighbours past the end are skipped
+    cache.clear();
+    cache.prefetch_around(48, 2);
+    cache.wait_prefetch();
+    assert(cache.stats().prefetched == 3);
+    auto hits = cache.stats().hits;
+    assert(*cache.get(47) == arrays[47]);
+    assert(cache.stats().hits == hits + 1);
+
+    std::vector<std::thread> readers;
+    std::atomic<size_t> mismatches = 0;
+    for (size_t t = 0; t < 4; t++)
+    {
+        readers.emplace_back([&, t]()
+                             {
+                                 for (size_t i = 0; i < 200; i++)
+                                 {
+                                     uint64_t key = (i * 7 + t) % buffers.size();
+                                     if (*cache.get(key) != arrays[key])
+                                     {
+                                         mismatches++;
+                                     }
+                                 } });
+    }
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    assert(mismatches == 0);
+    stats = cache.stats();
+    assert(stats.bytes <= config.max_bytes);
+
+    cache.clear();
+    assert(cache.stats().entries == 0 && cache.stats().bytes == 0);
+    return 0;
+}
+
+template <typename T>
+int test_byte_planes(const std::vector<T> &data)
+{
+    buffer_t plain;
+    mzd::byteshuffle_compress_buffer(data, plain);
+    for (bool parallel : {false, true})
+    {
+        buffer_t compressed;
+        mzd::byteshuffle_planes_compress_buffer(data, compressed, 3, parallel);
+        assert(mzd::planes::is_plane_frame(compressed));
+
+        buffer_t scratch;
+        std::vector<T> revert;
+        mzd::byteshuffle_decompress_buffer(compressed, scratch, revert);
+        assert(revert == data);
+
+        std::vector<double> widened;
+        mzd::byteshuffle_decompress_buffer_as<T>(compressed, scratch, widened);
+        assert(widened.size() == data.size() && (data.empty() || widened.back() == (double)data.back()));
+
+        mzd::CompressionSession session;
+        session.byteshuffle_decompress(compressed, revert);
+        assert(revert == data);
+    }
+    // Plain frames are still read the same way
+    assert(!mzd::planes::is_plane_frame(plain));
+    return 0;
+}
+
+int test_plane_coding()
+{
+    std::vector<double> noisy;
+    uint64_t state = 11;
+    double mz = 150.0;
+    for (size_t i = 0; i < 20000; i++)
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        mz += 0.001 + (double)(state >> 40) / (double)(1ull << 24) * 0.01;
+        noisy.push_back(mz);
+    }
+    assert(test_byte_planes(noisy) == 0);
+
+    // The constant and noise planes are identified
+    buffer_t compressed;
+    mzd::byteshuffle_planes_compress_buffer(noisy, compressed);
+    auto mode_of = [&](size_t plane)
+    {
+        return (mzd::planes::PlaneMode)compressed[mzd::planes::header_size + plane * mzd::planes::plane_entry_size];
+    };
+    assert(mode_of(0) == mzd::planes::PlaneMode::Raw);
+    assert(mode_of(7) == mzd::planes::PlaneMode::Constant);
+
+    std::vector<float> intensities(5000, 0.0f);
+    for (size_t i = 0; i < intensities.size(); i += 3)
+    {
+        intensities[i] = (float)(i % 97) * 10.5f;
+    }
+    assert(test_byte_planes(intensities) == 0);
+    assert(test_byte_planes(std::vector<int32_t>(1000, 42)) == 0);
+    assert(test_byte_planes(std::vector<double>()) == 0);
+    return 0;
+}
+
+template <typename T>
+int test_xor_stream_values(const std::vector<T> &data)
+{
+    mzd::XorStreamEncoder<T> encoder;
+    std::vector<T> revert;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        encoder.append(data[i]);
+        // The stream is complete after every append
+        if (i % 97 == 0 || i + 1 == data.size())
+        {
+            mzd::xor_decompress_buffer(encoder.buffer(), revert);
+            assert(revert.size() == i + 1);
+            assert(std::memcmp(revert.data(), data.data(), (i + 1) * sizeof(T)) == 0);
+        }
+    }
+
+    buffer_t compressed;
+    mzd::xor_compress_buffer(data, compressed);
+    assert(compressed == encoder.buffer());
+
+    // Re-opening a stream continues it exactly
+    const size_t half = data.size() / 2;
+    mzd::XorStreamEncoder<T> first;
+    first.append(std::span<const T>(data.data(), half));
+    auto resumed = mzd::XorStreamEncoder<T>::resume(first.buffer());
+    resumed.append(std::span<const T>(data.data() + half, data.size() - half));
+    assert(resumed.buffer() == compressed);
+    return 0;
+}
+
+int test_xor_stream()
+{
+    std::vector<double> tic;
+    std::vector<double> times;
+    uint64_t state = 5;
+    for (size_t i = 0; i < 3000; i++)
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        times.push_back(i * 0.25);
+        tic.push_back(std::round(1e6 * (1.5 + std::sin(i / 50.0)) + (double)(state >> 44)));
+    }
+    tic[10] = -0.0;
+    tic[11] = std::numeric_limits<double>::quiet_NaN();
+    tic[12] = std::numeric_limits<double>::infinity();
+    tic[13] = std::numeric_limits<double>::denorm_min();
+    assert(test_xor_stream_values(tic) == 0);
+    assert(test_xor_stream_values(times) == 0);
+    assert(test_xor_stream_values(std::vector<float>(tic.begin(), tic.end())) == 0);
+    assert(test_xor_stream_values(std::vector<double>(100, 42.0)) == 0);
+    assert(test_xor_stream_values(std::vector<double>()) == 0);
+
+    buffer_t compressed;
+    mzd::xor_compress_buffer(times, compressed);
+    assert(compressed.size() < times.size() * sizeof(double) / 2);
+    return 0;
+}
+
+int test_dictionary_index_width()
+{
+    // Dictionaries of exactly 255 or 65535 values still fit one or two byte indices, on either side of each width
+    for (size_t distinct : {254ul, 255ul, 256ul, 65535ul, 65536ul})
+    {
+        std::vector<double> data;
+        for (size_t i = 0; i < distinct + 5000; i++)
+        {
+            data.push_back((double)((i * 7919) % distinct));
+        }
+        buffer_t dictBuffer;
+        buffer_t compressed;
+        mzd::dict_compress_buffer(data, dictBuffer, compressed);
+        std::vector<double> revert;
+        mzd::dict_decompress_buffer(compressed, revert);
+        assert(revert == data);
+        mzd::dict_decompress_buffer(compressed, dictBuffer, revert);
+        assert(revert == data);
+        mzd::CompressionSession session;
+        session.dict_decompress(compressed, revert);
+        assert(revert == data);
+    }
+    return 0;
+}
+
+int test_dedup()
+{
+    // The hash is the reference MurmurHash3_x64_128
+    auto empty = mzd::dedup::murmur3_128(nullptr, 0);
+    assert(empty.low == 0 && empty.high == 0);
+    const std::string text = "The quick brown fox jumps over the lazy dog";
+    auto hash = mzd::dedup::murmur3_128((const byte_t *)text.data(), text.size());
+    assert(hash.low == 0xe34bbc7bbc071b6cull && hash.high == 0x7a433ca9c49a9347ull);
+
+    // A shared m/z axis repeated by most spectra, with a few distinct arrays between them
+    std::vector<double> axis;
+    for (size_t i = 0; i < 2000; i++)
+    {
+        axis.push_back(100.0 + i * 0.0137);
+    }
+    std::vector<std::vector<double>> arrays;
+    for (size_t i = 0; i < 100; i++)
+    {
+        if (i % 10 == 3)
+        {
+            std::vector<double> other(axis.begin(), axis.begin() + 500 + i);
+            other.back() += 1.0;
+            arrays.push_back(std::move(other));
+        }
+        else
+        {
+            arrays.push_back(axis);
+        }
+    }
+    arrays.push_back({});
+    arrays.push_back({});
+
+    buffer_t deduplicated;
+    buffer_t plain;
+    mzd::batch_compress_buffer(arrays, deduplicated);
+    mzd::batch_compress_buffer(arrays, plain, mzd::CompressionParams(), false);
+    assert(deduplicated.size() < plain.size());
+
+    for (auto *buffer : {&deduplicated, &plain})
+    {
+        std::vector<double> values;
+        std::vector<uint64_t> offsets;
+        mzd::batch_decompress_buffer(*buffer, values, offsets);
+        assert(offsets.size() == arrays.size() + 1);
+        for (size_t i = 0; i < arrays.size(); i++)
+        {
+            assert(std::equal(arrays[i].begin(), arrays[i].end(), values.begin() + offsets[i], values.begin() + offsets[i + 1]));
+        }
+        for (size_t i : {0ul, 3ul, 57ul, 99ul, 101ul})
+        {
+            std::vector<double> member;
+            mzd::batch_decompress_member(*buffer, i, member);
+            assert(member == arrays[i]);
+        }
+    }
+
+    // Repeats resolve to the decoded array of their first occurrence
+    std::vector<std::shared_ptr<const std::vector<double>>> members;
+    mzd::batch_decompress_shared(deduplicated, members);
+    assert(members.size() == arrays.size());
+    for (size_t i = 0; i < arrays.size(); i++)
+    {
+        assert(*members[i] == arrays[i]);
+    }
+    assert(members[0] == members[99]);
+    assert(members[3] != members[13]);
+    assert(members[100] == members[101]);
+    mzd::batch_decompress_shared(plain, members);
+    assert(members[0] != members[99] && *members[0] == *members[99]);
+
+    mzd::ArrayDeduplicator<uint8_t> bytes;
+    std::vector<uint8_t> a = {1, 2, 3};
+    std::vector<uint8_t> b = {1, 2, 3};
+    std::vector<uint8_t> c = {1, 2, 4};
+    assert(bytes.find_or_insert(a) == 0);
+    assert(bytes.find_or_insert(c) == 1);
+    assert(bytes.find_or_insert(b) == 0);
+    assert(bytes.seen() == 3 && bytes.duplicates() == 1 && bytes.collisions() == 0);
+
+    // Equal hashes are only a candidate. With every array colliding, arrays that differ in their bytes or share
+    // a prefix under a different length still do not match.
+    mzd::ArrayDeduplicator<uint8_t> colliding(false, [](const byte_t *, size_t)
+                                              { return mzd::dedup::Hash128{1, 2}; });
+    std::vector<uint8_t> prefix = {1, 2};
+    std::vector<uint8_t> none;
+    assert(colliding.find_or_insert(a) == 0);
+    assert(colliding.find_or_insert(c) == 1);
+    assert(colliding.find_or_insert(prefix) == 2);
+    assert(colliding.find_or_insert(none) == 3);
+    assert(colliding.find_or_insert(b) == 0);
+    assert(colliding.find_or_insert(std::vector<uint8_t>()) == 3);
+    assert(colliding.duplicates() == 2);
+    assert(colliding.collisions() == 1 + 2 + 3 + 3);
+
+    mzd::ArrayDeduplicator<double> retained(true);
+    {
+        std::vector<double> transient = axis;
+        assert(retained.find_or_insert(transient) == 0);
+    }
+    assert(retained.find_or_insert(axis) == 0);
+    return 0;
+}
+
+template <typename T>
+int test_fields()
+{
+    uint32_t state = 11;
+    auto next = [&state]()
+    {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    };
+    std::vector<T> mzs;
+    std::vector<T> intensities;
+    T mz = (T)150;
+    for (size_t i = 0; i < 10001; i++)
+    {
+        mz += (T)(0.001 * (1 + next() % 2000));
+        mzs.push_back(mz);
+        intensities.push_back((T)((next() % 100000) * 0.25));
+    }
+    std::vector<T> special = {(T)0, -(T)0, std::numeric_limits<T>::infinity(), -std::numeric_limits<T>::infinity(),
+                              std::numeric_limits<T>::quiet_NaN(), std::numeric_limits<T>::denorm_min(),
+                              -std::numeric_limits<T>::max(), std::numeric_limits<T>::min(), (T)-1.5};
+    for (size_t i = 0; i < 40; i++)
+    {
+        special.push_back(i % 2 ? -intensities[i] : mzs[i]);
+    }
+
+    // Sorted arrays delta code their exponents, unordered ones store them as they are
+    assert(mzd::fields::prefer_delta(mzs.data(), mzs.size()));
+    assert(!mzd::fields::prefer_delta(intensities.data(), intensities.size()));
+
+    // Compare bit patterns, as the special values hold a NaN and a negative zero
+    auto same_bits = [](const std::vector<T> &a, const std::vector<T> &b)
+    {
+        return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+    };
+
+    buffer_t scratch;
+    for (const auto *data : {&mzs, &intensities, &special})
+    {
+        for (size_t n : {(size_t)0, (size_t)1, (size_t)31, (size_t)33, data->size()})
+        {
+            std::vector<T> values(data->begin(), data->begin() + std::min(n, data->size()));
+            buffer_t compressed;
+            mzd::fields_compress_buffer(values, scratch, compressed);
+            std::vector<T> decoded;
+            mzd::fields_decompress_buffer(compressed, scratch, decoded);
+            assert(same_bits(decoded, values));
+
+            // The vector kernels lay out the streams exactly as the scalar ones do
+            for (bool delta : {false, true})
+            {
+                const size_t count = values.size();
+                std::vector<byte_t> signs((count + 7) / 8);
+                std::vector<byte_t> expected_signs((count + 7) / 8);
+                std::vector<byte_t> planes(mzd::fields::plane_bytes<T>(count));
+                std::vector<byte_t> expected_planes(planes.size());
+                mzd::fields::split(values.data(), count, delta, signs.data(), planes.data());
+                mzd::fields::split_scalar(values.data(), 0, count, delta, expected_signs.data(), expected_planes.data());
+                assert(signs == expected_signs && planes == expected_planes);
+                std::vector<T> merged(count);
+                mzd::fields::merge(signs.data(), planes.data(), count, delta, merged.data());
+                assert(same_bits(merged, values));
+            }
+        }
+    }
+
+    buffer_t compressed;
+    mzd::fields_compress_buffer(mzs, compressed);
+    bool threw = false;
+    try
+    {
+        std::vector<std::conditional_t<sizeof(T) == 8, float, double>> wrong;
+        mzd::fields_decompress_buffer(compressed, wrong);
+    }
+    catch (std::runtime_error &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    return 0;
+}
+
 int main()
 {
     std::cout << "testing double ========================================" << std::endl;
@@ -151,5 +1401,78 @@ int main()
     test_decode_empty<int>();
     test_decode_empty<char>();
 
+    std::cout << "testing compression session ========================================" << std::endl;
+    std::reverse(data_float.begin(), data_float.end());
+    assert(test_session(data_float) == 0);
+    assert(test_session(data_int) == 0);
+
+    std::cout << "testing adaptive level controller ========================================" << std::endl;
+    assert(test_adaptive_controller() == 0);
+
+    std::cout << "testing base64 ========================================" << std::endl;
+    assert(test_base64() == 0);
+    assert(test_base64_codecs(data_float) == 0);
+    assert(test_base64_codecs(data_int) == 0);
+    std::vector<double> data_large;
+    for (size_t i = 0; i < 50000; i++)
+    {
+        data_large.push_back(i % 3 == 0 ? 0.0 : 200.0 + i * 0.000242 + (i % 7) * 1e-9);
+    }
+    assert(test_base64_codecs(data_large) == 0);
+
+    std::cout << "testing compression parameters ========================================" << std::endl;
+    assert(test_compression_params() == 0);
+
+    std::cout << "testing reference compression ========================================" << std::endl;
+    assert(test_reference<double>() == 0);
+    assert(test_reference<float>() == 0);
+
+    std::cout << "testing grid compression ========================================" << std::endl;
+    assert(test_grid(data_double) == 0);
+    assert(test_grid(data_float) == 0);
+
+    std::cout << "testing sparse compression ========================================" << std::endl;
+    assert(test_sparse(data_double) == 0);
+    assert(test_sparse(data_float) == 0);
+    assert(test_sparse(data_int) == 0);
+    std::vector<double> signed_zeros = {0.0, -0.0, 1.0, 0.0, -0.0};
+    assert(test_sparse(signed_zeros) == 0);
+
+    std::cout << "testing decoding with dtype conversion ========================================" << std::endl;
+    assert(test_dtype_conversion() == 0);
+
+    std::cout << "testing chunked compression and range queries ========================================" << std::endl;
+    assert(test_chunked() == 0);
+
+    std::cout << "testing integer packing ========================================" << std::endl;
+    assert(test_integer_packing() == 0);
+
+    std::cout << "testing batch compression ========================================" << std::endl;
+    assert(test_batch<double>() == 0);
+    assert(test_batch<float>() == 0);
+    assert(test_batch<int32_t>() == 0);
+
+    std::cout << "testing compression pipeline ========================================" << std::endl;
+    assert(test_pipeline() == 0);
+
+    std::cout << "testing decode cache ========================================" << std::endl;
+    assert(test_decode_cache() == 0);
+
+    std::cout << "testing per-plane byte shuffle coding ========================================" << std::endl;
+    assert(test_plane_coding() == 0);
+
+    std::cout << "testing XOR stream coding ========================================" << std::endl;
+    assert(test_xor_stream() == 0);
+
+    std::cout << "testing dictionary index widths ========================================" << std::endl;
+    assert(test_dictionary_index_width() == 0);
+
+    std::cout << "testing array deduplication ========================================" << std::endl;
+    assert(test_dedup() == 0);
+
+    std::cout << "testing float field splitting ========================================" << std::endl;
+    assert(test_fields<double>() == 0);
+    assert(test_fields<float>() == 0);
+
     return 0;
 }
\ No newline at end of file
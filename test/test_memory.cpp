@@ -0,0 +1,218 @@
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "../src/mzd.hpp"
+
+// Peak memory checks replace the global allocator, so they live in their own executable rather than in test_all
+
+// Track the bytes allocated through operator new so decoders' peak memory can be checked
+namespace heap
+{
+    std::atomic<size_t> current = 0;
+    std::atomic<size_t> peak = 0;
+
+    // Stored just in front of each allocation
+    struct Header
+    {
+        void *raw;
+        size_t size;
+    };
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        const size_t align = std::max(alignment, alignof(std::max_align_t));
+        auto raw = static_cast<unsigned char *>(std::malloc(size + sizeof(Header) + align));
+        if (raw == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        const auto start = reinterpret_cast<uintptr_t>(raw + sizeof(Header));
+        auto ptr = reinterpret_cast<unsigned char *>((start + align - 1) & ~(uintptr_t)(align - 1));
+        const Header header{raw, size};
+        std::memcpy(ptr - sizeof(Header), &header, sizeof(Header));
+        auto now = current += size;
+        auto seen = peak.load();
+        while (now > seen && !peak.compare_exchange_weak(seen, now))
+        {
+        }
+        return ptr;
+    }
+
+    void release(void *ptr) noexcept
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        Header header;
+        std::memcpy(&header, static_cast<unsigned char *>(ptr) - sizeof(Header), sizeof(Header));
+        current -= header.size;
+        std::free(header.raw);
+    }
+
+    /// @brief The most bytes allocated at once while running `fn`, beyond what was allocated before it
+    template <typename F>
+    size_t peak_during(F &&fn)
+    {
+        const size_t before = current.load();
+        peak = before;
+        fn();
+        return peak.load() - before;
+    }
+}
+
+void *operator new(size_t size)
+{
+    return heap::allocate(size);
+}
+
+void *operator new[](size_t size)
+{
+    return heap::allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return heap::allocate(size, (size_t)alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return heap::allocate(size, (size_t)alignment);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    heap::release(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    heap::release(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    heap::release(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    heap::release(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    heap::release(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    heap::release(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+    heap::release(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept
+{
+    heap::release(ptr);
+}
+
+int test_scratch_free_decode()
+{
+    const size_t n = 1 << 20;
+    std::vector<double> mz;
+    std::vector<float> levels;
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; i < n; i++)
+    {
+        mz.push_back(100.0 + i * 0.0007 + std::sin(i * 0.01));
+        levels.push_back((float)(i % 300) * 0.5f);
+        bytes.push_back((uint8_t)((i * 7) % 256));
+    }
+    const size_t slack = 64 * 1024;
+
+    buffer_t compressed;
+    mzd::byteshuffle_compress_buffer(mz, compressed);
+    std::vector<double> revert;
+    auto buffered = heap::peak_during([&]()
+                                      {
+                                          buffer_t transposeBuffer;
+                                          mzd::byteshuffle_decompress_buffer(compressed, transposeBuffer, revert); });
+    assert(revert == mz);
+    revert = std::vector<double>();
+    auto streamed = heap::peak_during([&]()
+                                      { mzd::byteshuffle_decompress_buffer(compressed, revert); });
+    assert(revert == mz);
+    assert(buffered >= 2 * n * sizeof(double));
+    assert(streamed <= n * sizeof(double) + slack);
+    // A large enough output is re-used
+    assert(heap::peak_during([&]()
+                             { mzd::byteshuffle_decompress_buffer(compressed, revert); }) <= slack);
+
+    mzd::byteshuffle_planes_compress_buffer(mz, compressed);
+    revert = std::vector<double>();
+    streamed = heap::peak_during([&]()
+                                 { mzd::byteshuffle_decompress_buffer(compressed, revert); });
+    assert(revert == mz);
+    assert(streamed <= n * sizeof(double) + slack);
+
+    // 300 distinct values, so the dictionary and its lookup table are tiny next to the array
+    buffer_t dictCompressed;
+    {
+        buffer_t dictBuffer;
+        mzd::dict_compress_buffer(levels, dictBuffer, dictCompressed);
+    }
+    std::vector<float> levelsRevert;
+    buffered = heap::peak_during([&]()
+                                 {
+                                     buffer_t dictBuffer;
+                                     mzd::dict_decompress_buffer(dictCompressed, dictBuffer, levelsRevert); });
+    assert(levelsRevert == levels);
+    levelsRevert = std::vector<float>();
+    streamed = heap::peak_during([&]()
+                                 { mzd::dict_decompress_buffer(dictCompressed, levelsRevert); });
+    assert(levelsRevert == levels);
+    assert(buffered > n * sizeof(float) + n * sizeof(uint16_t));
+    assert(streamed <= n * sizeof(float) + slack);
+
+    // Indices wider than the values themselves still decode
+    buffer_t byteCompressed;
+    {
+        buffer_t dictBuffer;
+        mzd::dict_compress_buffer(bytes, dictBuffer, byteCompressed);
+    }
+    std::vector<uint8_t> bytesRevert;
+    mzd::dict_decompress_buffer(byteCompressed, bytesRevert);
+    assert(bytesRevert == bytes);
+    return 0;
+}
+
+int main()
+{
+    std::cout << "testing scratch-free decoding ========================================" << std::endl;
+    assert(test_scratch_free_decode() == 0);
+
+    std::cout << "testing over-aligned allocations ========================================" << std::endl;
+    struct alignas(64) Line
+    {
+        unsigned char bytes[64];
+    };
+    const size_t before = heap::current.load();
+    {
+        std::vector<Line> lines(100);
+        assert(reinterpret_cast<uintptr_t>(lines.data()) % 64 == 0);
+        assert(heap::current.load() == before + 100 * sizeof(Line));
+    }
+    assert(heap::current.load() == before);
+    return 0;
+}